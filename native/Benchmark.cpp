@@ -0,0 +1,1342 @@
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "native.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "lzma/LzFind.h"
+#include "lzma/LzFindMt.h"
+#include "lzma/LzmaEnc.h"
+#include "lzma/LzmaDec.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static double ElapsedSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double MegabytesPerSecond(size_t size, double seconds)
+{
+	return seconds > 0 ? (double)size / (1 << 20) / seconds : 0;
+}
+
+static void *BenchmarkAlloc(void *p, size_t size) { p = p; return size ? malloc(size) : NULL; }
+static void BenchmarkFree(void *p, void *address) { p = p; free(address); }
+static ISzAlloc g_BenchmarkAlloc = { BenchmarkAlloc, BenchmarkFree };
+
+struct BenchmarkInStream
+{
+	ISeqInStream vt;
+	const unsigned char *data;
+	size_t size;
+	size_t offset;
+};
+
+static SRes BenchmarkInStream_Read(void *p, void *buf, size_t *size)
+{
+	BenchmarkInStream *s = static_cast<BenchmarkInStream*>(p);
+	if(*size > s->size - s->offset)
+		*size = s->size - s->offset;
+	memcpy(buf, s->data + s->offset, *size);
+	s->offset += *size;
+	return SZ_OK;
+}
+
+void NativeBenchmarkFillInput(unsigned char *buffer, size_t size, unsigned seed)
+{
+	static const char *kWords[] = {
+		"int ", "return ", "if ", "else ", "for ", "while ", "(p->", "size", "buffer", "index",
+		" = ", " == ", " != ", "; ", ")\n", "{\n", "}\n", "\t", "  ", "0", "1", "Byte ", "UInt32 ",
+	};
+	const size_t kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+	unsigned state = seed * 2654435761u + 1;
+	size_t pos = 0;
+	while(pos < size)
+	{
+		state = state * 1103515245u + 12345u;
+		if(((state >> 16) & 15) == 0)
+		{
+			buffer[pos++] = (unsigned char)(state >> 24);
+			continue;
+		}
+		const char *word = kWords[(state >> 16) % kNumWords];
+		while(*word && pos < size)
+			buffer[pos++] = (unsigned char)*word++;
+	}
+}
+
+static size_t AppendText(unsigned char *buffer, size_t size, size_t pos, const char *text)
+{
+	while(*text && pos < size)
+		buffer[pos++] = (unsigned char)*text++;
+	return pos;
+}
+
+static size_t AppendNumber(unsigned char *buffer, size_t size, size_t pos, unsigned value, int minDigits)
+{
+	char digits[16];
+	int count = 0;
+	do
+	{
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	}
+	while(value != 0 || count < minDigits);
+	while(count > 0 && pos < size)
+		buffer[pos++] = (unsigned char)digits[--count];
+	return pos;
+}
+
+void NativeBenchmarkFillCorpus(unsigned char *buffer, size_t size, NativeBenchmarkCorpus corpus, unsigned seed)
+{
+	static const char *kLevels[] = { "INFO ", "INFO ", "INFO ", "DEBUG", "WARN ", "ERROR" };
+	static const char *kPaths[] = { "/api/v1/items", "/api/v1/items/search", "/api/v1/users", "/health", "/static/app.js" };
+	static const char *kNames[] = { "widget", "gadget", "sprocket", "gizmo", "doohickey", "thingamajig" };
+
+	if(corpus == NativeBenchmarkCorpus_Source)
+	{
+		NativeBenchmarkFillInput(buffer, size, seed);
+		return;
+	}
+
+	unsigned state = seed * 2654435761u + 1;
+	unsigned time = 0;
+	size_t pos = 0;
+	while(pos < size)
+	{
+		state = state * 1103515245u + 12345u;
+		unsigned r = state >> 8;
+		time += 1 + r % 250;
+		if(corpus == NativeBenchmarkCorpus_Log)
+		{
+			pos = AppendText(buffer, size, pos, "2026-10-17 ");
+			pos = AppendNumber(buffer, size, pos, time / 3600000 % 24, 2);
+			pos = AppendText(buffer, size, pos, ":");
+			pos = AppendNumber(buffer, size, pos, time / 60000 % 60, 2);
+			pos = AppendText(buffer, size, pos, ":");
+			pos = AppendNumber(buffer, size, pos, time / 1000 % 60, 2);
+			pos = AppendText(buffer, size, pos, ".");
+			pos = AppendNumber(buffer, size, pos, time % 1000, 3);
+			pos = AppendText(buffer, size, pos, " ");
+			pos = AppendText(buffer, size, pos, kLevels[r % 6]);
+			pos = AppendText(buffer, size, pos, " [worker-");
+			pos = AppendNumber(buffer, size, pos, (r >> 3) % 8, 1);
+			pos = AppendText(buffer, size, pos, "] GET ");
+			pos = AppendText(buffer, size, pos, kPaths[(r >> 6) % 5]);
+			pos = AppendText(buffer, size, pos, " status=");
+			pos = AppendNumber(buffer, size, pos, (r >> 9) % 16 ? 200 : 404, 3);
+			pos = AppendText(buffer, size, pos, " ms=");
+			pos = AppendNumber(buffer, size, pos, (r >> 13) % 100, 1);
+			pos = AppendText(buffer, size, pos, "\n");
+		}
+		else
+		{
+			pos = AppendText(buffer, size, pos, "  {\n    \"id\": ");
+			pos = AppendNumber(buffer, size, pos, time, 1);
+			pos = AppendText(buffer, size, pos, ",\n    \"name\": \"");
+			pos = AppendText(buffer, size, pos, kNames[r % 6]);
+			pos = AppendText(buffer, size, pos, "\",\n    \"price\": ");
+			pos = AppendNumber(buffer, size, pos, (r >> 3) % 1000, 1);
+			pos = AppendText(buffer, size, pos, ".");
+			pos = AppendNumber(buffer, size, pos, (r >> 13) % 100, 2);
+			pos = AppendText(buffer, size, pos, ",\n    \"active\": ");
+			pos = AppendText(buffer, size, pos, (r >> 20) & 1 ? "true" : "false");
+			pos = AppendText(buffer, size, pos, ",\n    \"tags\": [ \"");
+			pos = AppendText(buffer, size, pos, kNames[(r >> 21) % 6]);
+			pos = AppendText(buffer, size, pos, "\", \"");
+			pos = AppendText(buffer, size, pos, kNames[(r >> 4) % 6]);
+			pos = AppendText(buffer, size, pos, "\" ]\n  },\n");
+		}
+	}
+}
+
+int NativeBenchmarkBlockThreadScaling(NativeBenchmarkScalingResult *results, int maxResults,
+	size_t inputSize, int level, int maxBlockThreads, bool useThreadPool)
+{
+	if(maxBlockThreads < 1 || inputSize == 0)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> output(inputSize + inputSize / 2 + (1 << 16));
+	NativeBenchmarkFillInput(&input[0], inputSize, 1);
+
+	CLzmaEncProps levelProps;
+	LzmaEncProps_Init(&levelProps);
+	levelProps.level = level;
+	UInt32 levelDictSize = LzmaEncProps_GetDictSize(&levelProps);
+
+	NativeThreadPool *pool = useThreadPool ? NativeCreateThreadPool() : NULL;
+	NativeSetThreadPool(pool);
+
+	int count = 0;
+	for(int threads = 1; count < maxResults; threads = threads * 2 < maxBlockThreads ? threads * 2 : maxBlockThreads)
+	{
+		const size_t kMinBlockSize = 1 << 16;
+		size_t blockSize = (inputSize + threads - 1) / threads;
+		if(blockSize < kMinBlockSize)
+			blockSize = kMinBlockSize;
+
+		// A block coder never looks back past the start of its block, so a dictionary
+		// larger than the block only costs allocation and match finder setup.
+		UInt32 dictSize = levelDictSize;
+		if(dictSize > blockSize)
+			dictSize = (UInt32)blockSize;
+
+		NativeBenchmarkScalingResult &r = results[count++];
+		r.blockThreads = threads;
+		r.packedSize = output.size();
+
+		unsigned char prop;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		r.result = NativeLzmaCompress2(&output[0], &r.packedSize, &input[0], inputSize, &prop,
+			level, dictSize, -1, -1, -1, -1, -1, -1, -1, 0, 0, -1, (int)blockSize, threads, -1);
+		r.seconds = ElapsedSeconds(start);
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+
+		if(threads == maxBlockThreads)
+			break;
+	}
+
+	NativeSetThreadPool(NULL);
+	NativeDestroyThreadPool(pool);
+	return count;
+}
+
+static SRes RunMatchFinderMt(const unsigned char *input, size_t inputSize, unsigned dictSize, bool lockFree, unsigned *checksum)
+{
+	// same setup as LzmaEnc uses for btMode with numHashBytes = 4 and fb = 32
+	const UInt32 kBeforeSize = 1 << 12;
+	const UInt32 kNumFastBytes = 32;
+	const UInt32 kMatchLenMax = 273;
+
+	CMatchFinder mf;
+	CMatchFinderMt mt;
+	IMatchFinder vt;
+	MatchFinder_Construct(&mf);
+	MatchFinderMt_Construct(&mt);
+	mt.MatchFinder = &mf;
+	mf.btMode = 1;
+	mf.numHashBytes = 4;
+	mf.cutValue = 16 + (kNumFastBytes >> 1);
+	mf.bigHash = (dictSize > (1 << 24));
+	MatchFinderMt_SetLockFree(&mt, lockFree ? True : False);
+
+	BenchmarkInStream stream = { { BenchmarkInStream_Read }, input, inputSize, 0 };
+	SRes res = MatchFinderMt_Create(&mt, dictSize, kBeforeSize, kNumFastBytes, kMatchLenMax, &g_BenchmarkAlloc);
+	if(res == SZ_OK)
+	{
+		UInt32 matches[kMatchLenMax * 2 + 2 + 1];
+		unsigned sum = 0;
+		MatchFinderMt_CreateVTable(&mt, &vt);
+		mf.stream = &stream.vt;
+		vt.Init(&mt);
+		while(vt.GetNumAvailableBytes(&mt) != 0)
+		{
+			UInt32 num = vt.GetMatches(&mt, matches);
+			for(UInt32 i = 0; i < num; i++)
+				sum = sum * 31 + matches[i];
+		}
+		MatchFinderMt_ReleaseStream(&mt);
+		res = mf.result;
+		*checksum = sum;
+	}
+	MatchFinderMt_Destruct(&mt, &g_BenchmarkAlloc);
+	MatchFinder_Free(&mf, &g_BenchmarkAlloc);
+	return res;
+}
+
+int NativeBenchmarkMatchFinderHandoff(NativeBenchmarkMatchFinderResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize)
+{
+	if(inputSize == 0)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	NativeBenchmarkFillInput(&input[0], inputSize, 1);
+
+	int count = 0;
+	for(int mode = 0; mode < 2 && count < maxResults; mode++)
+	{
+		NativeBenchmarkMatchFinderResult &r = results[count++];
+		r.lockFree = (mode != 0);
+		r.checksum = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		r.result = RunMatchFinderMt(&input[0], inputSize, dictSize, r.lockFree, &r.checksum);
+		r.seconds = ElapsedSeconds(start);
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+	}
+	return count;
+}
+
+int NativeBenchmarkHashThreads(NativeBenchmarkHashThreadsResult *results, int maxResults,
+	size_t inputSize, int level, int maxHashThreads, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> reference;
+	NativeBenchmarkFillInput(&input[0], inputSize, 1);
+
+	int count = 0;
+	for(int hashThreads = 1; hashThreads <= maxHashThreads && count < maxResults; hashThreads *= 2)
+	{
+		NativeBenchmarkHashThreadsResult &r = results[count++];
+		r.numHashThreads = hashThreads;
+		r.seconds = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			CLzmaEncProps props;
+			LzmaEncProps_Init(&props);
+			props.level = level;
+			props.algo = 1;
+			props.btMode = 1;
+			props.numThreads = 2;
+			props.numHashThreads = hashThreads;
+			SizeT packedSize = packed.size();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			CLzmaEncHandle enc = LzmaEnc_Create(&g_BenchmarkAlloc);
+			if(enc == NULL)
+				r.result = SZ_ERROR_MEM;
+			else
+			{
+				r.result = LzmaEnc_SetProps(enc, &props);
+				if(r.result == SZ_OK)
+					r.result = LzmaEnc_MemEncode(enc, &packed[0], &packedSize, &input[0], inputSize, 0, NULL, &g_BenchmarkAlloc, &g_BenchmarkAlloc);
+				LzmaEnc_Destroy(enc, &g_BenchmarkAlloc, &g_BenchmarkAlloc);
+			}
+			double seconds = ElapsedSeconds(start);
+			if(run == 0 || seconds < r.seconds)
+				r.seconds = seconds;
+			r.packedSize = r.result == SZ_OK ? packedSize : 0;
+		}
+		if(hashThreads == 1)
+			reference.assign(packed.begin(), packed.begin() + r.packedSize);
+		r.identical = r.result == SZ_OK && r.packedSize == reference.size() &&
+			(r.packedSize == 0 || memcmp(&packed[0], &reference[0], r.packedSize) == 0);
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+		r.speedup = r.seconds > 0 ? results[0].seconds / r.seconds : 0;
+	}
+	return count;
+}
+
+int NativeBenchmarkWaitSpin(NativeBenchmarkWaitSpinResult *results, int maxResults,
+	size_t inputSize, size_t blockSize, int blockThreads, int level)
+{
+	if(inputSize == 0 || blockSize == 0 || blockThreads < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> output(inputSize + inputSize / 2 + (1 << 16));
+	NativeBenchmarkFillInput(&input[0], inputSize, 1);
+
+	const UInt32 kSpinCounts[] = { 0, THREAD_WAIT_SPIN_DEFAULT };
+	UInt32 prevSpinCount = Thread_GetWaitSpin();
+	int count = 0;
+	for(int mode = 0; mode < 2 && count < maxResults; mode++)
+	{
+		NativeBenchmarkWaitSpinResult &r = results[count++];
+		r.maxSpinCount = kSpinCounts[mode];
+		r.packedSize = output.size();
+		Thread_SetWaitSpin(r.maxSpinCount);
+		TraceResetWaitCounters();
+
+		unsigned char prop;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		r.result = NativeLzmaCompress2(&output[0], &r.packedSize, &input[0], inputSize, &prop,
+			level, 0, -1, -1, -1, -1, -1, -1, -1, 0, 0, -1, (int)blockSize, blockThreads, -1);
+		r.seconds = ElapsedSeconds(start);
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+
+		TraceWaitCounters counters;
+		TraceGetWaitCounters(&counters);
+#ifdef ENABLE_WAIT_COUNTERS
+		r.counted = true;
+#else
+		r.counted = false;
+#endif
+		r.spins = counters.spins;
+		r.parks = counters.parks;
+	}
+	Thread_SetWaitSpin(prevSpinCount);
+	return count;
+}
+
+static SRes DecodeWithKernel(unsigned kernel, unsigned char *dest, size_t destLen, const unsigned char *src, size_t *srcLen,
+	const unsigned char *props, unsigned propsSize, ELzmaStatus *status, size_t *outLen)
+{
+	CLzmaDec dec;
+	LzmaDec_Construct(&dec);
+	*outLen = 0;
+	*status = LZMA_STATUS_NOT_SPECIFIED;
+	SRes res = LzmaDec_AllocateProbs(&dec, props, propsSize, &g_BenchmarkAlloc);
+	if(res != SZ_OK)
+		return res;
+	dec.kernel = kernel;
+	dec.dic = dest;
+	dec.dicBufSize = destLen;
+	LzmaDec_Init(&dec);
+	res = LzmaDec_DecodeToDic(&dec, destLen, src, srcLen, LZMA_FINISH_END, status);
+	*outLen = dec.dicPos;
+	LzmaDec_FreeProbs(&dec, &g_BenchmarkAlloc);
+	return res;
+}
+
+int NativeBenchmarkDecodeKernel(NativeBenchmarkDecodeKernelResult *results, int maxResults,
+	size_t inputSize, int level, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output(inputSize);
+	NativeBenchmarkFillInput(&input[0], inputSize, 1);
+
+	unsigned char props[LZMA_PROPS_SIZE];
+	size_t propsSize = sizeof(props);
+	size_t packedSize = packed.size();
+	if(NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+		level, 0, -1, -1, -1, -1, -1, -1, -1, 0, 1, 1) != StatusCode_Ok)
+		return 0;
+
+	const unsigned kKernels[] = { LZMA_DEC_KERNEL_PORTABLE, LZMA_DEC_KERNEL_X64 };
+	int numKernels = (LzmaDec_GetDefaultKernel() == LZMA_DEC_KERNEL_X64) ? 2 : 1;
+	int count = 0;
+	for(int i = 0; i < numKernels && count < maxResults; i++)
+	{
+		NativeBenchmarkDecodeKernelResult &r = results[count++];
+		r.kernel = kKernels[i];
+		r.seconds = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			memset(&output[0], 0, inputSize);
+			size_t srcLen = packedSize;
+			size_t outLen;
+			ELzmaStatus status;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			r.result = DecodeWithKernel(r.kernel, &output[0], inputSize, &packed[0], &srcLen,
+				props, (unsigned)propsSize, &status, &outLen);
+			double seconds = ElapsedSeconds(start);
+			if(run == 0 || seconds < r.seconds)
+				r.seconds = seconds;
+			r.exact = (r.result == SZ_OK && outLen == inputSize && memcmp(&output[0], &input[0], inputSize) == 0);
+		}
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+	}
+	return count;
+}
+
+int NativeCompareDecodeKernels(size_t maxInputSize, int numStreams, unsigned seed)
+{
+	if(LzmaDec_GetDefaultKernel() != LZMA_DEC_KERNEL_X64)
+		return -1;
+	if(maxInputSize == 0)
+		return 0;
+
+	std::vector<unsigned char> input(maxInputSize);
+	std::vector<unsigned char> packed(maxInputSize + maxInputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output1(maxInputSize + 1);
+	std::vector<unsigned char> output2(maxInputSize + 1);
+
+	unsigned state = seed * 2654435761u + 1;
+	int mismatches = 0;
+	for(int i = 0; i < numStreams; i++)
+	{
+		state = state * 1103515245u + 12345u;
+		size_t inputSize = 1 + (size_t)(state >> 8) % maxInputSize;
+		NativeBenchmarkFillInput(&input[0], inputSize, state);
+
+		unsigned char props[LZMA_PROPS_SIZE];
+		size_t propsSize = sizeof(props);
+		size_t packedSize = packed.size();
+		int lc = (state >> 4) % 5, lp = (state >> 7) % 3, pb = (state >> 10) % 3;
+		if(NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+			1 + (state >> 13) % 9, 0, lc, lp, pb, -1, -1, -1, -1, 0, (state >> 16) & 1, 1) != StatusCode_Ok)
+		{
+			mismatches++;
+			continue;
+		}
+
+		// 0 - intact, 1 - corrupted bytes, 2 - truncated, 3 - random bytes
+		switch((state >> 20) & 3)
+		{
+		case 1:
+			for(int n = 1 + (state >> 22) % 8; n > 0; n--)
+			{
+				state = state * 1103515245u + 12345u;
+				packed[(state >> 8) % packedSize] ^= (unsigned char)(1 + (state >> 24) % 255);
+			}
+			break;
+		case 2:
+			packedSize = (state >> 8) % packedSize;
+			break;
+		case 3:
+			for(size_t n = 1; n < packedSize; n++)
+			{
+				state = state * 1103515245u + 12345u;
+				packed[n] = (unsigned char)(state >> 24);
+			}
+			break;
+		}
+
+		size_t srcLen1 = packedSize, srcLen2 = packedSize;
+		size_t outLen1, outLen2;
+		ELzmaStatus status1, status2;
+		SRes res1 = DecodeWithKernel(LZMA_DEC_KERNEL_PORTABLE, &output1[0], inputSize, &packed[0], &srcLen1,
+			props, (unsigned)propsSize, &status1, &outLen1);
+		SRes res2 = DecodeWithKernel(LZMA_DEC_KERNEL_X64, &output2[0], inputSize, &packed[0], &srcLen2,
+			props, (unsigned)propsSize, &status2, &outLen2);
+		if(res1 != res2 || status1 != status2 || srcLen1 != srcLen2 || outLen1 != outLen2
+			|| memcmp(&output1[0], &output2[0], outLen1) != 0)
+			mismatches++;
+	}
+	return mismatches;
+}
+
+int NativeBenchmarkMatchCopy(NativeBenchmarkMatchCopyResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output(inputSize);
+
+	const NativeBenchmarkCorpus kCorpora[] = { NativeBenchmarkCorpus_Source, NativeBenchmarkCorpus_Log, NativeBenchmarkCorpus_Json };
+	int count = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		NativeBenchmarkFillCorpus(&input[0], inputSize, kCorpora[i], 1);
+		unsigned char props[LZMA_PROPS_SIZE];
+		size_t propsSize = sizeof(props);
+		size_t packedSize = packed.size();
+		if(NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+			5, dictSize, -1, -1, -1, -1, -1, -1, -1, 0, 1, 1) != StatusCode_Ok)
+			continue;
+
+		for(int ring = 0; ring < 2 && count < maxResults; ring++)
+		{
+			NativeBenchmarkMatchCopyResult &r = results[count++];
+			r.corpus = kCorpora[i];
+			r.ring = ring != 0;
+			r.packedSize = packedSize;
+			r.seconds = 0;
+			for(int run = 0; run < runs; run++)
+			{
+				memset(&output[0], 0, inputSize);
+				size_t srcLen = packedSize;
+				size_t outLen = inputSize;
+				ELzmaStatus status;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				if(ring)
+				{
+					CLzmaDec dec;
+					LzmaDec_Construct(&dec);
+					r.result = LzmaDec_Allocate(&dec, props, (unsigned)propsSize, &g_BenchmarkAlloc);
+					if(r.result == SZ_OK)
+					{
+						LzmaDec_Init(&dec);
+						r.result = LzmaDec_DecodeToBuf(&dec, &output[0], &outLen, &packed[0], &srcLen, LZMA_FINISH_END, &status);
+						LzmaDec_Free(&dec, &g_BenchmarkAlloc);
+					}
+				}
+				else
+				{
+					r.result = DecodeWithKernel(LzmaDec_GetDefaultKernel(), &output[0], inputSize, &packed[0], &srcLen,
+						props, (unsigned)propsSize, &status, &outLen);
+				}
+				double seconds = ElapsedSeconds(start);
+				if(run == 0 || seconds < r.seconds)
+					r.seconds = seconds;
+				r.exact = (r.result == SZ_OK && outLen == inputSize && memcmp(&output[0], &input[0], inputSize) == 0);
+			}
+			r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+		}
+	}
+	return count;
+}
+
+int NativeBenchmarkBatchDecode(NativeBenchmarkBatchResult *results, int maxResults,
+	int numItems, size_t maxItemSize, int runs)
+{
+	if(numItems < 1 || maxItemSize < 16 || runs < 1)
+		return 0;
+
+	std::vector<size_t> sizes(numItems);
+	size_t totalSize = 0;
+	unsigned state = 1;
+	for(int i = 0; i < numItems; i++)
+	{
+		state = state * 1103515245u + 12345u;
+		sizes[i] = 1 + (size_t)(state >> 8) % ((i & 63) == 0 ? maxItemSize : maxItemSize / 16);
+		totalSize += sizes[i];
+	}
+
+	std::vector<unsigned char> input(totalSize);
+	std::vector<unsigned char> packed(totalSize + totalSize / 2 + (size_t)numItems * 64);
+	std::vector<unsigned char> output(totalSize);
+	std::vector<unsigned char> props((size_t)numItems * LZMA_PROPS_SIZE);
+	std::vector<NativeLzmaBatchItem> items(numItems);
+	size_t inputPos = 0, packedPos = 0;
+	for(int i = 0; i < numItems; i++)
+	{
+		NativeBenchmarkFillCorpus(&input[inputPos], sizes[i], (NativeBenchmarkCorpus)(i % 3), i);
+		size_t packedSize = packed.size() - packedPos;
+		size_t propsSize = LZMA_PROPS_SIZE;
+		if(NativeLzmaCompressStream(&packed[packedPos], &packedSize, &input[inputPos], sizes[i], &props[i * LZMA_PROPS_SIZE], &propsSize,
+			5, 1 << 20, -1, -1, -1, -1, -1, -1, -1, 0, 0, 1) != StatusCode_Ok)
+			return 0;
+		items[i].dest = &output[inputPos];
+		items[i].src = &packed[packedPos];
+		items[i].srcLen = packedSize;
+		items[i].props = &props[i * LZMA_PROPS_SIZE];
+		items[i].propsSize = propsSize;
+		inputPos += sizes[i];
+		packedPos += packedSize;
+	}
+
+	int count = 0;
+	for(int batch = 0; batch < 2 && count < maxResults; batch++)
+	{
+		NativeBenchmarkBatchResult &r = results[count++];
+		r.batch = batch != 0;
+		r.seconds = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			memset(&output[0], 0, totalSize);
+			for(int i = 0; i < numItems; i++)
+			{
+				items[i].destLen = sizes[i];
+				items[i].srcLen = (i + 1 < numItems ? items[i + 1].src : &packed[packedPos]) - items[i].src;
+				items[i].result = ErrorCode_Unknown;
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if(batch)
+			{
+				r.result = NativeLzmaUncompressBatch(&items[0], numItems);
+			}
+			else
+			{
+				r.result = StatusCode_Ok;
+				for(int i = 0; i < numItems; i++)
+					items[i].result = NativeLzmaUncompress(items[i].dest, &items[i].destLen, items[i].src, &items[i].srcLen, items[i].props, items[i].propsSize);
+			}
+			double seconds = ElapsedSeconds(start);
+			if(run == 0 || seconds < r.seconds)
+				r.seconds = seconds;
+			r.exact = true;
+			for(int i = 0; i < numItems; i++)
+			{
+				if(r.result == StatusCode_Ok && items[i].result != StatusCode_Ok)
+					r.result = items[i].result;
+				if(items[i].destLen != sizes[i])
+					r.exact = false;
+			}
+			r.exact = r.exact && r.result == StatusCode_Ok && memcmp(&output[0], &input[0], totalSize) == 0;
+		}
+		r.megabytesPerSecond = MegabytesPerSecond(totalSize, r.seconds);
+	}
+	return count;
+}
+
+// Feeds the rest of src to the decoder stream, as much as it takes, and ends its input after the last byte.
+static ResultCode FeedDecoder(NativeStream *stream, const unsigned char *src, size_t srcLen, size_t *srcPos)
+{
+	if(*srcPos == srcLen)
+		return StatusCode_Ok;
+	size_t inLen = srcLen - *srcPos;
+	ResultCode res = NativeStreamFeed(stream, src + *srcPos, &inLen);
+	*srcPos += inLen;
+	if(res == StatusCode_Ok && *srcPos == srcLen)
+		res = NativeStreamEnd(stream);
+	return res;
+}
+
+// Passes count bytes of output of the decoder stream, fed from src, to NativeStreamSkip or drains them into a
+// buffer of 16 KiB as the baseline. Returns the ResultCode and sets *passed.
+static ResultCode PassOutput(NativeStream *stream, const unsigned char *src, size_t srcLen, size_t *srcPos,
+	unsigned long long count, bool skip, unsigned long long *passed)
+{
+	unsigned char buffer[0x4000];
+	*passed = 0;
+	while(*passed < count)
+	{
+		ResultCode res = FeedDecoder(stream, src, srcLen, srcPos);
+		if(res != StatusCode_Ok)
+			return res;
+
+		unsigned long long done;
+		bool finished;
+		if(skip)
+		{
+			res = NativeStreamSkip(stream, count - *passed, &done, &finished);
+		}
+		else
+		{
+			size_t destLen = (size_t)(count - *passed < sizeof(buffer) ? count - *passed : sizeof(buffer));
+			res = NativeStreamDrain(stream, buffer, &destLen, &finished);
+			done = destLen;
+		}
+		*passed += done;
+		if(res != StatusCode_Ok || finished)
+			return res;
+	}
+	return StatusCode_Ok;
+}
+
+int NativeBenchmarkSkipOutput(NativeBenchmarkSkipResult *results, int maxResults,
+	size_t inputSize, size_t skipSize, int runs)
+{
+	if(inputSize == 0 || skipSize > inputSize || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output(inputSize - skipSize + 1);
+	NativeBenchmarkFillCorpus(&input[0], inputSize, NativeBenchmarkCorpus_Source, 1);
+	unsigned char props[LZMA_PROPS_SIZE];
+	size_t propsSize = LZMA_PROPS_SIZE;
+	size_t packedSize = packed.size();
+	if(NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+		5, 1 << 20, -1, -1, -1, -1, -1, -1, -1, 0, 1, 1) != StatusCode_Ok)
+		return 0;
+
+	int count = 0;
+	for(int skip = 1; skip >= 0 && count < maxResults; skip--)
+	{
+		NativeBenchmarkSkipResult &r = results[count++];
+		r.skip = skip != 0;
+		r.seconds = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			NativeStream *stream;
+			r.result = NativeLzmaDecoderCreate(&stream, props, propsSize);
+			if(r.result != StatusCode_Ok)
+				break;
+			size_t srcPos = 0;
+			unsigned long long passed = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			r.result = PassOutput(stream, &packed[0], packedSize, &srcPos, skipSize, r.skip, &passed);
+			double seconds = ElapsedSeconds(start);
+			if(run == 0 || seconds < r.seconds)
+				r.seconds = seconds;
+
+			// the output after the skipped part must be intact
+			size_t outLen = 0;
+			bool finished = false;
+			while(r.result == StatusCode_Ok && !finished && outLen < output.size())
+			{
+				r.result = FeedDecoder(stream, &packed[0], packedSize, &srcPos);
+				size_t destLen = output.size() - outLen;
+				if(r.result == StatusCode_Ok)
+					r.result = NativeStreamDrain(stream, &output[outLen], &destLen, &finished);
+				outLen += destLen;
+			}
+			NativeStreamDestroy(stream);
+			r.exact = r.result == StatusCode_Ok && passed == skipSize && outLen == inputSize - skipSize &&
+				memcmp(&output[0], &input[skipSize], outLen) == 0;
+		}
+		r.megabytesPerSecond = MegabytesPerSecond(skipSize, r.seconds);
+	}
+	return count;
+}
+
+int NativeCheckStreamRoundTrip(size_t inputSize, bool lzma2, bool endMark, size_t pieceSize)
+{
+	if(pieceSize == 0)
+		return ErrorCode_Parameter;
+
+	std::vector<unsigned char> input(inputSize + 1);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output(inputSize + 1);
+	NativeBenchmarkFillCorpus(&input[0], inputSize, NativeBenchmarkCorpus_Source, 1);
+	unsigned char props[LZMA_PROPS_SIZE];
+	size_t propsSize = LZMA_PROPS_SIZE;
+	size_t packedSize = packed.size();
+	ResultCode res;
+	if(lzma2)
+		res = NativeLzmaCompress2(&packed[0], &packedSize, &input[0], inputSize, props,
+			5, 1 << 20, -1, -1, -1, -1, -1, -1, -1, 0, 0, 1, -1, 1, -1);
+	else
+		res = NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+			5, 1 << 20, -1, -1, -1, -1, -1, -1, -1, 0, endMark ? 1 : 0, 1);
+	if(res != StatusCode_Ok)
+		return res;
+
+	NativeStream *stream;
+	res = lzma2 ? NativeLzma2DecoderCreate(&stream, props[0]) : NativeLzmaDecoderCreate(&stream, props, propsSize);
+	if(res != StatusCode_Ok)
+		return res;
+	size_t srcPos = 0;
+	size_t outLen = 0;
+	bool finished = false;
+	while(res == StatusCode_Ok && !finished && outLen < output.size())
+	{
+		if(srcPos < packedSize)
+		{
+			size_t inLen = packedSize - srcPos < pieceSize ? packedSize - srcPos : pieceSize;
+			res = NativeStreamFeed(stream, &packed[srcPos], &inLen);
+			srcPos += inLen;
+			if(res == StatusCode_Ok && srcPos == packedSize)
+				res = NativeStreamEnd(stream);
+		}
+		size_t destLen = output.size() - outLen < pieceSize ? output.size() - outLen : pieceSize;
+		if(res == StatusCode_Ok)
+			res = NativeStreamDrain(stream, &output[outLen], &destLen, &finished);
+		outLen += destLen;
+	}
+	NativeStreamDestroy(stream);
+	if(res == StatusCode_Ok && (!finished || outLen != inputSize || memcmp(&output[0], &input[0], outLen) != 0))
+		res = ErrorCode_Data;
+	return res;
+}
+
+// Endless input for NativeCheckLongStreamRoundTrip: 1 MiB of source corpus, rotated by a prime for every repetition.
+struct LongStreamSource
+{
+	ISeqInStream vt;
+	const unsigned char *pattern;
+	size_t patternSize;
+	unsigned long long size;
+	unsigned long long offset;
+};
+
+static void LongStreamSource_Fill(LongStreamSource *s, unsigned char *buf, size_t size)
+{
+	while(size != 0)
+	{
+		size_t pos = (size_t)((s->offset % s->patternSize + s->offset / s->patternSize * 7919) % s->patternSize);
+		size_t len = s->patternSize - pos;
+		if(len > s->patternSize - (size_t)(s->offset % s->patternSize))
+			len = s->patternSize - (size_t)(s->offset % s->patternSize);
+		if(len > size)
+			len = size;
+		memcpy(buf, s->pattern + pos, len);
+		buf += len;
+		size -= len;
+		s->offset += len;
+	}
+}
+
+static SRes LongStreamSource_Read(void *p, void *buf, size_t *size)
+{
+	LongStreamSource *s = static_cast<LongStreamSource*>(p);
+	if(*size > s->size - s->offset)
+		*size = (size_t)(s->size - s->offset);
+	LongStreamSource_Fill(s, static_cast<unsigned char*>(buf), *size);
+	return SZ_OK;
+}
+
+// Decodes what the encoder writes and compares it with a second LongStreamSource.
+struct LongStreamSink
+{
+	ISeqOutStream vt;
+	NativeStream *decoder;
+	LongStreamSource expected;
+	int result;
+	bool finished;
+	unsigned char output[1 << 16];
+	unsigned char compare[1 << 16];
+};
+
+static ResultCode LongStreamSink_Drain(LongStreamSink *s)
+{
+	for(;;)
+	{
+		size_t destLen = sizeof(s->output);
+		ResultCode res = NativeStreamDrain(s->decoder, s->output, &destLen, &s->finished);
+		if(res != StatusCode_Ok)
+			return res;
+		if(destLen == 0)
+			return StatusCode_Ok;
+		if(destLen > s->expected.size - s->expected.offset)
+			return ErrorCode_Data;
+		LongStreamSource_Fill(&s->expected, s->compare, destLen);
+		if(memcmp(s->output, s->compare, destLen) != 0)
+			return ErrorCode_Data;
+	}
+}
+
+static size_t LongStreamSink_Write(void *p, const void *buf, size_t size)
+{
+	LongStreamSink *s = static_cast<LongStreamSink*>(p);
+	const unsigned char *src = static_cast<const unsigned char*>(buf);
+	size_t done = 0;
+	while(s->result == StatusCode_Ok && done < size)
+	{
+		size_t inLen = size - done;
+		s->result = NativeStreamFeed(s->decoder, src + done, &inLen);
+		done += inLen;
+		if(s->result == StatusCode_Ok)
+			s->result = LongStreamSink_Drain(s);
+	}
+	return s->result == StatusCode_Ok ? size : 0;
+}
+
+static int GetEncoderCheckResult(SRes res)
+{
+	switch(res)
+	{
+	case SZ_OK: return StatusCode_Ok;
+	case SZ_ERROR_MEM: return ErrorCode_Memory;
+	case SZ_ERROR_PARAM: return ErrorCode_Parameter;
+	default: return ErrorCode_Unknown;
+	}
+}
+
+int NativeCheckLongStreamRoundTrip(unsigned long long inputSize, unsigned dictSize)
+{
+	CLzmaEncProps props;
+	LzmaEncProps_Init(&props);
+	props.level = 1;
+	props.dictSize = dictSize;
+	props.fb = 273;
+	props.writeEndMark = 1;
+	props.numThreads = 1;
+
+	CLzmaEncHandle enc = LzmaEnc_Create(&g_BenchmarkAlloc);
+	if(enc == NULL)
+		return ErrorCode_Memory;
+
+	// only the props are checked here, a dictionary this large is not allocated
+	CLzmaEncProps large = props;
+	large.dictSize = (3u << 30) >> 1;
+	large.algo = 1;
+	SRes res = LzmaEnc_SetProps(enc, &large);
+	large.numThreads = 2;
+	if(res != SZ_OK || LzmaEnc_SetProps(enc, &large) != SZ_ERROR_PARAM)
+	{
+		LzmaEnc_Destroy(enc, &g_BenchmarkAlloc, &g_BenchmarkAlloc);
+		return ErrorCode_Parameter;
+	}
+
+	std::vector<unsigned char> pattern(1 << 20);
+	NativeBenchmarkFillCorpus(&pattern[0], pattern.size(), NativeBenchmarkCorpus_Source, 1);
+	LongStreamSource source = { { LongStreamSource_Read }, &pattern[0], pattern.size(), inputSize, 0 };
+	LongStreamSink *sink = new LongStreamSink;
+	sink->vt.Write = LongStreamSink_Write;
+	sink->expected = source;
+	sink->result = StatusCode_Ok;
+	sink->finished = false;
+
+	unsigned char header[LZMA_PROPS_SIZE];
+	SizeT headerSize = LZMA_PROPS_SIZE;
+	res = LzmaEnc_SetProps(enc, &props);
+	if(res == SZ_OK)
+		res = LzmaEnc_WriteProperties(enc, header, &headerSize);
+	int result = res == SZ_OK ? NativeLzmaDecoderCreate(&sink->decoder, header, headerSize) : GetEncoderCheckResult(res);
+	if(result == StatusCode_Ok)
+	{
+		res = LzmaEnc_Encode(enc, &sink->vt, &source.vt, NULL, &g_BenchmarkAlloc, &g_BenchmarkAlloc);
+		result = sink->result != StatusCode_Ok ? sink->result : GetEncoderCheckResult(res);
+		if(result == StatusCode_Ok)
+			result = NativeStreamEnd(sink->decoder);
+		if(result == StatusCode_Ok)
+			result = LongStreamSink_Drain(sink);
+		if(result == StatusCode_Ok && (!sink->finished || sink->expected.offset != inputSize))
+			result = ErrorCode_Data;
+		NativeStreamDestroy(sink->decoder);
+	}
+	delete sink;
+	LzmaEnc_Destroy(enc, &g_BenchmarkAlloc, &g_BenchmarkAlloc);
+	return result;
+}
+
+int NativeCheckHashThreads(size_t inputSize, int numHashThreads)
+{
+	std::vector<unsigned char> input(inputSize + 1);
+	std::vector<unsigned char> reference(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> packed(reference.size());
+	NativeBenchmarkFillCorpus(&input[0], inputSize, NativeBenchmarkCorpus_Log, 1);
+	unsigned char props[LZMA_PROPS_SIZE];
+	size_t propsSize = LZMA_PROPS_SIZE;
+	size_t referenceSize = reference.size();
+	ResultCode res = NativeLzmaCompressStream(&reference[0], &referenceSize, &input[0], inputSize, props, &propsSize,
+		5, 1 << 22, -1, -1, -1, 1, -1, 1, -1, 0, 0, 2);
+	if(res != StatusCode_Ok)
+		return res;
+	NativeSetEncoderHashThreads(numHashThreads);
+	size_t packedSize = packed.size();
+	propsSize = LZMA_PROPS_SIZE;
+	res = NativeLzmaCompressStream(&packed[0], &packedSize, &input[0], inputSize, props, &propsSize,
+		5, 1 << 22, -1, -1, -1, 1, -1, 1, -1, 0, 0, 2);
+	NativeSetEncoderHashThreads(1);
+	if(res != StatusCode_Ok)
+		return res;
+	if(packedSize != referenceSize || memcmp(&packed[0], &reference[0], packedSize) != 0)
+		return ErrorCode_Data;
+
+	std::vector<unsigned char> output(inputSize + 1);
+	size_t outLen = inputSize;
+	res = NativeLzmaUncompress(&output[0], &outLen, &packed[0], &packedSize, props, propsSize);
+	if(res == StatusCode_Ok && (outLen != inputSize || memcmp(&output[0], &input[0], inputSize) != 0))
+		res = ErrorCode_Data;
+	return res;
+}
+
+static int CheckPlacement(const unsigned char *input, size_t inputSize, std::vector<unsigned char> &packed, int numBlockThreads)
+{
+	size_t packedSize = packed.size();
+	unsigned char prop;
+	ResultCode res = NativeLzmaCompress2(&packed[0], &packedSize, input, inputSize, &prop,
+		5, 1 << 20, -1, -1, -1, 1, -1, 1, -1, 0, 0, 2, 1 << 18, numBlockThreads, -1);
+	if(res != StatusCode_Ok)
+		return res;
+	NativeCpuPlacement placement[NUM_MT_CODER_THREADS_MAX];
+	if(NativeGetCpuPlacement(placement, NUM_MT_CODER_THREADS_MAX) != numBlockThreads)
+		return ErrorCode_Data;
+	for(int i = 0; i < numBlockThreads; i++)
+	{
+		const NativeCpuPlacement &p = placement[i];
+		if(p.node != i % 2 || p.firstCpu != (i % 2) * 4 + ((i / 2) * 2) % 4 || p.numCpus != 2)
+			return ErrorCode_Data;
+	}
+	return StatusCode_Ok;
+}
+
+int NativeCheckPlacement(int numBlockThreads)
+{
+	if(numBlockThreads < 2 || numBlockThreads > NUM_MT_CODER_THREADS_MAX)
+		return ErrorCode_Parameter;
+	size_t inputSize = (size_t)numBlockThreads << 18;
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	NativeBenchmarkFillCorpus(&input[0], inputSize, NativeBenchmarkCorpus_Json, 1);
+
+	if(!NativeSetCpuTopology(true, "0-3;4-7"))
+		return ErrorCode_Parameter;
+	int res = CheckPlacement(&input[0], inputSize, packed, numBlockThreads);
+	if(res == StatusCode_Ok)
+	{
+		NativeSetCpuTopology(false, NULL);
+		NativeThreadPool *pool = NativeCreateThreadPool();
+		if(pool == NULL)
+			return ErrorCode_Memory;
+		NativeSetThreadPool(pool);
+		NativeSetCpuTopology(true, "0-3;4-7");
+		res = CheckPlacement(&input[0], inputSize, packed, numBlockThreads);
+		NativeSetThreadPool(NULL);
+		NativeDestroyThreadPool(pool);
+	}
+	NativeSetCpuTopology(false, NULL);
+	return res;
+}
+
+int NativeBenchmarkMatchLen(NativeBenchmarkMatchLenResult *results, int maxResults,
+	size_t inputSize, int level, int fb, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> reference;
+
+	const NativeBenchmarkCorpus kCorpora[] = { NativeBenchmarkCorpus_Source, NativeBenchmarkCorpus_Log, NativeBenchmarkCorpus_Json };
+	unsigned savedKernel = LzFind_GetMatchLenKernel();
+	unsigned maxKernel = LzFind_GetDefaultMatchLenKernel();
+	int count = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		NativeBenchmarkFillCorpus(&input[0], inputSize, kCorpora[i], 1);
+		for(unsigned kernel = LZ_FIND_MATCH_LEN_BYTES; kernel <= maxKernel && count < maxResults; kernel++)
+		{
+			LzFind_SetMatchLenKernel(kernel);
+			NativeBenchmarkMatchLenResult &r = results[count++];
+			r.corpus = kCorpora[i];
+			r.kernel = kernel;
+			r.seconds = 0;
+			for(int run = 0; run < runs; run++)
+			{
+				unsigned char props[LZMA_PROPS_SIZE];
+				size_t propsSize = sizeof(props);
+				r.packedSize = packed.size();
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				r.result = NativeLzmaCompressStream(&packed[0], &r.packedSize, &input[0], inputSize, props, &propsSize,
+					level, 0, -1, -1, -1, -1, fb, -1, -1, 0, 0, 1);
+				double seconds = ElapsedSeconds(start);
+				if(run == 0 || seconds < r.seconds)
+					r.seconds = seconds;
+			}
+			if(r.result != StatusCode_Ok)
+				r.packedSize = 0;
+			if(kernel == LZ_FIND_MATCH_LEN_BYTES)
+				reference.assign(packed.begin(), packed.begin() + r.packedSize);
+			r.identical = r.result == StatusCode_Ok && r.packedSize == reference.size() &&
+				(r.packedSize == 0 || memcmp(&packed[0], &reference[0], r.packedSize) == 0);
+			r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+		}
+	}
+	LzFind_SetMatchLenKernel(savedKernel);
+	return count;
+}
+
+int NativeBenchmarkNormalize(NativeBenchmarkNormalizeResult *results, int maxResults,
+	unsigned dictSize, int runs)
+{
+	// same setup as LzmaEnc uses for btMode with numHashBytes = 4 and fb = 32
+	const UInt32 kBeforeSize = 1 << 12;
+	const UInt32 kNumFastBytes = 32;
+	const UInt32 kMatchLenMax = 273;
+	if(dictSize == 0 || runs < 1)
+		return 0;
+
+	CMatchFinder mf;
+	MatchFinder_Construct(&mf);
+	mf.btMode = 1;
+	mf.numHashBytes = 4;
+	mf.bigHash = (dictSize > (1 << 24));
+	if(!MatchFinder_Create(&mf, dictSize, kBeforeSize, kNumFastBytes, kMatchLenMax, &g_BenchmarkAlloc))
+	{
+		if(maxResults > 0)
+		{
+			memset(&results[0], 0, sizeof(results[0]));
+			results[0].result = SZ_ERROR_MEM;
+			return 1;
+		}
+		return 0;
+	}
+
+	// the positions of a match finder that reached kMaxValForNormalize, see MatchFinder_GetSubValue
+	UInt32 numItems = (UInt32)(mf.hashSizeSum + mf.numSons);
+	UInt32 subValue = (0xFFFFFFFF - mf.historySize - 1) & ~(UInt32)((1 << 10) - 1);
+	unsigned savedKernel = LzFind_GetNormalizeKernel();
+	unsigned maxKernel = LzFind_GetDefaultNormalizeKernel();
+	unsigned referenceSum = 0;
+	int count = 0;
+	for(unsigned kernel = LZ_FIND_NORMALIZE_SCALAR; kernel <= maxKernel && count < maxResults; kernel++)
+	{
+		LzFind_SetNormalizeKernel(kernel);
+		NativeBenchmarkNormalizeResult &r = results[count++];
+		r.kernel = kernel;
+		r.result = SZ_OK;
+		r.tableSize = (size_t)numItems * sizeof(CLzRef);
+		r.seconds = 0;
+		unsigned sum = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			UInt32 state = 1;
+			for(UInt32 i = 0; i < numItems; i++)
+			{
+				state = state * 1103515245u + 12345u;
+				mf.hash[i] = (i & 7) == 0 ? 0 : subValue - (1 << 20) + (state >> 12); // empty, older and newer positions
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			MatchFinder_Normalize3(subValue, mf.hash, numItems);
+			double seconds = ElapsedSeconds(start);
+			if(run == 0 || seconds < r.seconds)
+				r.seconds = seconds;
+		}
+		for(UInt32 i = 0; i < numItems; i++)
+			sum = sum * 31 + mf.hash[i];
+		if(kernel == LZ_FIND_NORMALIZE_SCALAR)
+			referenceSum = sum;
+		r.identical = sum == referenceSum;
+		r.secondsPerGigabyte = r.seconds * (1 << 30) / (double)(0xFFFFFFFF - mf.historySize);
+	}
+	LzFind_SetNormalizeKernel(savedKernel);
+	MatchFinder_Free(&mf, &g_BenchmarkAlloc);
+	return count;
+}
+
+// Counts the cache misses (last level) of the calling thread in user mode with the hardware counters,
+// where the OS gives access to them. OpenCacheMissCounter returns -1 if it does not.
+static int OpenCacheMissCounter()
+{
+#ifdef __linux__
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void StartCacheMissCounter(int counter)
+{
+#ifdef __linux__
+	if(counter >= 0)
+	{
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+static long long StopCacheMissCounter(int counter)
+{
+#ifdef __linux__
+	long long value;
+	if(counter >= 0)
+	{
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(counter, &value, sizeof(value)) == sizeof(value))
+			return value;
+	}
+#endif
+	return -1;
+}
+
+static void CloseCacheMissCounter(int counter)
+{
+#ifdef __linux__
+	if(counter >= 0)
+		close(counter);
+#endif
+}
+
+static SRes RunMatchFinder(const unsigned char *input, size_t inputSize, unsigned dictSize, bool hashChain,
+	int counter, unsigned *checksum, double *seconds, long long *misses)
+{
+	// same setup as LzmaEnc uses for numHashBytes = 4 and fb = 32
+	const UInt32 kBeforeSize = 1 << 12;
+	const UInt32 kNumFastBytes = 32;
+	const UInt32 kMatchLenMax = 273;
+
+	CMatchFinder mf;
+	IMatchFinder vt;
+	MatchFinder_Construct(&mf);
+	mf.btMode = hashChain ? 0 : 1;
+	mf.numHashBytes = 4;
+	mf.cutValue = (16 + (kNumFastBytes >> 1)) >> (hashChain ? 1 : 0);
+	mf.bigHash = (dictSize > (1 << 24));
+
+	BenchmarkInStream stream = { { BenchmarkInStream_Read }, input, inputSize, 0 };
+	if(!MatchFinder_Create(&mf, dictSize, kBeforeSize, kNumFastBytes, kMatchLenMax, &g_BenchmarkAlloc))
+		return SZ_ERROR_MEM;
+
+	UInt32 matches[kMatchLenMax * 2 + 2 + 1];
+	unsigned sum = 0;
+	MatchFinder_CreateVTable(&mf, &vt);
+	mf.stream = &stream.vt;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	StartCacheMissCounter(counter);
+	vt.Init(&mf);
+	while(vt.GetNumAvailableBytes(&mf) != 0)
+	{
+		UInt32 num = vt.GetMatches(&mf, matches);
+		for(UInt32 i = 0; i < num; i++)
+			sum = sum * 31 + matches[i];
+	}
+	*misses = StopCacheMissCounter(counter);
+	*seconds = ElapsedSeconds(start);
+	*checksum = sum;
+	SRes res = mf.result;
+	MatchFinder_Free(&mf, &g_BenchmarkAlloc);
+	return res;
+}
+
+int NativeBenchmarkPrefetch(NativeBenchmarkPrefetchResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	NativeBenchmarkFillCorpus(&input[0], inputSize, NativeBenchmarkCorpus_Log, 1);
+
+	Bool savedPrefetch = LzFind_GetPrefetch();
+	int counter = OpenCacheMissCounter();
+	unsigned referenceChecksum = 0;
+	int count = 0;
+	for(int mode = 0; mode < 4 && count < maxResults; mode++)
+	{
+		NativeBenchmarkPrefetchResult &r = results[count++];
+		r.hashChain = (mode >= 2);
+		r.prefetch = (mode & 1) != 0;
+		r.seconds = 0;
+		r.cacheMisses = -1;
+		LzFind_SetPrefetch(r.prefetch ? True : False);
+		unsigned checksum = 0;
+		for(int run = 0; run < runs; run++)
+		{
+			double seconds;
+			long long misses;
+			r.result = RunMatchFinder(&input[0], inputSize, dictSize, r.hashChain, counter, &checksum, &seconds, &misses);
+			if(run == 0 || seconds < r.seconds)
+			{
+				r.seconds = seconds;
+				r.cacheMisses = misses;
+			}
+		}
+		if(!r.prefetch)
+			referenceChecksum = checksum;
+		r.identical = r.result == SZ_OK && checksum == referenceChecksum;
+		r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+		r.missesPerPosition = r.cacheMisses >= 0 ? (double)r.cacheMisses / inputSize : -1;
+	}
+	CloseCacheMissCounter(counter);
+	LzFind_SetPrefetch(savedPrefetch);
+	return count;
+}
+
+int NativeBenchmarkHashLayout(NativeBenchmarkHashLayoutResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int level, int runs)
+{
+	if(inputSize == 0 || runs < 1)
+		return 0;
+
+	std::vector<unsigned char> input(inputSize);
+	std::vector<unsigned char> packed(inputSize + inputSize / 2 + (1 << 16));
+	std::vector<unsigned char> output(inputSize);
+
+	const NativeBenchmarkCorpus kCorpora[] = { NativeBenchmarkCorpus_Source, NativeBenchmarkCorpus_Log, NativeBenchmarkCorpus_Json };
+	const int kBtModes[] = { 0, 1, 2, 2 };
+	const unsigned kMc[] = { 0, 0, 0, 2 };
+	int count = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		NativeBenchmarkFillCorpus(&input[0], inputSize, kCorpora[i], 1);
+		for(int mode = 0; mode < 4 && count < maxResults; mode++)
+		{
+			NativeBenchmarkHashLayoutResult &r = results[count++];
+			r.corpus = kCorpora[i];
+			r.btMode = kBtModes[mode];
+			r.mc = kMc[mode];
+			r.seconds = 0;
+			unsigned char props[LZMA_PROPS_SIZE];
+			size_t propsSize = sizeof(props);
+			for(int run = 0; run < runs; run++)
+			{
+				propsSize = sizeof(props);
+				r.packedSize = packed.size();
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				r.result = NativeLzmaCompressStream(&packed[0], &r.packedSize, &input[0], inputSize, props, &propsSize,
+					level, dictSize, -1, -1, -1, -1, -1, r.btMode, -1, r.mc, 0, 1);
+				double seconds = ElapsedSeconds(start);
+				if(run == 0 || seconds < r.seconds)
+					r.seconds = seconds;
+			}
+			r.exact = false;
+			if(r.result == StatusCode_Ok)
+			{
+				size_t outLen = inputSize;
+				size_t srcLen = r.packedSize;
+				r.exact = NativeLzmaUncompress(&output[0], &outLen, &packed[0], &srcLen, props, propsSize) == StatusCode_Ok &&
+					outLen == inputSize && memcmp(&output[0], &input[0], inputSize) == 0;
+			}
+			else
+				r.packedSize = 0;
+			r.ratio = (double)r.packedSize / inputSize;
+			r.megabytesPerSecond = MegabytesPerSecond(inputSize, r.seconds);
+		}
+	}
+	return count;
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stddef.h>
+
+// Benchmarks for the native coders. They run on deterministic synthetic input and
+// only measure; formatting and printing the results is left to the caller.
+
+// Fills the buffer with text-like data that compresses roughly like source code.
+void NativeBenchmarkFillInput(unsigned char *buffer, size_t size, unsigned seed);
+
+enum NativeBenchmarkCorpus
+{
+	NativeBenchmarkCorpus_Source, // NativeBenchmarkFillInput
+	NativeBenchmarkCorpus_Log, // timestamped request log lines
+	NativeBenchmarkCorpus_Json, // an indented array of small records
+};
+
+// Fills the buffer with synthetic data of the given kind. Logs and JSON have long
+// repeated runs that decode into long matches.
+void NativeBenchmarkFillCorpus(unsigned char *buffer, size_t size, NativeBenchmarkCorpus corpus, unsigned seed);
+
+struct NativeBenchmarkScalingResult
+{
+	int blockThreads;
+	int result; // ResultCode of the last run
+	size_t packedSize;
+	double seconds;
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes with NativeLzmaCompress2 using 1, 2, 4, ... block threads up to
+// maxBlockThreads (which is always measured last). The block size is chosen so that every
+// block thread gets at least one block, and the level's dictionary is capped to the block size.
+// With useThreadPool the runs share a worker pool, otherwise every run creates and joins its
+// own threads.
+// Returns the number of entries written to results.
+int NativeBenchmarkBlockThreadScaling(NativeBenchmarkScalingResult *results, int maxResults,
+	size_t inputSize, int level, int maxBlockThreads, bool useThreadPool);
+
+struct NativeBenchmarkMatchFinderResult
+{
+	bool lockFree;
+	int result; // SRes of the run
+	unsigned checksum; // over all reported matches, equal for both modes
+	double seconds;
+	double megabytesPerSecond;
+};
+
+// Runs the multithreaded binary tree match finder (the hash and BT threads the encoder
+// uses for numThreads = 2) over inputSize bytes and reads every match, once with the
+// semaphore block handoff and once with the lock-free rings.
+// Returns the number of entries written to results.
+int NativeBenchmarkMatchFinderHandoff(NativeBenchmarkMatchFinderResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize);
+
+struct NativeBenchmarkHashThreadsResult
+{
+	int numHashThreads;
+	int result; // SRes of the last run
+	bool identical; // the packed data equals that of one hash thread
+	size_t packedSize;
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+	double speedup; // over one hash thread
+};
+
+// Compresses inputSize bytes as a single LZMA stream runs times with the multithreaded binary tree match
+// finder (numThreads = 2) and 1, 2, 4, ... up to maxHashThreads hash threads (see numHashThreads of
+// CLzmaEncProps), which shows whether the hash stage scales within one stream.
+// Returns the number of entries written to results.
+int NativeBenchmarkHashThreads(NativeBenchmarkHashThreadsResult *results, int maxResults,
+	size_t inputSize, int level, int maxHashThreads, int runs);
+
+struct NativeBenchmarkWaitSpinResult
+{
+	unsigned maxSpinCount; // 0 - waits block right away
+	int result; // ResultCode of the run
+	size_t packedSize;
+	bool counted; // the wait counters are compiled into this build (see Trace.h)
+	unsigned long long spins; // waits that ended without blocking, 0 if not counted
+	unsigned long long parks; // waits that blocked, 0 if not counted
+	double seconds;
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes with NativeLzmaCompress2 in small blocks of blockSize bytes on
+// blockThreads block threads, once with waits blocking right away and once with the default
+// spin before blocking (see Thread_SetWaitSpin), and reads the wait counters of both runs.
+// Without the wait counters (release builds without ENABLE_WAIT_COUNTERS) only the times are
+// measured and counted is false.
+// Returns the number of entries written to results.
+int NativeBenchmarkWaitSpin(NativeBenchmarkWaitSpinResult *results, int maxResults,
+	size_t inputSize, size_t blockSize, int blockThreads, int level);
+
+struct NativeBenchmarkDecodeKernelResult
+{
+	unsigned kernel; // LZMA_DEC_KERNEL_PORTABLE or LZMA_DEC_KERNEL_X64
+	int result; // SRes of the last run
+	bool exact; // the output equals the input
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes with NativeLzmaCompressStream and decodes them runs times with
+// every LzmaDec kernel compiled into this build (see LzmaDec_GetDefaultKernel).
+// Returns the number of entries written to results.
+int NativeBenchmarkDecodeKernel(NativeBenchmarkDecodeKernelResult *results, int maxResults,
+	size_t inputSize, int level, int runs);
+
+// Decodes numStreams streams of up to maxInputSize bytes with the portable and the x86-64
+// LzmaDec kernel and compares result, status, consumed input and output of both. The streams are
+// compressed with varying lc/lp/pb and then kept intact, corrupted, truncated or replaced by
+// random bytes. Returns the number of streams on which the kernels differ, or -1 if the build
+// has no second kernel (it is compiled for x86-64 only).
+int NativeCompareDecodeKernels(size_t maxInputSize, int numStreams, unsigned seed);
+
+struct NativeBenchmarkMatchCopyResult
+{
+	NativeBenchmarkCorpus corpus;
+	bool ring; // decoded through a dictionary ring instead of straight into the output
+	int result; // SRes of the last run
+	bool exact; // the output equals the input
+	size_t packedSize;
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes of every corpus with a dictionary of dictSize bytes and decodes
+// them runs times, once into the output buffer (LzmaDec_DecodeToDic) and once through a ring of
+// dictSize bytes (LzmaDec_DecodeToBuf), which splits the matches that cross the end of the ring.
+// Returns the number of entries written to results.
+int NativeBenchmarkMatchCopy(NativeBenchmarkMatchCopyResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int runs);
+
+struct NativeBenchmarkBatchResult
+{
+	bool batch; // NativeLzmaUncompressBatch instead of one NativeLzmaUncompress call per item
+	int result; // ResultCode of the last run, the first failed item if any
+	bool exact; // every output equals its input
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+};
+
+// Compresses numItems items of NativeBenchmarkFillCorpus data, most of them between 1 and maxItemSize / 16
+// bytes and every 64th of up to maxItemSize bytes, and decodes all of them runs times with one call per item
+// and with one NativeLzmaUncompressBatch call on the decoder threads (see NativeSetDecoderThreads).
+// Returns the number of entries written to results.
+int NativeBenchmarkBatchDecode(NativeBenchmarkBatchResult *results, int maxResults,
+	int numItems, size_t maxItemSize, int runs);
+
+struct NativeBenchmarkSkipResult
+{
+	bool skip; // NativeStreamSkip instead of the 16 KiB drain loop baseline
+	int result; // ResultCode of the last run
+	bool exact; // the output after the skipped bytes equals the input
+	double seconds; // of the fastest run, for the skipped bytes only
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes with NativeLzmaCompressStream (with end mark) and passes the first skipSize bytes of the decoded
+// output runs times, once with NativeStreamSkip and once by draining them into a 16 KiB buffer, then checks the rest
+// of the output. The drain loop stands in for a managed skip; the managed Decoder.SkipOutputData is not measured.
+// Returns the number of entries written to results.
+int NativeBenchmarkSkipOutput(NativeBenchmarkSkipResult *results, int maxResults,
+	size_t inputSize, size_t skipSize, int runs);
+
+// Compresses inputSize bytes as LZMA (with or without end mark) or LZMA2 and decodes them with a decoder stream that
+// is fed and drained in pieces of pieceSize bytes. Returns the first ResultCode that is not StatusCode_Ok, or
+// ErrorCode_Data if the stream did not finish with exactly the input.
+int NativeCheckStreamRoundTrip(size_t inputSize, bool lzma2, bool endMark, size_t pieceSize);
+
+// Compresses inputSize bytes (more than 4 GB, so that the 32-bit match finder positions wrap) generated on the fly
+// with the single-threaded match finder and a dictionary of dictSize bytes, and decodes them while they are written.
+// Also checks that LzmaEnc_SetProps takes dictionaries above 1 GB for the single-threaded match finder only.
+// Returns the first ResultCode that is not StatusCode_Ok, or ErrorCode_Data if the output differs from the input.
+int NativeCheckLongStreamRoundTrip(unsigned long long inputSize, unsigned dictSize);
+
+// Compresses inputSize bytes with NativeLzmaCompressStream and the multithreaded match finder, once with one hash
+// thread and once with numHashThreads (see NativeSetEncoderHashThreads), and decodes the second result. The hash
+// thread setting is reset to 1 afterwards. Returns the first ResultCode that is not StatusCode_Ok, or ErrorCode_Data
+// if the two results differ or do not decode into the input.
+int NativeCheckHashThreads(size_t inputSize, int numHashThreads);
+
+// Compresses with NativeLzmaCompress2 on numBlockThreads (2 or more) block threads with the multithreaded match finder
+// (2 cpus per thread) on the fake topology "0-3;4-7" (see NativeSetCpuTopology), with its own threads and then with
+// a thread pool, and checks the placement reported by NativeGetCpuPlacement: thread i on node i % 2, with the
+// (i / 2)-th pair of cpus of the node, wrapping around. The topology is disabled and the pool detached afterwards. Returns the first
+// ResultCode that is not StatusCode_Ok, or ErrorCode_Data if a placement differs.
+int NativeCheckPlacement(int numBlockThreads);
+
+struct NativeBenchmarkMatchLenResult
+{
+	NativeBenchmarkCorpus corpus;
+	unsigned kernel; // LZ_FIND_MATCH_LEN_*
+	int result; // ResultCode of the last run
+	bool identical; // the packed data equals that of LZ_FIND_MATCH_LEN_BYTES
+	size_t packedSize;
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes of every corpus runs times with NativeLzmaCompressStream at the given level and
+// fast bytes (fb, up to 273) with every match length kernel the cpu supports (see LzFind_SetMatchLenKernel),
+// on one thread. The kernel of the library is restored afterwards, so this must not overlap with other encoders.
+// Returns the number of entries written to results.
+int NativeBenchmarkMatchLen(NativeBenchmarkMatchLenResult *results, int maxResults,
+	size_t inputSize, int level, int fb, int runs);
+
+struct NativeBenchmarkNormalizeResult
+{
+	unsigned kernel; // LZ_FIND_NORMALIZE_*
+	int result; // SRes of the match finder allocation
+	bool identical; // the normalized tables equal those of LZ_FIND_NORMALIZE_SCALAR
+	size_t tableSize; // bytes of the hash and son arrays
+	double seconds; // of one normalization, fastest run
+	double secondsPerGigabyte; // normalization time per GB encoded
+};
+
+// Creates a BT4 match finder with a dictionary of dictSize bytes, as LzmaEnc does, and normalizes its hash
+// and son arrays runs times with every normalize kernel the cpu supports (see LzFind_SetNormalizeKernel).
+// A match finder normalizes once every 4 GB minus dictSize of input, which gives the cost per GB encoded.
+// The kernel of the library is restored afterwards. Returns the number of entries written to results.
+int NativeBenchmarkNormalize(NativeBenchmarkNormalizeResult *results, int maxResults,
+	unsigned dictSize, int runs);
+
+struct NativeBenchmarkPrefetchResult
+{
+	bool hashChain; // HC4 instead of BT4
+	bool prefetch; // see LzFind_SetPrefetch
+	int result; // SRes of the last run
+	bool identical; // the matches equal those without prefetch
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+	long long cacheMisses; // of the fastest run, -1 without hardware counters
+	double missesPerPosition; // -1 without hardware counters
+};
+
+// Runs the single-threaded BT4 and HC4 match finders with a dictionary of dictSize bytes over inputSize bytes
+// of log corpus and reads every match, runs times without and with prefetch (see LzFind_SetPrefetch). Where the
+// OS gives access to the hardware counters (perf events on Linux), the cache misses of the fastest run are counted
+// too. The prefetch setting of the library is restored afterwards. Returns the number of entries written to results.
+int NativeBenchmarkPrefetch(NativeBenchmarkPrefetchResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int runs);
+
+struct NativeBenchmarkHashLayoutResult
+{
+	NativeBenchmarkCorpus corpus;
+	int btMode; // 0 - HC4, 1 - BT4, 2 - HB4 hash buckets (see MatchFinder_Create)
+	unsigned mc; // candidates per position, 0 for the default of the level
+	int result; // ResultCode of the last run
+	bool exact; // the packed data decodes into the input
+	size_t packedSize;
+	double ratio; // packedSize / inputSize
+	double seconds; // of the fastest run
+	double megabytesPerSecond;
+};
+
+// Compresses inputSize bytes of every corpus runs times with NativeLzmaCompressStream at the given level, with a
+// dictionary of dictSize bytes and one thread, using the HC4, BT4 and HB4 match finders. HB4 runs with the default
+// mc, which checks all 8 heads of a bucket, and with mc = 2, which checks the 2 newest. Every result is decoded
+// once and compared with the input. Returns the number of entries written to results.
+int NativeBenchmarkHashLayout(NativeBenchmarkHashLayoutResult *results, int maxResults,
+	size_t inputSize, unsigned dictSize, int level, int runs);
@@ -1,4 +1,7 @@
-#include "trace.h"
+#include "Trace.h"
+
+#ifndef DISABLE_TRACE
+
 #include <Windows.h>
 #include <map>
 #include <string>
@@ -569,3 +572,71 @@ void LeaveGlobalLock()
 {
 	mSession->Unlock();
 }
+
+#else
+
+// Without tracing the harness entry points still exist so callers do not need to care.
+
+void TraceInit(const char *id)
+{
+	(void)id;
+}
+
+void TraceStop()
+{
+}
+
+#endif
+
+#ifdef ENABLE_WAIT_COUNTERS
+
+// The wait counters are shared by all threads and updated once per wait.
+
+#ifdef _WIN32
+#include <Windows.h>
+#define TraceAtomicAdd(p, v) InterlockedExchangeAdd64((volatile LONGLONG *)(p), (LONGLONG)(v))
+#define TraceAtomicExchange(p, v) InterlockedExchange64((volatile LONGLONG *)(p), (LONGLONG)(v))
+#else
+#define TraceAtomicAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define TraceAtomicExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static volatile unsigned long long gWaitSpins = 0;
+static volatile unsigned long long gWaitParks = 0;
+static volatile unsigned long long gWaitSpinIterations = 0;
+
+void TraceCountWait(int parked, unsigned spinIterations)
+{
+	TraceAtomicAdd(parked ? &gWaitParks : &gWaitSpins, 1ULL);
+	if(spinIterations != 0)
+		TraceAtomicAdd(&gWaitSpinIterations, (unsigned long long)spinIterations);
+}
+
+void TraceGetWaitCounters(TraceWaitCounters *counters)
+{
+	counters->spins = TraceAtomicAdd(&gWaitSpins, 0ULL);
+	counters->parks = TraceAtomicAdd(&gWaitParks, 0ULL);
+	counters->spinIterations = TraceAtomicAdd(&gWaitSpinIterations, 0ULL);
+}
+
+void TraceResetWaitCounters()
+{
+	TraceAtomicExchange(&gWaitSpins, 0ULL);
+	TraceAtomicExchange(&gWaitParks, 0ULL);
+	TraceAtomicExchange(&gWaitSpinIterations, 0ULL);
+}
+
+#else
+
+void TraceGetWaitCounters(TraceWaitCounters *counters)
+{
+	counters->spins = 0;
+	counters->parks = 0;
+	counters->spinIterations = 0;
+}
+
+void TraceResetWaitCounters()
+{
+}
+
+#endif
@@ -1,11 +1,45 @@
 #pragma once
 
+// The trace hooks talk to the managed test harness over named pipes and are only
+// available on Windows. Defining DISABLE_TRACE compiles them out of the native
+// library; it is implied on every other platform.
+#if !defined(_WIN32) && !defined(DISABLE_TRACE)
+#define DISABLE_TRACE
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void TraceInit(const char *id);
 void TraceStop();
+
+// Wait counters of the native thread layer: waits that were satisfied while spinning,
+// waits that blocked in the kernel, and the pause iterations spent spinning by both kinds.
+// Counting costs a shared atomic add per wait, so the counters are only kept in traced
+// builds or when ENABLE_WAIT_COUNTERS is defined. Otherwise TraceCountWait compiles to
+// nothing and TraceGetWaitCounters reports zeros.
+#if !defined(DISABLE_TRACE) && !defined(ENABLE_WAIT_COUNTERS)
+#define ENABLE_WAIT_COUNTERS
+#endif
+
+typedef struct
+{
+	unsigned long long spins;
+	unsigned long long parks;
+	unsigned long long spinIterations;
+} TraceWaitCounters;
+
+#ifdef ENABLE_WAIT_COUNTERS
+void TraceCountWait(int parked, unsigned spinIterations);
+#else
+#define TraceCountWait(parked, spinIterations) ((void)0)
+#endif
+void TraceGetWaitCounters(TraceWaitCounters *counters);
+void TraceResetWaitCounters();
+
+#ifndef DISABLE_TRACE
+
 void* GetRootContext();
 void TraceInitThread(void *root);
 void TraceStopThread();
@@ -25,6 +59,29 @@ void TraceStatusCode(const char *key, unsigned long res);
 void EnterGlobalLock();
 void LeaveGlobalLock();
 
+#else
+
+#define GetRootContext() ((void*)0)
+#define TraceInitThread(root) ((void)0)
+#define TraceStopThread() ((void)0)
+#define TR(key, value) ((void)0)
+#define TRS(key, value) ((void)0)
+#define TRI(value1, value2) ((void)0)
+#define TRZC(handle) ((void)0)
+#define TRZD(handle) ((void)0)
+#define TRZ1(handle) ((void)0)
+#define TSZ(key, res) (res)
+
+#define TraceObjectCreate(key, handle) ((void)0)
+#define TraceObjectDelete(key, handle) ((void)0)
+#define TraceObjectSync(key, handle) ((void)0)
+#define TraceStatusCode(key, res) ((void)0)
+
+#define EnterGlobalLock() ((void)0)
+#define LeaveGlobalLock() ((void)0)
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,69 @@
+/* 7zCrc.c -- CRC32 calculation
+2026-10-17 : Public domain */
+
+#include "7zCrc.h"
+
+#define kCrcPoly 0xEDB88320
+
+/* the slicing tables are indexed by the bytes of little-endian words */
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64) \
+    || (defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  #define CRC_SLICING_BY_8
+#endif
+
+#define CRC_NUM_TABLES 8
+
+UInt32 g_CrcTable[256 * CRC_NUM_TABLES];
+
+void MY_FAST_CALL CrcGenerateTable(void)
+{
+  UInt32 i;
+  for (i = 0; i < 256; i++)
+  {
+    UInt32 r = i;
+    int j;
+    for (j = 0; j < 8; j++)
+      r = (r >> 1) ^ (kCrcPoly & ~((r & 1) - 1));
+    g_CrcTable[i] = r;
+  }
+  /* table k advances a byte through k further zero bytes */
+  for (; i < 256 * CRC_NUM_TABLES; i++)
+  {
+    UInt32 r = g_CrcTable[i - 256];
+    g_CrcTable[i] = g_CrcTable[r & 0xFF] ^ (r >> 8);
+  }
+}
+
+UInt32 MY_FAST_CALL CrcUpdate(UInt32 v, const void *data, size_t size)
+{
+  const Byte *p = (const Byte *)data;
+  #ifdef CRC_SLICING_BY_8
+  const UInt32 *table = g_CrcTable;
+  for (; size > 0 && ((size_t)p & 3) != 0; size--, p++)
+    v = CRC_UPDATE_BYTE(v, *p);
+  for (; size >= 8; size -= 8, p += 8)
+  {
+    UInt32 d;
+    v ^= *(const UInt32 *)p;
+    v =
+          table[0x700 + (v & 0xFF)]
+        ^ table[0x600 + ((v >> 8) & 0xFF)]
+        ^ table[0x500 + ((v >> 16) & 0xFF)]
+        ^ table[0x400 + ((v >> 24))];
+    d = *((const UInt32 *)p + 1);
+    v ^=
+          table[0x300 + (d & 0xFF)]
+        ^ table[0x200 + ((d >> 8) & 0xFF)]
+        ^ table[0x100 + ((d >> 16) & 0xFF)]
+        ^ table[0x000 + ((d >> 24))];
+  }
+  #endif
+  for (; size > 0; size--, p++)
+    v = CRC_UPDATE_BYTE(v, *p);
+  return v;
+}
+
+UInt32 MY_FAST_CALL CrcCalc(const void *data, size_t size)
+{
+  return CrcUpdate(CRC_INIT_VAL, data, size) ^ CRC_INIT_VAL;
+}
@@ -5,6 +5,9 @@ Public domain */
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 #include <stdlib.h>
 
@@ -125,3 +128,270 @@ void BigFree(void *address)
 }
 
 #endif
+
+/* ---------- Pages ---------- */
+
+#define kHugePageSize ((size_t)1 << 21)
+#define kMinPagesSize ((size_t)1 << 18)
+
+static size_t RoundUpSize(size_t size, size_t align) { return (size + align - 1) & ~(align - 1); }
+
+#ifdef _WIN32
+
+static void *Pages_Alloc(size_t size, Bool huge, size_t *mapSize, unsigned *backing)
+{
+  void *res;
+  #ifdef _7ZIP_LARGE_PAGES
+  if (huge && g_LargePageSize != 0 && g_LargePageSize <= (1 << 30))
+  {
+    size_t s = RoundUpSize(size, g_LargePageSize);
+    res = VirtualAlloc(0, s, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (res != 0)
+    {
+      *mapSize = s;
+      *backing = SZ_BACKING_HUGE_PAGES;
+      return res;
+    }
+  }
+  #else
+  huge = huge;
+  #endif
+  res = VirtualAlloc(0, size, MEM_COMMIT, PAGE_READWRITE);
+  *mapSize = size;
+  *backing = SZ_BACKING_PAGES;
+  return res;
+}
+
+static void Pages_Free(void *address, size_t mapSize)
+{
+  mapSize = mapSize;
+  VirtualFree(address, 0, MEM_RELEASE);
+}
+
+#else
+
+static void *Pages_Map(size_t size, int flags)
+{
+  void *res = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  return (res == MAP_FAILED) ? 0 : res;
+}
+
+static void *Pages_Alloc(size_t size, Bool huge, size_t *mapSize, unsigned *backing)
+{
+  Byte *res;
+  if (huge)
+  {
+    size_t s = RoundUpSize(size, kHugePageSize);
+    #ifdef MAP_HUGETLB
+    {
+      /* private hugetlb mappings reserve their pages here, so a small pool fails now and not on first touch */
+      int flags = MAP_HUGETLB;
+      #ifdef MAP_HUGE_SHIFT
+      flags |= 21 << MAP_HUGE_SHIFT;
+      #endif
+      res = (Byte *)Pages_Map(s, flags);
+      if (res != 0)
+      {
+        *mapSize = s;
+        *backing = SZ_BACKING_HUGE_PAGES;
+        return res;
+      }
+    }
+    #endif
+    #ifdef MADV_HUGEPAGE
+    /* transparent huge pages only back 2 MB aligned ranges, so map more and trim */
+    res = (Byte *)Pages_Map(s + kHugePageSize, 0);
+    if (res != 0)
+    {
+      Byte *aligned = (Byte *)RoundUpSize((size_t)res, kHugePageSize);
+      size_t head = (size_t)(aligned - res);
+      if (head != 0)
+        munmap(res, head);
+      munmap(aligned + s, kHugePageSize - head);
+      *mapSize = s;
+      *backing = (madvise(aligned, s, MADV_HUGEPAGE) == 0) ? SZ_BACKING_THP : SZ_BACKING_PAGES;
+      return aligned;
+    }
+    #endif
+  }
+  *mapSize = RoundUpSize(size, (size_t)sysconf(_SC_PAGESIZE));
+  *backing = SZ_BACKING_PAGES;
+  return Pages_Map(*mapSize, 0);
+}
+
+static void Pages_Free(void *address, size_t mapSize)
+{
+  munmap(address, mapSize);
+}
+
+#endif
+
+/* Mapped blocks are listed in a side table (the returned pointer is the start of the mapping,
+   so it stays page aligned); a block that is not in the table came from the heap.
+   Slots are claimed and released with a compare-exchange on the address, so no lock is needed;
+   the table is only scanned on free, which is rare for blocks this large. */
+
+typedef struct
+{
+  void * volatile address;
+  size_t mapSize;
+  unsigned backing;
+} CPagesBlock;
+
+#define kNumPagesBlocks 1024
+
+static CPagesBlock g_PagesBlocks[kNumPagesBlocks];
+
+#ifdef _WIN32
+#define Pages_ClaimSlot(p, a) (InterlockedCompareExchangePointer(&(p)->address, (a), NULL) == NULL)
+#define Pages_ReleaseSlot(p) InterlockedExchangePointer(&(p)->address, NULL)
+#else
+#define Pages_ClaimSlot(p, a) __sync_bool_compare_and_swap(&(p)->address, (void *)0, (a))
+#define Pages_ReleaseSlot(p) __atomic_store_n(&(p)->address, (void *)0, __ATOMIC_SEQ_CST)
+#endif
+
+static CPagesBlock *Pages_FindBlock(const void *address)
+{
+  unsigned i;
+  for (i = 0; i < kNumPagesBlocks; i++)
+    if (g_PagesBlocks[i].address == address)
+      return &g_PagesBlocks[i];
+  return 0;
+}
+
+static void *Pages_AllocBlock(size_t size, size_t minPagesSize, Bool huge, unsigned *backingRes)
+{
+  void *base = 0;
+  size_t mapSize;
+  unsigned backing = SZ_BACKING_HEAP;
+  if (size == 0 || size > ((size_t)0 - kHugePageSize * 2))
+    return 0;
+  if (size >= minPagesSize)
+    base = Pages_Alloc(size, huge, &mapSize, &backing);
+  if (base != 0)
+  {
+    unsigned i;
+    for (i = 0; i < kNumPagesBlocks; i++)
+    {
+      CPagesBlock *p = &g_PagesBlocks[i];
+      if (p->address == 0 && Pages_ClaimSlot(p, base))
+      {
+        p->mapSize = mapSize;
+        p->backing = backing;
+        break;
+      }
+    }
+    if (i == kNumPagesBlocks)
+    {
+      Pages_Free(base, mapSize);
+      base = 0;
+    }
+  }
+  if (base == 0)
+  {
+    base = MyAlloc(size);
+    if (base == 0)
+      return 0;
+    backing = SZ_BACKING_HEAP;
+  }
+  if (backingRes)
+    *backingRes = backing;
+  return base;
+}
+
+static void Pages_FreeBlock(void *address)
+{
+  CPagesBlock *p;
+  if (address == 0)
+    return;
+  p = Pages_FindBlock(address);
+  if (p == 0)
+    MyFree(address);
+  else
+  {
+    size_t mapSize = p->mapSize;
+    Pages_ReleaseSlot(p);
+    Pages_Free(address, mapSize);
+  }
+}
+
+#ifndef _WIN32
+
+void *MidAlloc(size_t size) { return Pages_AllocBlock(size, kMinPagesSize, False, 0); }
+void MidFree(void *address) { Pages_FreeBlock(address); }
+void *BigAlloc(size_t size) { return Pages_AllocBlock(size, kMinPagesSize, True, 0); }
+void BigFree(void *address) { Pages_FreeBlock(address); }
+
+#endif
+
+/* ---------- Large page ISzAlloc ---------- */
+
+static void *LargePageAlloc_Alloc(void *pp, size_t size)
+{
+  CLargePageAlloc *p = (CLargePageAlloc *)pp;
+  unsigned backing;
+  void *res = Pages_AllocBlock(size, p->minPagesSize, True, &backing);
+  if (res != 0)
+  {
+    #ifdef _WIN32
+    InterlockedOr((LONG volatile *)&p->usedBackings, (LONG)1 << backing);
+    #else
+    __atomic_fetch_or(&p->usedBackings, (UInt32)1 << backing, __ATOMIC_RELAXED);
+    #endif
+  }
+  return res;
+}
+
+static void LargePageAlloc_Free(void *pp, void *address)
+{
+  pp = pp;
+  Pages_FreeBlock(address);
+}
+
+void LargePageAlloc_Construct(CLargePageAlloc *p)
+{
+  p->funcTable.Alloc = LargePageAlloc_Alloc;
+  p->funcTable.Free = LargePageAlloc_Free;
+  p->minPagesSize = kMinPagesSize;
+  p->usedBackings = 0;
+  #ifdef _WIN32
+  SetLargePageSize();
+  #endif
+}
+
+unsigned LargePageAlloc_GetBacking(const void *address)
+{
+  const CPagesBlock *p = Pages_FindBlock(address);
+  return p ? p->backing : SZ_BACKING_HEAP;
+}
+
+/* ---------- First touch ISzAlloc ---------- */
+
+#define kFirstTouchPageSize (1 << 12)
+
+static void *FirstTouchAlloc_Alloc(void *pp, size_t size)
+{
+  CFirstTouchAlloc *p = (CFirstTouchAlloc *)pp;
+  Byte *address = (Byte *)IAlloc_Alloc(p->baseAlloc, size);
+  size_t pos;
+  if (address != 0 && size != 0)
+  {
+    for (pos = 0; pos < size; pos += kFirstTouchPageSize)
+      ((volatile Byte *)address)[pos] = 0;
+    ((volatile Byte *)address)[size - 1] = 0;
+  }
+  return address;
+}
+
+static void FirstTouchAlloc_Free(void *pp, void *address)
+{
+  CFirstTouchAlloc *p = (CFirstTouchAlloc *)pp;
+  IAlloc_Free(p->baseAlloc, address);
+}
+
+void FirstTouchAlloc_Construct(CFirstTouchAlloc *p, ISzAlloc *baseAlloc)
+{
+  p->funcTable.Alloc = FirstTouchAlloc_Alloc;
+  p->funcTable.Free = FirstTouchAlloc_Free;
+  p->baseAlloc = baseAlloc;
+}
@@ -6,6 +6,8 @@
 
 #include <stddef.h>
 
+#include "Types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,13 +26,50 @@ void BigFree(void *address);
 
 #else
 
-#define MidAlloc(size) MyAlloc(size)
-#define MidFree(address) MyFree(address)
-#define BigAlloc(size) MyAlloc(size)
-#define BigFree(address) MyFree(address)
+/* mmap based; BigAlloc prefers huge pages like the _WIN32 version prefers large pages */
+void *MidAlloc(size_t size);
+void MidFree(void *address);
+void *BigAlloc(size_t size);
+void BigFree(void *address);
 
 #endif
 
+/* ---------- Large page ISzAlloc ---------- */
+
+/* Where a block of CLargePageAlloc lives. Every request first tries huge pages
+   (MEM_LARGE_PAGES / MAP_HUGETLB), then transparent huge pages (madvise),
+   then normal pages and finally the heap. */
+
+#define SZ_BACKING_HEAP 0
+#define SZ_BACKING_PAGES 1
+#define SZ_BACKING_HUGE_PAGES 2
+#define SZ_BACKING_THP 3
+
+typedef struct
+{
+  ISzAlloc funcTable;
+  size_t minPagesSize;   /* smaller requests are served from the heap */
+  volatile UInt32 usedBackings; /* (1 << SZ_BACKING_*) of every block handed out so far */
+} CLargePageAlloc;
+
+void LargePageAlloc_Construct(CLargePageAlloc *p);
+/* address must be a block returned by a CLargePageAlloc */
+unsigned LargePageAlloc_GetBacking(const void *address);
+
+/* ---------- First touch ISzAlloc ---------- */
+
+/* CFirstTouchAlloc forwards to baseAlloc and writes every page of a new block
+   from the allocating thread, so that a first-touch NUMA policy places the block
+   on the node of that thread instead of the node of the thread that uses it first. */
+
+typedef struct
+{
+  ISzAlloc funcTable;
+  ISzAlloc *baseAlloc;
+} CFirstTouchAlloc;
+
+void FirstTouchAlloc_Construct(CFirstTouchAlloc *p, ISzAlloc *baseAlloc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,333 @@
+/* EncStream.c -- Push interface for the LZMA and LZMA2 encoders
+2026-10-17 : Public domain */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "EncStream.h"
+
+#define ENC_STREAM_FROM_OUT(pp) ((CEncStream *)((Byte *)(pp) - offsetof(CEncStream, outStream)))
+
+/* ---------- coder thread ---------- */
+
+static SRes EncStream_Read(void *pp, void *buf, size_t *size)
+{
+  CEncStream *p = (CEncStream *)pp;
+  size_t n;
+  CriticalSection_Enter(&p->cs);
+  for (;;)
+  {
+    if (p->aborted)
+    {
+      CriticalSection_Leave(&p->cs);
+      *size = 0;
+      return SZ_ERROR_READ;
+    }
+    if (p->inAvail != 0 || p->ended || p->flushRequested)
+      break;
+    p->waitingForInput = True;
+    Event_Set(&p->callerEvent);
+    CriticalSection_Leave(&p->cs);
+    Event_Wait(&p->inputEvent);
+    CriticalSection_Enter(&p->cs);
+  }
+  p->waitingForInput = False;
+  if (p->inAvail == 0)
+  {
+    /* the run ends here, see EncStream_ThreadFunc */
+    p->runEndedByEnd = p->ended;
+    *size = 0;
+  }
+  else
+  {
+    size_t rem = *size;
+    Byte *dest = (Byte *)buf;
+    if (rem > p->inAvail)
+      rem = p->inAvail;
+    *size = rem;
+    while (rem != 0)
+    {
+      n = p->bufSize - p->inPos;
+      if (n > rem)
+        n = rem;
+      memcpy(dest, p->inBuf + p->inPos, n);
+      dest += n;
+      rem -= n;
+      p->inAvail -= n;
+      p->inPos += n;
+      if (p->inPos == p->bufSize)
+        p->inPos = 0;
+    }
+  }
+  CriticalSection_Leave(&p->cs);
+  return SZ_OK;
+}
+
+static size_t EncStream_Put(CEncStream *p, const Byte *data, size_t size)
+{
+  size_t done = 0;
+  CriticalSection_Enter(&p->cs);
+  while (done < size && !p->aborted)
+  {
+    size_t space = p->bufSize - p->outAvail;
+    size_t pos, n;
+    if (space == 0)
+    {
+      CriticalSection_Leave(&p->cs);
+      Event_Wait(&p->spaceEvent);
+      CriticalSection_Enter(&p->cs);
+      continue;
+    }
+    pos = p->outPos + p->outAvail;
+    if (pos >= p->bufSize)
+      pos -= p->bufSize;
+    n = p->bufSize - pos;
+    if (n > space)
+      n = space;
+    if (n > size - done)
+      n = size - done;
+    memcpy(p->outBuf + pos, data + done, n);
+    p->outAvail += n;
+    done += n;
+    Event_Set(&p->callerEvent);
+  }
+  CriticalSection_Leave(&p->cs);
+  return done;
+}
+
+static size_t EncStream_Write(void *pp, const void *buf, size_t size)
+{
+  CEncStream *p = ENC_STREAM_FROM_OUT(pp);
+  const Byte *data = (const Byte *)buf;
+  if (size == 0)
+    return 0;
+  if (p->lzma == 0)
+  {
+    if (p->hasPending && EncStream_Put(p, &p->pending, 1) != 1)
+      return 0;
+    if (EncStream_Put(p, data, size - 1) != size - 1)
+      return 0;
+    p->pending = data[size - 1];
+    p->hasPending = True;
+    return size;
+  }
+  return EncStream_Put(p, data, size);
+}
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE EncStream_ThreadFunc(void *pp)
+{
+  CEncStream *p = (CEncStream *)pp;
+  for (;;)
+  {
+    SRes res;
+    Bool endOfRun;
+    p->hasPending = False;
+    if (p->lzma != 0)
+      res = LzmaEnc_Encode(p->lzma, &p->outStream, &p->inStream, NULL, p->alloc, p->allocBig);
+    else
+      res = Lzma2Enc_Encode(p->lzma2, &p->outStream, &p->inStream, NULL);
+
+    CriticalSection_Enter(&p->cs);
+    endOfRun = (res == SZ_OK && p->lzma == 0 && !p->runEndedByEnd);
+    if (endOfRun)
+    {
+      /* a flushed run: drop its end marker, the next run starts with a dictionary reset */
+      if (!p->hasPending || p->pending != 0)
+        res = SZ_ERROR_FAIL;
+      else
+        p->flushRequested = False;
+    }
+    CriticalSection_Leave(&p->cs);
+    if (res == SZ_OK && endOfRun)
+    {
+      Event_Set(&p->callerEvent);
+      continue;
+    }
+
+    if (res == SZ_OK && p->hasPending && EncStream_Put(p, &p->pending, 1) != 1)
+      res = SZ_ERROR_WRITE;
+    CriticalSection_Enter(&p->cs);
+    p->res = res;
+    p->finished = True;
+    Event_Set(&p->callerEvent);
+    CriticalSection_Leave(&p->cs);
+    return 0;
+  }
+}
+
+/* ---------- caller ---------- */
+
+SRes EncStream_Create(CEncStream *p, CLzmaEncHandle lzma, CLzma2EncHandle lzma2, size_t bufSize,
+    ISzAlloc *alloc, ISzAlloc *allocBig)
+{
+  WRes wres;
+  p->inStream.Read = EncStream_Read;
+  p->outStream.Write = EncStream_Write;
+  p->lzma = lzma;
+  p->lzma2 = lzma2;
+  p->alloc = alloc;
+  p->allocBig = allocBig;
+  p->bufSize = bufSize;
+  p->inPos = p->inAvail = 0;
+  p->outPos = p->outAvail = 0;
+  p->ended = p->flushRequested = p->runEndedByEnd = False;
+  p->waitingForInput = p->finished = p->aborted = False;
+  p->hasPending = False;
+  p->res = SZ_OK;
+
+  p->inBuf = (Byte *)IAlloc_Alloc(alloc, bufSize);
+  p->outBuf = (Byte *)IAlloc_Alloc(alloc, bufSize);
+  if (p->inBuf == 0 || p->outBuf == 0)
+  {
+    IAlloc_Free(alloc, p->inBuf);
+    IAlloc_Free(alloc, p->outBuf);
+    p->inBuf = p->outBuf = 0;
+    return SZ_ERROR_MEM;
+  }
+
+  Event_Construct(&p->inputEvent);
+  Event_Construct(&p->spaceEvent);
+  Event_Construct(&p->callerEvent);
+  wres = CriticalSection_Init(&p->cs);
+  if (wres == 0)
+  {
+    if ((wres = AutoResetEvent_CreateNotSignaled(&p->inputEvent)) == 0 &&
+        (wres = AutoResetEvent_CreateNotSignaled(&p->spaceEvent)) == 0 &&
+        (wres = AutoResetEvent_CreateNotSignaled(&p->callerEvent)) == 0 &&
+        (wres = Thread_Create(&p->thread, EncStream_ThreadFunc, p)) == 0)
+      return SZ_OK;
+    Event_Close(&p->inputEvent);
+    Event_Close(&p->spaceEvent);
+    Event_Close(&p->callerEvent);
+    CriticalSection_Delete(&p->cs);
+  }
+  Thread_Construct(&p->thread);
+  IAlloc_Free(alloc, p->inBuf);
+  IAlloc_Free(alloc, p->outBuf);
+  p->inBuf = p->outBuf = 0;
+  return SZ_ERROR_THREAD;
+}
+
+void EncStream_Destruct(CEncStream *p)
+{
+  if (p->inBuf == 0)
+    return;
+  CriticalSection_Enter(&p->cs);
+  p->aborted = True;
+  CriticalSection_Leave(&p->cs);
+  Event_Set(&p->inputEvent);
+  Event_Set(&p->spaceEvent);
+  Thread_Wait(&p->thread);
+  Thread_Close(&p->thread);
+  Event_Close(&p->inputEvent);
+  Event_Close(&p->spaceEvent);
+  Event_Close(&p->callerEvent);
+  CriticalSection_Delete(&p->cs);
+  IAlloc_Free(p->alloc, p->inBuf);
+  IAlloc_Free(p->alloc, p->outBuf);
+  p->inBuf = p->outBuf = 0;
+}
+
+SRes EncStream_Feed(CEncStream *p, const Byte *src, size_t *srcLen)
+{
+  size_t rem = *srcLen;
+  SRes res = SZ_OK;
+  *srcLen = 0;
+  CriticalSection_Enter(&p->cs);
+  if (p->finished && p->res != SZ_OK)
+    res = p->res;
+  else if (p->ended)
+    res = SZ_ERROR_PARAM;
+  else
+  {
+    if (rem > p->bufSize - p->inAvail)
+      rem = p->bufSize - p->inAvail;
+    *srcLen = rem;
+    while (rem != 0)
+    {
+      size_t pos = p->inPos + p->inAvail;
+      size_t n;
+      if (pos >= p->bufSize)
+        pos -= p->bufSize;
+      n = p->bufSize - pos;
+      if (n > rem)
+        n = rem;
+      memcpy(p->inBuf + pos, src, n);
+      src += n;
+      rem -= n;
+      p->inAvail += n;
+    }
+  }
+  CriticalSection_Leave(&p->cs);
+  if (*srcLen != 0)
+    Event_Set(&p->inputEvent);
+  return res;
+}
+
+SRes EncStream_Drain(CEncStream *p, Byte *dest, size_t *destLen, Bool *finished)
+{
+  size_t rem = *destLen;
+  SRes res = SZ_OK;
+  *destLen = 0;
+  *finished = False;
+  if (rem == 0)
+    return SZ_OK;
+  CriticalSection_Enter(&p->cs);
+  for (;;)
+  {
+    if (p->outAvail != 0)
+    {
+      if (rem > p->outAvail)
+        rem = p->outAvail;
+      *destLen = rem;
+      while (rem != 0)
+      {
+        size_t n = p->bufSize - p->outPos;
+        if (n > rem)
+          n = rem;
+        memcpy(dest, p->outBuf + p->outPos, n);
+        dest += n;
+        rem -= n;
+        p->outAvail -= n;
+        p->outPos += n;
+        if (p->outPos == p->bufSize)
+          p->outPos = 0;
+      }
+      Event_Set(&p->spaceEvent);
+      break;
+    }
+    if (p->finished)
+    {
+      res = p->res;
+      *finished = (res == SZ_OK);
+      break;
+    }
+    if (p->waitingForInput && p->inAvail == 0 && !p->flushRequested && !p->ended)
+      break;
+    CriticalSection_Leave(&p->cs);
+    Event_Wait(&p->callerEvent);
+    CriticalSection_Enter(&p->cs);
+  }
+  CriticalSection_Leave(&p->cs);
+  return res;
+}
+
+SRes EncStream_Flush(CEncStream *p)
+{
+  if (p->lzma != 0)
+    return SZ_ERROR_UNSUPPORTED;
+  CriticalSection_Enter(&p->cs);
+  p->flushRequested = True;
+  CriticalSection_Leave(&p->cs);
+  Event_Set(&p->inputEvent);
+  return SZ_OK;
+}
+
+SRes EncStream_End(CEncStream *p)
+{
+  CriticalSection_Enter(&p->cs);
+  p->ended = True;
+  CriticalSection_Leave(&p->cs);
+  Event_Set(&p->inputEvent);
+  return SZ_OK;
+}
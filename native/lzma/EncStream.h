@@ -0,0 +1,90 @@
+/* EncStream.h -- Push interface for the LZMA and LZMA2 encoders
+2026-10-17 : Public domain */
+
+#ifndef __ENC_STREAM_H
+#define __ENC_STREAM_H
+
+#include "LzmaEnc.h"
+#include "Lzma2Enc.h"
+#include "Threads.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* LzmaEnc_Encode and Lzma2Enc_Encode pull their input from an ISeqInStream and push their output
+   into an ISeqOutStream until the input ends. CEncStream runs one of them on a coder thread between
+   two rings of bufSize bytes, so that the caller can push input and pull output in pieces of any size:
+
+     EncStream_Feed   copies input into the input ring, as much as fits;
+     EncStream_Drain  copies output from the output ring. It waits until there is output, or the
+                      encoder waits for input that was not fed yet, or the stream is finished;
+     EncStream_Flush  (LZMA2 only) makes the encoder write everything fed so far: the current run of
+                      Lzma2Enc_Encode ends, its end marker is dropped and the next run starts with
+                      a dictionary reset, so the output stays a single LZMA2 stream;
+     EncStream_End    ends the input; EncStream_Drain returns the rest of the output and then
+                      reports that the stream is finished.
+
+   If EncStream_Feed cannot copy all input, the caller drains before it feeds the rest; the drain
+   waits for the encoder. The caller functions must not be called concurrently for the same stream.
+   EncStream_Destruct aborts an unfinished encoder. The encoder handles stay owned by the caller. */
+
+#define ENC_STREAM_BUF_SIZE_DEFAULT (1 << 20)
+
+typedef struct
+{
+  ISeqInStream inStream;
+  ISeqOutStream outStream;
+  CLzmaEncHandle lzma;
+  CLzma2EncHandle lzma2;
+  ISzAlloc *alloc;
+  ISzAlloc *allocBig;
+
+  CThread thread;
+  CCriticalSection cs;
+  CAutoResetEvent inputEvent;   /* the coder may read: input was fed, or the input ends, or abort */
+  CAutoResetEvent spaceEvent;   /* the coder may write: output was drained, or abort */
+  CAutoResetEvent callerEvent;  /* the caller may drain: output, waiting for input, run ended, finished */
+
+  Byte *inBuf;
+  size_t inPos;
+  size_t inAvail;
+  Byte *outBuf;
+  size_t outPos;
+  size_t outAvail;
+  size_t bufSize;
+
+  Bool ended;
+  Bool flushRequested;
+  Bool runEndedByEnd;
+  Bool waitingForInput;
+  Bool finished;
+  Bool aborted;
+  SRes res;
+
+  Bool hasPending;  /* LZMA2: the last written byte, held back in case it is the end marker of a flushed run */
+  Byte pending;
+} CEncStream;
+
+#define EncStream_Construct(p) { Thread_Construct(&(p)->thread); (p)->inBuf = 0; (p)->outBuf = 0; }
+
+/* exactly one of lzma and lzma2 is not NULL; alloc and allocBig are passed to LzmaEnc_Encode */
+SRes EncStream_Create(CEncStream *p, CLzmaEncHandle lzma, CLzma2EncHandle lzma2, size_t bufSize,
+    ISzAlloc *alloc, ISzAlloc *allocBig);
+void EncStream_Destruct(CEncStream *p);
+
+/* EncStream_Feed: *srcLen is the size of src on input and the number of copied bytes on output.
+   EncStream_Drain: *destLen is the size of dest on input and the number of output bytes on output,
+   *finished is set when the stream is finished and all its output was drained.
+   After an encoder error EncStream_Feed and EncStream_Drain return the error. */
+
+SRes EncStream_Feed(CEncStream *p, const Byte *src, size_t *srcLen);
+SRes EncStream_Drain(CEncStream *p, Byte *dest, size_t *destLen, Bool *finished);
+SRes EncStream_Flush(CEncStream *p);
+SRes EncStream_End(CEncStream *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
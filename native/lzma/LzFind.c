@@ -11,9 +11,245 @@
 #define kNormalizeStepMin (1 << 10) /* it must be power of 2 */
 #define kNormalizeMask (~(kNormalizeStepMin - 1))
 #define kMaxHistorySize ((UInt32)3 << 30)
+#define kMaxHistorySize64 ((UInt32)0xFFFFFFFF - ((UInt32)1 << 20))
+#define kMaxReadSize ((UInt32)1 << 30)
 
 #define kStartMaxLen 3
 
+/* ---------- CPU features ---------- */
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+  #define LZ_FIND_X86
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+    #include <immintrin.h>
+  #endif
+  #include <emmintrin.h>
+  #if defined(_M_X64) || defined(__x86_64__)
+    #define LZ_FIND_X64
+  #endif
+  #ifdef __GNUC__
+    #define LZ_FIND_TARGET(s) __attribute__((target(s)))
+  #else
+    #define LZ_FIND_TARGET(s)
+  #endif
+#endif
+
+#define LZ_FIND_CPU_SSE2 1
+#define LZ_FIND_CPU_SSE41 2
+#define LZ_FIND_CPU_AVX2 4
+
+static unsigned LzFind_GetCpuFeatures(void)
+{
+  unsigned features = 0;
+  #ifdef LZ_FIND_X86
+  unsigned a, b, c, d;
+  #ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  a = (unsigned)regs[0]; b = (unsigned)regs[1]; c = (unsigned)regs[2]; d = (unsigned)regs[3];
+  #else
+  if (!__get_cpuid(1, &a, &b, &c, &d))
+    return 0;
+  #endif
+  if (((d >> 26) & 1) != 0)
+    features |= LZ_FIND_CPU_SSE2;
+  if (((c >> 19) & 1) != 0)
+    features |= LZ_FIND_CPU_SSE41;
+  #ifdef LZ_FIND_X64
+  /* AVX2 needs the cpu flag and the YMM state enabled by the OS (OSXSAVE, XCR0 bits 1 and 2) */
+  if (((c >> 27) & 1) != 0 && ((c >> 28) & 1) != 0)
+  {
+    unsigned xcr0;
+    #ifdef _MSC_VER
+    xcr0 = (unsigned)_xgetbv(0);
+    __cpuidex(regs, 7, 0);
+    b = (unsigned)regs[1];
+    #else
+    unsigned xcr0High;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+      b = 0;
+    #endif
+    if ((xcr0 & 6) == 6 && ((b >> 5) & 1) != 0)
+      features |= LZ_FIND_CPU_AVX2;
+  }
+  #endif
+  #endif
+  return features;
+}
+
+/* ---------- Match length ---------- */
+
+/* MatchLen_* return the first position in (len, lenLimit) at which pb and cur differ, or lenLimit.
+   That is the result of
+     while (++len != lenLimit) if (pb[len] != cur[len]) break;
+   The word and vector kernels find the first differing byte as the lowest set bit of the XOR
+   (or of the inverted compare mask) of a block, so they need a little-endian cpu. */
+
+static UInt32 MY_FAST_CALL MatchLen_Bytes(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  while (++len != lenLimit)
+    if (pb[len] != cur[len])
+      break;
+  return len;
+}
+
+#ifdef LZ_FIND_X86
+
+typedef size_t CLzWord;
+
+static CLzWord GetWord(const Byte *p)
+{
+  CLzWord v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned GetLowBit(CLzWord v)
+{
+  #ifdef _MSC_VER
+  unsigned long index;
+  #if defined(_M_X64)
+  _BitScanForward64(&index, v);
+  #else
+  _BitScanForward(&index, v);
+  #endif
+  return (unsigned)index;
+  #else
+  return (unsigned)(sizeof(v) == 8 ? __builtin_ctzll((unsigned long long)v) : __builtin_ctz((unsigned)v));
+  #endif
+}
+
+/* len is the first position to compare, not the last equal one */
+static UInt32 MatchLen_WordsFrom(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  for (; len + sizeof(CLzWord) <= lenLimit; len += sizeof(CLzWord))
+  {
+    CLzWord d = GetWord(pb + len) ^ GetWord(cur + len);
+    if (d != 0)
+      return len + (GetLowBit(d) >> 3);
+  }
+  for (; len < lenLimit; len++)
+    if (pb[len] != cur[len])
+      break;
+  return len;
+}
+
+static UInt32 MY_FAST_CALL MatchLen_Words(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  return MatchLen_WordsFrom(pb, cur, len + 1, lenLimit);
+}
+
+LZ_FIND_TARGET("sse2")
+static UInt32 MY_FAST_CALL MatchLen_Sse2(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  for (len++; len + 16 <= lenLimit; len += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(pb + len));
+    __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(cur + len));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+    if (mask != 0)
+      return len + GetLowBit(mask);
+  }
+  return MatchLen_WordsFrom(pb, cur, len, lenLimit);
+}
+
+#ifdef LZ_FIND_X64
+
+LZ_FIND_TARGET("avx2")
+static UInt32 MY_FAST_CALL MatchLen_Avx2(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  for (len++; len + 32 <= lenLimit; len += 32)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(const void *)(pb + len));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(const void *)(cur + len));
+    UInt32 mask = ~(UInt32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    if (mask != 0)
+      return len + GetLowBit(mask);
+  }
+  return MatchLen_WordsFrom(pb, cur, len, lenLimit);
+}
+
+#endif
+
+#endif
+
+typedef UInt32 (MY_FAST_CALL *LzFind_MatchLenFunc)(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit);
+
+#ifdef LZ_FIND_X86
+static unsigned g_MatchLenKernel = LZ_FIND_MATCH_LEN_WORDS;
+static LzFind_MatchLenFunc g_MatchLenLong = MatchLen_Words;
+#else
+static unsigned g_MatchLenKernel = LZ_FIND_MATCH_LEN_BYTES;
+static LzFind_MatchLenFunc g_MatchLenLong = MatchLen_Bytes;
+#endif
+
+unsigned LzFind_GetDefaultMatchLenKernel(void)
+{
+  #ifdef LZ_FIND_X86
+  unsigned features = LzFind_GetCpuFeatures();
+  if ((features & LZ_FIND_CPU_AVX2) != 0)
+    return LZ_FIND_MATCH_LEN_AVX2;
+  if ((features & LZ_FIND_CPU_SSE2) != 0)
+    return LZ_FIND_MATCH_LEN_SSE2;
+  return LZ_FIND_MATCH_LEN_WORDS;
+  #else
+  return LZ_FIND_MATCH_LEN_BYTES;
+  #endif
+}
+
+unsigned LzFind_GetMatchLenKernel(void)
+{
+  return g_MatchLenKernel;
+}
+
+void LzFind_SetMatchLenKernel(unsigned kernel)
+{
+  LzFind_MatchLenFunc func = MatchLen_Bytes;
+  if (kernel > LzFind_GetDefaultMatchLenKernel())
+    kernel = LzFind_GetDefaultMatchLenKernel();
+  #ifdef LZ_FIND_X86
+  switch (kernel)
+  {
+    case LZ_FIND_MATCH_LEN_WORDS: func = MatchLen_Words; break;
+    case LZ_FIND_MATCH_LEN_SSE2: func = MatchLen_Sse2; break;
+    #ifdef LZ_FIND_X64
+    case LZ_FIND_MATCH_LEN_AVX2: func = MatchLen_Avx2; break;
+    #endif
+    default: kernel = LZ_FIND_MATCH_LEN_BYTES; break;
+  }
+  #else
+  kernel = LZ_FIND_MATCH_LEN_BYTES;
+  #endif
+  g_MatchLenKernel = kernel;
+  g_MatchLenLong = func;
+}
+
+/* Most candidates differ within a few bytes, so the first word is compared here and only
+   longer matches go through the selected kernel. */
+
+#ifdef LZ_FIND_X86
+#define MATCH_LEN(pb, cur, len, lenLimit) \
+  (g_MatchLenKernel == LZ_FIND_MATCH_LEN_BYTES ? MatchLen_Bytes(pb, cur, len, lenLimit) : MatchLen_First(pb, cur, len, lenLimit))
+
+static UInt32 MatchLen_First(const Byte *pb, const Byte *cur, UInt32 len, UInt32 lenLimit)
+{
+  if (len + 1 + sizeof(CLzWord) <= lenLimit)
+  {
+    CLzWord d = GetWord(pb + len + 1) ^ GetWord(cur + len + 1);
+    if (d != 0)
+      return len + 1 + (GetLowBit(d) >> 3);
+    return g_MatchLenLong(pb, cur, len + (UInt32)sizeof(CLzWord), lenLimit);
+  }
+  return MatchLen_Bytes(pb, cur, len, lenLimit);
+}
+#else
+#define MATCH_LEN(pb, cur, len, lenLimit) MatchLen_Bytes(pb, cur, len, lenLimit)
+#endif
+
 static void LzInWindow_Free(CMatchFinder *p, ISzAlloc *alloc)
 {
   if (!p->directInput)
@@ -23,11 +259,11 @@ static void LzInWindow_Free(CMatchFinder *p, ISzAlloc *alloc)
   }
 }
 
-/* keepSizeBefore + keepSizeAfter + keepSizeReserv must be < 4G) */
+/* keepSizeBefore + keepSizeAfter + keepSizeReserv must fit into size_t */
 
 static int LzInWindow_Create(CMatchFinder *p, UInt32 keepSizeReserv, ISzAlloc *alloc)
 {
-  UInt32 blockSize = p->keepSizeBefore + p->keepSizeAfter + keepSizeReserv;
+  size_t blockSize = (size_t)p->keepSizeBefore + p->keepSizeAfter + keepSizeReserv;
   if (p->directInput)
   {
     p->blockSize = blockSize;
@@ -37,7 +273,7 @@ static int LzInWindow_Create(CMatchFinder *p, UInt32 keepSizeReserv, ISzAlloc *a
   {
     LzInWindow_Free(p, alloc);
     p->blockSize = blockSize;
-    p->bufferBase = (Byte *)alloc->Alloc(alloc, (size_t)blockSize);
+    p->bufferBase = (Byte *)alloc->Alloc(alloc, blockSize);
   }
   return (p->bufferBase != 0);
 }
@@ -47,8 +283,14 @@ Byte MatchFinder_GetIndexByte(CMatchFinder *p, Int32 index) { return p->buffer[i
 
 UInt32 MatchFinder_GetNumAvailableBytes(CMatchFinder *p) { return p->streamPos - p->pos; }
 
+UInt64 MatchFinder_GetPos64(CMatchFinder *p)
+{
+  return p->posBase + p->pos - p->cyclicBufferSize;
+}
+
 void MatchFinder_ReduceOffsets(CMatchFinder *p, UInt32 subValue)
 {
+  p->posBase += subValue;
   p->posLimit -= subValue;
   p->pos -= subValue;
   p->streamPos -= subValue;
@@ -60,7 +302,8 @@ static void MatchFinder_ReadBlock(CMatchFinder *p)
     return;
   if (p->directInput)
   {
-    UInt32 curSize = 0xFFFFFFFF - p->streamPos;
+    /* with 64-bit positions streamPos may wrap, it only has to stay less than 4 GB ahead of pos */
+    UInt32 curSize = p->pos64 ? kMaxReadSize : 0xFFFFFFFF - p->streamPos;
     if (curSize > p->directInputRem)
       curSize = (UInt32)p->directInputRem;
     p->directInputRem -= curSize;
@@ -75,6 +318,8 @@ static void MatchFinder_ReadBlock(CMatchFinder *p)
     size_t size = (p->bufferBase + p->blockSize - dest);
     if (size == 0)
       return;
+    if (size > kMaxReadSize)
+      size = kMaxReadSize;
     p->result = p->stream->Read(p->stream, dest, &size);
     if (p->result != SZ_OK)
       return;
@@ -93,7 +338,7 @@ void MatchFinder_MoveBlock(CMatchFinder *p)
 {
   memmove(p->bufferBase,
     p->buffer - p->keepSizeBefore,
-    (size_t)(p->streamPos - p->pos + p->keepSizeBefore));
+    (size_t)(p->streamPos - p->pos) + p->keepSizeBefore);
   p->buffer = p->bufferBase + p->keepSizeBefore;
 }
 
@@ -126,6 +371,7 @@ static void MatchFinder_SetDefaultSettings(CMatchFinder *p)
   p->btMode = 1;
   p->numHashBytes = 4;
   p->bigHash = 0;
+  p->pos64 = 1;
 }
 
 #define kCrcPoly 0xEDB88320
@@ -161,7 +407,7 @@ void MatchFinder_Free(CMatchFinder *p, ISzAlloc *alloc)
   LzInWindow_Free(p, alloc);
 }
 
-static CLzRef* AllocRefs(UInt32 num, ISzAlloc *alloc)
+static CLzRef* AllocRefs(size_t num, ISzAlloc *alloc)
 {
   size_t sizeInBytes = (size_t)num * sizeof(CLzRef);
   if (sizeInBytes / sizeof(CLzRef) != num)
@@ -169,12 +415,22 @@ static CLzRef* AllocRefs(UInt32 num, ISzAlloc *alloc)
   return (CLzRef *)alloc->Alloc(alloc, sizeInBytes);
 }
 
+/* With btMode 2 son points to the buckets, which follow the fixed hash tables, aligned so that no
+   bucket spans two cache lines. */
+static void MatchFinder_SetBuckets(CMatchFinder *p)
+{
+  p->son = p->hash + p->fixedHashSize;
+  while (((size_t)p->son & (kHbBucketSize * sizeof(CLzRef) - 1)) != 0)
+    p->son++;
+}
+
 int MatchFinder_Create(CMatchFinder *p, UInt32 historySize,
     UInt32 keepAddBufferBefore, UInt32 matchMaxLen, UInt32 keepAddBufferAfter,
     ISzAlloc *alloc)
 {
   UInt32 sizeReserv;
-  if (historySize > kMaxHistorySize)
+  if (historySize > ((p->pos64 && sizeof(size_t) > 4) ? kMaxHistorySize64 : kMaxHistorySize) ||
+      historySize + keepAddBufferBefore + 1 <= historySize)
   {
     MatchFinder_Free(p, alloc);
     return 0;
@@ -218,24 +474,35 @@ int MatchFinder_Create(CMatchFinder *p, UInt32 historySize,
       if (p->numHashBytes > 2) p->fixedHashSize += kHash2Size;
       if (p->numHashBytes > 3) p->fixedHashSize += kHash3Size;
       if (p->numHashBytes > 4) p->fixedHashSize += kHash4Size;
+      if (p->btMode == 2)
+      {
+        /* buckets of kHbBucketSize heads instead of the son array, about one head per byte of
+           history, and one more bucket to align them (see MatchFinder_SetBuckets) */
+        p->fixedHashSize = kFix4HashSize;
+        p->hashMask = (hs >> 2) - 1;
+        hs = (p->hashMask + 2) * kHbBucketSize;
+      }
       hs += p->fixedHashSize;
     }
 
     {
-      UInt32 prevSize = p->hashSizeSum + p->numSons;
-      UInt32 newSize;
+      size_t prevSize = p->hashSizeSum + p->numSons;
+      size_t newSize;
       p->historySize = historySize;
       p->hashSizeSum = hs;
       p->cyclicBufferSize = newCyclicBufferSize;
-      p->numSons = (p->btMode ? newCyclicBufferSize * 2 : newCyclicBufferSize);
+      p->numSons = (p->btMode == 2 ? 0 : p->btMode ? (size_t)newCyclicBufferSize * 2 : newCyclicBufferSize);
       newSize = p->hashSizeSum + p->numSons;
-      if (p->hash != 0 && prevSize == newSize)
-        return 1;
-      MatchFinder_FreeThisClassMemory(p, alloc);
-      p->hash = AllocRefs(newSize, alloc);
+      if (p->hash == 0 || prevSize != newSize)
+      {
+        MatchFinder_FreeThisClassMemory(p, alloc);
+        p->hash = AllocRefs(newSize, alloc);
+      }
       if (p->hash != 0)
       {
         p->son = p->hash + p->hashSizeSum;
+        if (p->btMode == 2)
+          MatchFinder_SetBuckets(p);
         return 1;
       }
     }
@@ -246,8 +513,12 @@ int MatchFinder_Create(CMatchFinder *p, UInt32 historySize,
 
 static void MatchFinder_SetLimits(CMatchFinder *p)
 {
+  /* stop where pos reaches kMaxValForNormalize, or with 64-bit positions where it wraps to 0 */
   UInt32 limit = kMaxValForNormalize - p->pos;
-  UInt32 limit2 = p->cyclicBufferSize - p->cyclicBufferPos;
+  UInt32 limit2;
+  if (p->pos64 && p->pos != 0)
+    limit = (UInt32)0 - p->pos;
+  limit2 = p->cyclicBufferSize - p->cyclicBufferPos;
   if (limit2 < limit)
     limit = limit2;
   limit2 = p->streamPos - p->pos;
@@ -277,6 +548,7 @@ void MatchFinder_Init(CMatchFinder *p)
   p->cyclicBufferPos = 0;
   p->buffer = p->bufferBase;
   p->pos = p->streamPos = p->cyclicBufferSize;
+  p->posBase = 0;
   p->result = SZ_OK;
   p->streamEndWasReached = 0;
   MatchFinder_ReadBlock(p);
@@ -288,7 +560,13 @@ static UInt32 MatchFinder_GetSubValue(CMatchFinder *p)
   return (p->pos - p->historySize - 1) & kNormalizeMask;
 }
 
-void MatchFinder_Normalize3(UInt32 subValue, CLzRef *items, UInt32 numItems)
+/* ---------- Normalize ---------- */
+
+/* Normalizing subtracts subValue from every position in the hash and son arrays, and positions that
+   are not above subValue become kEmptyHashValue (0): a saturating subtraction, max(v, subValue) - subValue.
+   The vector kernels do it for 4 (SSE4.1) or 8 (AVX2) positions at once. */
+
+static void MY_FAST_CALL Normalize_Scalar(UInt32 subValue, CLzRef *items, UInt32 numItems)
 {
   UInt32 i;
   for (i = 0; i < numItems; i++)
@@ -302,16 +580,123 @@ void MatchFinder_Normalize3(UInt32 subValue, CLzRef *items, UInt32 numItems)
   }
 }
 
+#ifdef LZ_FIND_X86
+
+LZ_FIND_TARGET("sse4.1")
+static void MY_FAST_CALL Normalize_Sse41(UInt32 subValue, CLzRef *items, UInt32 numItems)
+{
+  __m128i sub = _mm_set1_epi32((Int32)subValue);
+  UInt32 head = (UInt32)((0 - ((size_t)items >> 2)) & 3);
+  UInt32 i;
+  if (head > numItems)
+    head = numItems;
+  Normalize_Scalar(subValue, items, head);
+  items += head;
+  numItems -= head;
+  for (i = 0; i + 8 <= numItems; i += 8)
+  {
+    __m128i *v = (__m128i *)(void *)(items + i);
+    v[0] = _mm_sub_epi32(_mm_max_epu32(v[0], sub), sub);
+    v[1] = _mm_sub_epi32(_mm_max_epu32(v[1], sub), sub);
+  }
+  Normalize_Scalar(subValue, items + i, numItems - i);
+}
+
+#ifdef LZ_FIND_X64
+
+LZ_FIND_TARGET("avx2")
+static void MY_FAST_CALL Normalize_Avx2(UInt32 subValue, CLzRef *items, UInt32 numItems)
+{
+  __m256i sub = _mm256_set1_epi32((Int32)subValue);
+  UInt32 head = (UInt32)((0 - ((size_t)items >> 2)) & 7);
+  UInt32 i;
+  if (head > numItems)
+    head = numItems;
+  Normalize_Scalar(subValue, items, head);
+  items += head;
+  numItems -= head;
+  for (i = 0; i + 16 <= numItems; i += 16)
+  {
+    __m256i *v = (__m256i *)(void *)(items + i);
+    v[0] = _mm256_sub_epi32(_mm256_max_epu32(v[0], sub), sub);
+    v[1] = _mm256_sub_epi32(_mm256_max_epu32(v[1], sub), sub);
+  }
+  Normalize_Scalar(subValue, items + i, numItems - i);
+}
+
+#endif
+
+#endif
+
+typedef void (MY_FAST_CALL *LzFind_NormalizeFunc)(UInt32 subValue, CLzRef *items, UInt32 numItems);
+
+static unsigned g_NormalizeKernel = LZ_FIND_NORMALIZE_SCALAR;
+static LzFind_NormalizeFunc g_Normalize = Normalize_Scalar;
+
+unsigned LzFind_GetDefaultNormalizeKernel(void)
+{
+  unsigned features = LzFind_GetCpuFeatures();
+  if ((features & LZ_FIND_CPU_AVX2) != 0)
+    return LZ_FIND_NORMALIZE_AVX2;
+  if ((features & LZ_FIND_CPU_SSE41) != 0)
+    return LZ_FIND_NORMALIZE_SSE41;
+  return LZ_FIND_NORMALIZE_SCALAR;
+}
+
+unsigned LzFind_GetNormalizeKernel(void)
+{
+  return g_NormalizeKernel;
+}
+
+void LzFind_SetNormalizeKernel(unsigned kernel)
+{
+  LzFind_NormalizeFunc func = Normalize_Scalar;
+  if (kernel > LzFind_GetDefaultNormalizeKernel())
+    kernel = LzFind_GetDefaultNormalizeKernel();
+  #ifdef LZ_FIND_X86
+  switch (kernel)
+  {
+    case LZ_FIND_NORMALIZE_SSE41: func = Normalize_Sse41; break;
+    #ifdef LZ_FIND_X64
+    case LZ_FIND_NORMALIZE_AVX2: func = Normalize_Avx2; break;
+    #endif
+    default: kernel = LZ_FIND_NORMALIZE_SCALAR; break;
+  }
+  #else
+  kernel = LZ_FIND_NORMALIZE_SCALAR;
+  #endif
+  g_NormalizeKernel = kernel;
+  g_Normalize = func;
+}
+
+void MatchFinder_Normalize3(UInt32 subValue, CLzRef *items, UInt32 numItems)
+{
+  g_Normalize(subValue, items, numItems);
+}
+
 static void MatchFinder_Normalize(CMatchFinder *p)
 {
   UInt32 subValue = MatchFinder_GetSubValue(p);
-  MatchFinder_Normalize3(subValue, p->hash, p->hashSizeSum + p->numSons);
+  CLzRef *items = p->hash;
+  size_t numItems = p->hashSizeSum + p->numSons;
+  while (numItems != 0)
+  {
+    UInt32 num = (numItems > ((UInt32)1 << 30)) ? ((UInt32)1 << 30) : (UInt32)numItems;
+    MatchFinder_Normalize3(subValue, items, num);
+    items += num;
+    numItems -= num;
+  }
   MatchFinder_ReduceOffsets(p, subValue);
 }
 
 static void MatchFinder_CheckLimits(CMatchFinder *p)
 {
-  if (p->pos == kMaxValForNormalize)
+  if (p->pos64)
+  {
+    if (p->pos == 0)
+      p->posBase += (UInt64)1 << 32;
+  }
+  else if (p->pos == kMaxValForNormalize)
     MatchFinder_Normalize(p);
   if (!p->streamEndWasReached && p->keepSizeAfter == p->streamPos - p->pos)
     MatchFinder_CheckAndMoveAndRead(p);
@@ -320,25 +705,66 @@ static void MatchFinder_CheckLimits(CMatchFinder *p)
   MatchFinder_SetLimits(p);
 }
 
+/* ---------- Prefetch ---------- */
+
+/* The tree and chain walks below load the son entry and the bytes of every candidate from a position
+   that the previous load gave, and with a dictionary larger than the cache most of these loads miss.
+   The chain walk knows the next candidate one step ahead and prefetches its son entry and its bytes
+   while it compares the current one. The tree walk learns the next candidate only at the end of a
+   step, so it prefetches the son pair of the current candidate before it compares its bytes, and the
+   two misses overlap instead of following one another. */
+
+#if defined(__GNUC__)
+  #define LZ_FIND_PREFETCH(a) __builtin_prefetch((const void *)(a))
+#elif defined(LZ_FIND_X86)
+  #define LZ_FIND_PREFETCH(a) _mm_prefetch((const char *)(a), _MM_HINT_T0)
+#else
+  #define LZ_FIND_PREFETCH(a)
+#endif
+
+static Bool g_Prefetch = True;
+
+Bool LzFind_GetPrefetch(void)
+{
+  return g_Prefetch;
+}
+
+void LzFind_SetPrefetch(Bool enable)
+{
+  g_Prefetch = enable;
+}
+
+/* the son entry and the bytes at len of the chain candidate curMatch */
+#define PREFETCH_CANDIDATE(curMatch, len) \
+  if (prefetch) { UInt32 pd = pos - (curMatch); if (pd < _cyclicBufferSize) { \
+    LZ_FIND_PREFETCH(son + _cyclicBufferPos - pd + ((pd > _cyclicBufferPos) ? _cyclicBufferSize : 0)); \
+    LZ_FIND_PREFETCH(cur - pd + (len)); }}
+
+/* the HASH4_CALC bucket of the next position; it arrives while the current position is walked */
+#define PREFETCH_NEXT_HASH4 \
+  if (g_Prefetch && lenLimit > 4) { \
+    LZ_FIND_PREFETCH(p->hash + kFix4HashSize + HASH4_VALUE(cur + 1)); }
+
 static UInt32 * Hc_GetMatchesSpec(UInt32 lenLimit, UInt32 curMatch, UInt32 pos, const Byte *cur, CLzRef *son,
     UInt32 _cyclicBufferPos, UInt32 _cyclicBufferSize, UInt32 cutValue,
     UInt32 *distances, UInt32 maxLen)
 {
+  Bool prefetch = g_Prefetch;
+  UInt32 prevDelta = 0;
   son[_cyclicBufferPos] = curMatch;
   for (;;)
   {
     UInt32 delta = pos - curMatch;
-    if (cutValue-- == 0 || delta >= _cyclicBufferSize)
+    if (cutValue-- == 0 || delta >= _cyclicBufferSize || delta <= prevDelta)
       return distances;
+    prevDelta = delta;
     {
       const Byte *pb = cur - delta;
       curMatch = son[_cyclicBufferPos - delta + ((delta > _cyclicBufferPos) ? _cyclicBufferSize : 0)];
+      PREFETCH_CANDIDATE(curMatch, maxLen)
       if (pb[maxLen] == cur[maxLen] && *pb == *cur)
       {
-        UInt32 len = 0;
-        while (++len != lenLimit)
-          if (pb[len] != cur[len])
-            break;
+        UInt32 len = MATCH_LEN(pb, cur, 0, lenLimit);
         if (maxLen < len)
         {
           *distances++ = maxLen = len;
@@ -358,24 +784,29 @@ UInt32 * GetMatchesSpec1(UInt32 lenLimit, UInt32 curMatch, UInt32 pos, const Byt
   CLzRef *ptr0 = son + (_cyclicBufferPos << 1) + 1;
   CLzRef *ptr1 = son + (_cyclicBufferPos << 1);
   UInt32 len0 = 0, len1 = 0;
+  Bool prefetch = g_Prefetch;
+  UInt32 prevDelta = 0;
   for (;;)
   {
     UInt32 delta = pos - curMatch;
-    if (cutValue-- == 0 || delta >= _cyclicBufferSize)
+    if (cutValue-- == 0 || delta >= _cyclicBufferSize || delta <= prevDelta)
     {
-      *ptr0 = *ptr1 = kEmptyHashValue;
+      /* empty links: out of the window from now on, and older than their node until it leaves the
+         window, so that they do not turn into references when pos64 wraps */
+      *ptr0 = *ptr1 = pos - _cyclicBufferSize;
       return distances;
     }
+    prevDelta = delta;
     {
       CLzRef *pair = son + ((_cyclicBufferPos - delta + ((delta > _cyclicBufferPos) ? _cyclicBufferSize : 0)) << 1);
       const Byte *pb = cur - delta;
       UInt32 len = (len0 < len1 ? len0 : len1);
+      if (prefetch)
+        LZ_FIND_PREFETCH(pair);
       if (pb[len] == cur[len])
       {
         if (++len != lenLimit && pb[len] == cur[len])
-          while (++len != lenLimit)
-            if (pb[len] != cur[len])
-              break;
+          len = MATCH_LEN(pb, cur, len, lenLimit);
         if (maxLen < len)
         {
           *distances++ = maxLen = len;
@@ -412,23 +843,26 @@ static void SkipMatchesSpec(UInt32 lenLimit, UInt32 curMatch, UInt32 pos, const
   CLzRef *ptr0 = son + (_cyclicBufferPos << 1) + 1;
   CLzRef *ptr1 = son + (_cyclicBufferPos << 1);
   UInt32 len0 = 0, len1 = 0;
+  Bool prefetch = g_Prefetch;
+  UInt32 prevDelta = 0;
   for (;;)
   {
     UInt32 delta = pos - curMatch;
-    if (cutValue-- == 0 || delta >= _cyclicBufferSize)
+    if (cutValue-- == 0 || delta >= _cyclicBufferSize || delta <= prevDelta)
     {
-      *ptr0 = *ptr1 = kEmptyHashValue;
+      *ptr0 = *ptr1 = pos - _cyclicBufferSize;
       return;
     }
+    prevDelta = delta;
     {
       CLzRef *pair = son + ((_cyclicBufferPos - delta + ((delta > _cyclicBufferPos) ? _cyclicBufferSize : 0)) << 1);
       const Byte *pb = cur - delta;
       UInt32 len = (len0 < len1 ? len0 : len1);
+      if (prefetch)
+        LZ_FIND_PREFETCH(pair);
       if (pb[len] == cur[len])
       {
-        while (++len != lenLimit)
-          if (pb[len] != cur[len])
-            break;
+        len = MATCH_LEN(pb, cur, len, lenLimit);
         {
           if (len == lenLimit)
           {
@@ -456,6 +890,13 @@ static void SkipMatchesSpec(UInt32 lenLimit, UInt32 curMatch, UInt32 pos, const
   }
 }
 
+/* A hash2 (hash3) candidate at delta starts with the 2 (3) bytes at cur. That follows from the hash
+   and the first byte for the positions that the walks accept, but with 64-bit positions a stale hash
+   head may point to any position of the window, so the bytes are compared. */
+#define IS_CANDIDATE2(delta) ((delta) - 1 < p->historySize && \
+    (cur - (delta))[0] == cur[0] && (cur - (delta))[1] == cur[1])
+#define IS_CANDIDATE3(delta) (IS_CANDIDATE2(delta) && (cur - (delta))[2] == cur[2])
+
 #define MOVE_POS \
   ++p->cyclicBufferPos; \
   p->buffer++; \
@@ -520,11 +961,9 @@ static UInt32 Bt3_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
 
   maxLen = 2;
   offset = 0;
-  if (delta2 < p->cyclicBufferSize && *(cur - delta2) == *cur)
+  if (IS_CANDIDATE2(delta2))
   {
-    for (; maxLen != lenLimit; maxLen++)
-      if (cur[(ptrdiff_t)maxLen - delta2] != cur[maxLen])
-        break;
+    maxLen = MATCH_LEN(cur - delta2, cur, maxLen - 1, lenLimit);
     distances[0] = maxLen;
     distances[1] = delta2 - 1;
     offset = 2;
@@ -543,6 +982,7 @@ static UInt32 Bt4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
   GET_MATCHES_HEADER(4)
 
   HASH4_CALC;
+  PREFETCH_NEXT_HASH4
 
   delta2 = p->pos - p->hash[                hash2Value];
   delta3 = p->pos - p->hash[kFix3HashSize + hash3Value];
@@ -554,13 +994,13 @@ static UInt32 Bt4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
 
   maxLen = 1;
   offset = 0;
-  if (delta2 < p->cyclicBufferSize && *(cur - delta2) == *cur)
+  if (IS_CANDIDATE2(delta2))
   {
     distances[0] = maxLen = 2;
     distances[1] = delta2 - 1;
     offset = 2;
   }
-  if (delta2 != delta3 && delta3 < p->cyclicBufferSize && *(cur - delta3) == *cur)
+  if (delta2 != delta3 && IS_CANDIDATE3(delta3))
   {
     maxLen = 3;
     distances[offset + 1] = delta3 - 1;
@@ -569,9 +1009,7 @@ static UInt32 Bt4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
   }
   if (offset != 0)
   {
-    for (; maxLen != lenLimit; maxLen++)
-      if (cur[(ptrdiff_t)maxLen - delta2] != cur[maxLen])
-        break;
+    maxLen = MATCH_LEN(cur - delta2, cur, maxLen - 1, lenLimit);
     distances[offset - 2] = maxLen;
     if (maxLen == lenLimit)
     {
@@ -590,6 +1028,7 @@ static UInt32 Hc4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
   GET_MATCHES_HEADER(4)
 
   HASH4_CALC;
+  PREFETCH_NEXT_HASH4
 
   delta2 = p->pos - p->hash[                hash2Value];
   delta3 = p->pos - p->hash[kFix3HashSize + hash3Value];
@@ -601,7 +1040,7 @@ static UInt32 Hc4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
 
   maxLen = 1;
   offset = 0;
-  if (delta2 < p->cyclicBufferSize && *(cur - delta2) == *cur)
+  if (IS_CANDIDATE2(delta2))
   {
 TR("Hc4_MatchFinder_GetMatches:a1",maxLen);
 TR("Hc4_MatchFinder_GetMatches:a2",delta2);
@@ -609,7 +1048,7 @@ TR("Hc4_MatchFinder_GetMatches:a2",delta2);
     distances[1] = delta2 - 1;
     offset = 2;
   }
-  if (delta2 != delta3 && delta3 < p->cyclicBufferSize && *(cur - delta3) == *cur)
+  if (delta2 != delta3 && IS_CANDIDATE3(delta3))
   {
 TR("Hc4_MatchFinder_GetMatches:b1",offset);
 TR("Hc4_MatchFinder_GetMatches:b2",delta3);
@@ -620,9 +1059,7 @@ TR("Hc4_MatchFinder_GetMatches:b2",delta3);
   }
   if (offset != 0)
   {
-    for (; maxLen != lenLimit; maxLen++)
-      if (cur[(ptrdiff_t)maxLen - delta2] != cur[maxLen])
-        break;
+    maxLen = MATCH_LEN(cur - delta2, cur, maxLen - 1, lenLimit);
 TR("Hc4_MatchFinder_GetMatches:c1",offset);
 TR("Hc4_MatchFinder_GetMatches:c2",maxLen);
     distances[offset - 2] = maxLen;
@@ -740,6 +1177,131 @@ void Hc3Zip_MatchFinder_Skip(CMatchFinder *p, UInt32 num)
   while (--num != 0);
 }
 
+/* ---------- Hash buckets ---------- */
+
+/* HB4 (btMode 2) keeps the kHbBucketSize most recent positions of every bucket, newest first, in one
+   aligned 32-byte bucket instead of a chain or a tree in the son array. A lookup reads that bucket and
+   checks up to cutValue of its heads, so every position costs about the same, with about one random
+   access, but only these heads are candidates and the ratio is lower than with HC4 and BT4. Different
+   4-byte values share a bucket, and with 64-bit positions the heads may be stale, so every candidate
+   is compared from its first byte. */
+
+#define PREFETCH_NEXT_HB4 \
+  if (g_Prefetch && lenLimit > 4) \
+    LZ_FIND_PREFETCH(p->son + (size_t)HB4_BUCKET(cur + 1) * kHbBucketSize);
+
+#define HB_INSERT(bucket) { unsigned i; \
+  for (i = kHbBucketSize - 1; i != 0; i--) (bucket)[i] = (bucket)[i - 1]; \
+  (bucket)[0] = p->pos; }
+
+static UInt32 * Hb_GetMatchesSpec(UInt32 lenLimit, const CLzRef *bucket, UInt32 pos, const Byte *cur,
+    UInt32 _cyclicBufferSize, UInt32 cutValue, UInt32 *distances, UInt32 maxLen)
+{
+  unsigned i;
+  if (cutValue > kHbBucketSize)
+    cutValue = kHbBucketSize;
+  for (i = 0; i < cutValue; i++)
+  {
+    UInt32 delta = pos - bucket[i];
+    if (delta - 1 < _cyclicBufferSize - 1)
+    {
+      const Byte *pb = cur - delta;
+      if (pb[maxLen] == cur[maxLen] && *pb == *cur)
+      {
+        UInt32 len = MATCH_LEN(pb, cur, 0, lenLimit);
+        if (maxLen < len)
+        {
+          *distances++ = maxLen = len;
+          *distances++ = delta - 1;
+          if (len == lenLimit)
+            break;
+        }
+      }
+    }
+  }
+  return distances;
+}
+
+static UInt32 Hb4_MatchFinder_GetMatches(CMatchFinder *p, UInt32 *distances)
+{
+  UInt32 lenLimit, hashValue, hash2Value, hash3Value, delta2, delta3, maxLen, offset;
+  const Byte *cur;
+  CLzRef *bucket;
+  lenLimit = p->lenLimit;
+  if (lenLimit < 4)
+  {
+    MatchFinder_MovePos(p);
+    return 0;
+  }
+  cur = p->buffer;
+
+  HB4_CALC;
+  PREFETCH_NEXT_HB4
+
+  delta2 = p->pos - p->hash[                hash2Value];
+  delta3 = p->pos - p->hash[kFix3HashSize + hash3Value];
+  bucket = p->son + (size_t)hashValue * kHbBucketSize;
+
+  p->hash[                hash2Value] =
+  p->hash[kFix3HashSize + hash3Value] = p->pos;
+
+  maxLen = 1;
+  offset = 0;
+  if (IS_CANDIDATE2(delta2))
+  {
+    distances[0] = maxLen = 2;
+    distances[1] = delta2 - 1;
+    offset = 2;
+  }
+  if (delta2 != delta3 && IS_CANDIDATE3(delta3))
+  {
+    maxLen = 3;
+    distances[offset + 1] = delta3 - 1;
+    offset += 2;
+    delta2 = delta3;
+  }
+  if (offset != 0)
+  {
+    maxLen = MATCH_LEN(cur - delta2, cur, maxLen - 1, lenLimit);
+    distances[offset - 2] = maxLen;
+    if (maxLen == lenLimit)
+    {
+      HB_INSERT(bucket);
+      MOVE_POS_RET;
+    }
+  }
+  if (maxLen < 3)
+    maxLen = 3;
+  offset = (UInt32)(Hb_GetMatchesSpec(lenLimit, bucket, p->pos, cur, p->cyclicBufferSize, p->cutValue,
+    distances + offset, maxLen) - (distances));
+  HB_INSERT(bucket);
+  MOVE_POS_RET
+}
+
+static void Hb4_MatchFinder_Skip(CMatchFinder *p, UInt32 num)
+{
+  do
+  {
+    UInt32 lenLimit, hashValue, hash2Value, hash3Value;
+    const Byte *cur;
+    CLzRef *bucket;
+    lenLimit = p->lenLimit;
+    if (lenLimit < 4)
+    {
+      MatchFinder_MovePos(p);
+      continue;
+    }
+    cur = p->buffer;
+    HB4_CALC;
+    bucket = p->son + (size_t)hashValue * kHbBucketSize;
+    p->hash[                hash2Value] =
+    p->hash[kFix3HashSize + hash3Value] = p->pos;
+    HB_INSERT(bucket);
+    MOVE_POS
+  }
+  while (--num != 0);
+}
+
 void MatchFinder_CreateVTable(CMatchFinder *p, IMatchFinder *vTable)
 {
   TR("MatchFinder_CreateVTable",p->numHashBytes);
@@ -752,6 +1314,11 @@ void MatchFinder_CreateVTable(CMatchFinder *p, IMatchFinder *vTable)
     vTable->GetMatches = (Mf_GetMatches_Func)Hc4_MatchFinder_GetMatches;
     vTable->Skip = (Mf_Skip_Func)Hc4_MatchFinder_Skip;
   }
+  else if (p->btMode == 2)
+  {
+    vTable->GetMatches = (Mf_GetMatches_Func)Hb4_MatchFinder_GetMatches;
+    vTable->Skip = (Mf_Skip_Func)Hb4_MatchFinder_Skip;
+  }
   else if (p->numHashBytes == 2)
   {
     vTable->GetMatches = (Mf_GetMatches_Func)Bt2_MatchFinder_GetMatches;
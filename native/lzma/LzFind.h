@@ -33,7 +33,7 @@ typedef struct _CMatchFinder
   ISeqInStream *stream;
   int streamEndWasReached;
 
-  UInt32 blockSize;
+  size_t blockSize;
   UInt32 keepSizeBefore;
   UInt32 keepSizeAfter;
 
@@ -42,10 +42,12 @@ typedef struct _CMatchFinder
   size_t directInputRem;
   int btMode;
   int bigHash;
+  int pos64;
   UInt32 historySize;
   UInt32 fixedHashSize;
   UInt32 hashSizeSum;
-  UInt32 numSons;
+  size_t numSons;
+  UInt64 posBase;
   SRes result;
   UInt32 crc[256];
 } CMatchFinder;
@@ -63,20 +65,78 @@ void MatchFinder_ReadIfRequired(CMatchFinder *p);
 void MatchFinder_Construct(CMatchFinder *p);
 
 /* Conditions:
-     historySize <= 3 GB
+     historySize <= 3 GB, or 4 GB - 1 MB with pos64 on 64-bit hosts
      keepAddBufferBefore + matchMaxLen + keepAddBufferAfter < 511MB
+
+   pos64 (set by MatchFinder_Construct, cleared by MatchFinderMt_Create) selects 64-bit positions:
+   the stream position is posBase + pos, the hash and son arrays keep its low 32 bits and the
+   distances are their 32-bit differences. pos wraps every 4 GB instead of being normalized. The
+   walks accept a reference only inside the window and older than the one before it, and compare
+   the bytes of hash2 and hash3 candidates, so stale references, which may now wrap to any position
+   of the window, only cost wasted candidates. Without pos64 all positions are reduced by
+   MatchFinder_Normalize3 every 4 GB - historySize bytes. Both modes find the same matches in the
+   first 4 GB - historySize bytes of a stream.
+
+   btMode selects the match finder:
+     0 - hash chain (HC4), numHashBytes must be 4;
+     1 - binary tree (BT2, BT3 or BT4 by numHashBytes);
+     2 - hash buckets (HB4): a multiplicative hash of 4 bytes selects a bucket that holds the 8 most
+         recent positions with that hash, and up to cutValue of them are the candidates. It has no
+         son array and reads one bucket per position whatever cutValue is, but it finds fewer and
+         shorter matches than HC4 and BT4. numHashBytes is ignored.
 */
 int MatchFinder_Create(CMatchFinder *p, UInt32 historySize,
     UInt32 keepAddBufferBefore, UInt32 matchMaxLen, UInt32 keepAddBufferAfter,
     ISzAlloc *alloc);
 void MatchFinder_Free(CMatchFinder *p, ISzAlloc *alloc);
+UInt64 MatchFinder_GetPos64(CMatchFinder *p);  /* bytes of the stream before the current position */
 void MatchFinder_Normalize3(UInt32 subValue, CLzRef *items, UInt32 numItems);
+
+/* Normalize kernels of MatchFinder_Normalize3:
+     LZ_FIND_NORMALIZE_SCALAR - one position per step, the reference.
+     LZ_FIND_NORMALIZE_SSE41  - saturating subtraction of 4 positions per instruction (x86 with SSE4.1).
+     LZ_FIND_NORMALIZE_AVX2   - 8 positions per instruction (x86-64 with AVX2).
+   All kernels give the same result. The default and set functions work like those of the match
+   length kernels below. */
+
+#define LZ_FIND_NORMALIZE_SCALAR 0
+#define LZ_FIND_NORMALIZE_SSE41 1
+#define LZ_FIND_NORMALIZE_AVX2 2
+
+unsigned LzFind_GetDefaultNormalizeKernel(void);
+unsigned LzFind_GetNormalizeKernel(void);
+void LzFind_SetNormalizeKernel(unsigned kernel);
+
+/* Software prefetch in the BT and HC walks and of the next hash bucket in Bt4, Hc4 and Hb4 (on by default).
+   It does not change the matches; LzFind_SetPrefetch(False) is there to measure it. */
+
+Bool LzFind_GetPrefetch(void);
+void LzFind_SetPrefetch(Bool enable);
 void MatchFinder_ReduceOffsets(CMatchFinder *p, UInt32 subValue);
 
 UInt32 * GetMatchesSpec1(UInt32 lenLimit, UInt32 curMatch, UInt32 pos, const Byte *buffer, CLzRef *son,
     UInt32 _cyclicBufferPos, UInt32 _cyclicBufferSize, UInt32 _cutValue,
     UInt32 *distances, UInt32 maxLen);
 
+/* Match length kernels: they extend a candidate match past its first bytes.
+     LZ_FIND_MATCH_LEN_BYTES - one byte per step, the reference.
+     LZ_FIND_MATCH_LEN_WORDS - one machine word per step (x86 and x86-64).
+     LZ_FIND_MATCH_LEN_SSE2  - 16 bytes per step (x86 with SSE2, all x86-64).
+     LZ_FIND_MATCH_LEN_AVX2  - 32 bytes per step (x86-64 with AVX2).
+   All kernels give the same match lengths, so the match lists and the encoded data do not change.
+   LzFind_GetDefaultMatchLenKernel checks the CPU (CPUID) and returns the fastest available kernel.
+   LzFind_SetMatchLenKernel selects the kernel of all match finders; a kernel that is not available
+   falls back to the best available one. It must not be called while a match finder runs. */
+
+#define LZ_FIND_MATCH_LEN_BYTES 0
+#define LZ_FIND_MATCH_LEN_WORDS 1
+#define LZ_FIND_MATCH_LEN_SSE2 2
+#define LZ_FIND_MATCH_LEN_AVX2 3
+
+unsigned LzFind_GetDefaultMatchLenKernel(void);
+unsigned LzFind_GetMatchLenKernel(void);
+void LzFind_SetMatchLenKernel(unsigned kernel);
+
 /*
 Conditions:
   Mf_GetNumAvailableBytes_Func must be called before each Mf_GetMatchLen_Func.
@@ -10,12 +10,95 @@ void MtSync_Construct(CMtSync *p)
   p->wasCreated = False;
   p->csWasInitialized = False;
   p->csWasEntered = False;
+  p->threadPool = NULL;
+  p->loopThread = NULL;
   Thread_Construct(&p->thread);
   Event_Construct(&p->canStart);
   Event_Construct(&p->wasStarted);
   Event_Construct(&p->wasStopped);
   Semaphore_Construct(&p->freeSemaphore);
   Semaphore_Construct(&p->filledSemaphore);
+  Event_Construct(&p->filledEvent);
+  Event_Construct(&p->freeEvent);
+  #ifdef DISABLE_TRACE
+  p->lockFree = True;
+  #else
+  p->lockFree = False;
+  #endif
+}
+
+#define MtSync_ThreadWasCreated(p) (Thread_WasCreated(&(p)->thread) || (p)->loopThread != NULL)
+
+/* Waits until *counter differs from value. The waiter publishes its parked flag
+   before it checks the counter again and the other side advances the counter
+   before it reads the flag, so a wakeup can't be lost between the two. */
+
+static void MtSync_WaitCounter(volatile UInt32 *counter, UInt32 value, volatile UInt32 *parked, CAutoResetEvent *event)
+{
+  unsigned i;
+  for (i = 0; i < kMtRingSpinCount; i++)
+  {
+    if (Atomic_Load32(counter) != value)
+      return;
+    Thread_SpinPause();
+  }
+  Atomic_Store32(parked, 1);
+  while (Atomic_Load32(counter) == value)
+    Event_Wait(event);
+  Atomic_Store32(parked, 0);
+}
+
+static void MtSync_AdvanceCounter(volatile UInt32 *counter, volatile UInt32 *parked, CAutoResetEvent *event)
+{
+  Atomic_Store32(counter, *counter + 1);
+  if (Atomic_Load32(parked) != 0)
+    Event_Set(event);
+}
+
+/* producer side */
+
+static void MtSync_WaitFree(CMtSync *p)
+{
+  if (!p->lockFree)
+  {
+    Semaphore_Wait(&p->freeSemaphore);
+    return;
+  }
+  MtSync_WaitCounter(&p->numFreed, p->numReserved - p->numBlocks, &p->producerParked, &p->freeEvent);
+  p->numReserved++;
+}
+
+static void MtSync_ReleaseFilled(CMtSync *p)
+{
+  if (!p->lockFree)
+  {
+    Semaphore_Release1(&p->filledSemaphore);
+    return;
+  }
+  MtSync_AdvanceCounter(&p->numFilled, &p->consumerParked, &p->filledEvent);
+}
+
+/* consumer side */
+
+static void MtSync_WaitFilled(CMtSync *p)
+{
+  if (!p->lockFree)
+  {
+    Semaphore_Wait(&p->filledSemaphore);
+    return;
+  }
+  MtSync_WaitCounter(&p->numFilled, p->numAcquired, &p->consumerParked, &p->filledEvent);
+  p->numAcquired++;
+}
+
+static void MtSync_ReleaseFree(CMtSync *p)
+{
+  if (!p->lockFree)
+  {
+    Semaphore_Release1(&p->freeSemaphore);
+    return;
+  }
+  MtSync_AdvanceCounter(&p->numFreed, &p->producerParked, &p->freeEvent);
 }
 
 void MtSync_GetNextBlock(CMtSync *p)
@@ -30,6 +113,9 @@ void MtSync_GetNextBlock(CMtSync *p)
     TraceObjectSync("MtSync_GetNextBlock:start", p);
     LeaveGlobalLock();
     p->exit = False;
+    /* the producer is waiting for canStart, so the ring can be rewound */
+    p->numReserved = p->numFilled = 0;
+    p->numAcquired = p->numFreed = 0;
     Event_Reset(&p->wasStarted);
     Event_Reset(&p->wasStopped);
 
@@ -41,9 +127,9 @@ void MtSync_GetNextBlock(CMtSync *p)
     CriticalSection_Leave(&p->cs);
     p->csWasEntered = False;
     p->numProcessedBlocks++;
-    Semaphore_Release1(&p->freeSemaphore);
+    MtSync_ReleaseFree(p);
   }
-  Semaphore_Wait(&p->filledSemaphore);
+  MtSync_WaitFilled(p);
   CriticalSection_Enter(&p->cs);
   p->csWasEntered = True;
 }
@@ -53,11 +139,11 @@ void MtSync_GetNextBlock(CMtSync *p)
 void MtSync_StopWriting(CMtSync *p)
 {
   UInt32 myNumBlocks = p->numProcessedBlocks;
-  if (!Thread_WasCreated(&p->thread) || p->needStart)
+  if (!MtSync_ThreadWasCreated(p) || p->needStart)
     return;
   EnterGlobalLock();
   TraceObjectSync("MtSync_StopWriting:stop", p);
-  p->stopWriting = True;
+  Atomic_Store32(&p->stopWriting, True);
   TraceObjectSync("MtSync_StopWriting:stop", p);
   LeaveGlobalLock();
   if (p->csWasEntered)
@@ -65,28 +151,37 @@ void MtSync_StopWriting(CMtSync *p)
     CriticalSection_Leave(&p->cs);
     p->csWasEntered = False;
   }
-  Semaphore_Release1(&p->freeSemaphore);
+  MtSync_ReleaseFree(p);
  
   Event_Wait(&p->wasStopped);
 
   while (myNumBlocks++ != p->numProcessedBlocks)
   {
-    Semaphore_Wait(&p->filledSemaphore);
-    Semaphore_Release1(&p->freeSemaphore);
+    MtSync_WaitFilled(p);
+    MtSync_ReleaseFree(p);
   }
   p->needStart = True;
 }
 
 void MtSync_Destruct(CMtSync *p)
 {
-  if (Thread_WasCreated(&p->thread))
+  if (MtSync_ThreadWasCreated(p))
   {
     MtSync_StopWriting(p);
     p->exit = True;
     if (p->needStart)
       Event_Set(&p->canStart);
-    Thread_Wait(&p->thread);
-    Thread_Close(&p->thread);
+    if (p->loopThread)
+    {
+      LoopThread_WaitSubThread(p->loopThread);
+      ThreadPool_Release(p->threadPool, p->loopThread);
+      p->loopThread = NULL;
+    }
+    else
+    {
+      Thread_Wait(&p->thread);
+      Thread_Close(&p->thread);
+    }
   }
   if (p->csWasInitialized)
   {
@@ -99,6 +194,10 @@ void MtSync_Destruct(CMtSync *p)
   Event_Close(&p->wasStopped);
   Semaphore_Close(&p->freeSemaphore);
   Semaphore_Close(&p->filledSemaphore);
+  if (Event_IsCreated(&p->filledEvent))
+    Event_Close(&p->filledEvent);
+  if (Event_IsCreated(&p->freeEvent))
+    Event_Close(&p->freeEvent);
 
   if(p->wasCreated)
     TraceObjectDelete("MtSync_Destruct", p);
@@ -121,12 +220,39 @@ static SRes MtSync_Create2(CMtSync *p, unsigned (MY_STD_CALL *startAddress)(void
   RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&p->wasStarted));
   RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&p->wasStopped));
   
-  RINOK_THREAD(Semaphore_Create(&p->freeSemaphore, numBlocks, numBlocks));
-  RINOK_THREAD(Semaphore_Create(&p->filledSemaphore, 0, numBlocks));
+  p->numBlocks = numBlocks;
+  if (p->lockFree)
+  {
+    RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&p->filledEvent));
+    RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&p->freeEvent));
+  }
+  else
+  {
+    RINOK_THREAD(Semaphore_Create(&p->freeSemaphore, numBlocks, numBlocks));
+    RINOK_THREAD(Semaphore_Create(&p->filledSemaphore, 0, numBlocks));
+  }
 
   p->needStart = True;
   
-  RINOK_THREAD(Thread_Create(&p->thread, startAddress, obj));
+  if (p->threadPool)
+  {
+    CLoopThread *lt = ThreadPool_Acquire(p->threadPool);
+    if (lt == NULL)
+      return SZ_ERROR_THREAD;
+    lt->func = startAddress;
+    lt->param = obj;
+    LoopThread_InheritAffinity(lt);
+    if (LoopThread_StartSubThread(lt) != 0)
+    {
+      ThreadPool_Release(p->threadPool, lt);
+      return SZ_ERROR_THREAD;
+    }
+    p->loopThread = lt;
+  }
+  else
+  {
+    RINOK_THREAD(Thread_Create(&p->thread, startAddress, obj));
+  }
   p->wasCreated = True;
   return SZ_OK;
 }
@@ -157,6 +283,138 @@ DEF_GetHeads(4,  (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8) ^ (crc[p[3]] << 5)) & h
 DEF_GetHeads(4b, (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8) ^ ((UInt32)p[3] << 16)) & hashMask)
 /* DEF_GetHeads(5,  (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8) ^ (crc[p[3]] << 5) ^ (crc[p[4]] << 3)) & hashMask) */
 
+#define DEF_GetHashValues2(name, v, action) \
+static void GetHashValues ## name(const Byte *p, UInt32 *values, UInt32 numValues, \
+UInt32 hashMask, const UInt32 *crc) \
+{ action; for (; numValues != 0; numValues--) { *values++ = (v); p++; } }
+
+#define DEF_GetHashValues(name, v) DEF_GetHashValues2(name, v, ;)
+
+DEF_GetHashValues2(2,  (p[0] | ((UInt32)p[1] << 8)), hashMask = hashMask; crc = crc; )
+DEF_GetHashValues(3,  (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8)) & hashMask)
+DEF_GetHashValues(4,  (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8) ^ (crc[p[3]] << 5)) & hashMask)
+DEF_GetHashValues(4b, (crc[p[0]] ^ p[1] ^ ((UInt32)p[2] << 8) ^ ((UInt32)p[3] << 16)) & hashMask)
+
+/* first step of a block: hashes the positions of slice (part) and sorts their indexes by owner;
+   the list of owner (o) is hashOrder[starts[o] .. starts[o + 1]) */
+static void MatchFinderMt_HashSlice(CMatchFinderMt *mt, UInt32 part)
+{
+  UInt32 numThreads = mt->numHashThreads;
+  UInt32 begin = mt->hashJobNum * part / numThreads;
+  UInt32 end = mt->hashJobNum * (part + 1) / numThreads;
+  UInt32 *starts = mt->hashStarts[part];
+  UInt32 next[kMtMaxHashThreads];
+  const UInt32 *values = mt->hashValues;
+  UInt32 i, o, shift = mt->hashJobShift;
+  CMatchFinder *mf = mt->MatchFinder;
+
+  mt->GetHashValuesFunc(mt->hashJobBuffer + begin, mt->hashValues + begin, end - begin, mf->hashMask, mf->crc);
+  for (o = 0; o < numThreads; o++)
+    next[o] = 0;
+  for (i = begin; i < end; i++)
+    next[values[i] >> shift]++;
+  for (o = 0, i = begin; o < numThreads; o++)
+  {
+    UInt32 num = next[o];
+    starts[o] = next[o] = i;
+    i += num;
+  }
+  starts[numThreads] = end;
+  for (i = begin; i < end; i++)
+    mt->hashOrder[next[values[i] >> shift]++] = i;
+}
+
+/* second step: updates the hash entries of range (part), slice after slice, so every entry
+   sees its positions in order; the head of each position replaces its index in hashOrder */
+static void MatchFinderMt_HashRange(CMatchFinderMt *mt, UInt32 part)
+{
+  CMatchFinder *mf = mt->MatchFinder;
+  UInt32 *hash = mf->hash + mf->fixedHashSize;
+  const UInt32 *values = mt->hashValues;
+  UInt32 *order = mt->hashOrder;
+  UInt32 pos = mt->hashJobPos;
+  UInt32 s;
+  for (s = 0; s < mt->numHashThreads; s++)
+  {
+    UInt32 k = mt->hashStarts[s][part];
+    UInt32 lim = mt->hashStarts[s][part + 1];
+    for (; k < lim; k++)
+    {
+      UInt32 cur = pos + order[k];
+      UInt32 *entry = hash + values[order[k]];
+      order[k] = cur - *entry;
+      *entry = cur;
+    }
+  }
+}
+
+static void HashWorkerFunc(CMtHashWorker *w)
+{
+  CMatchFinderMt *mt = w->mt;
+  UInt32 numJobs = 0;
+  for (;;)
+  {
+    MtSync_WaitCounter(&w->numJobs, numJobs, &w->workerParked, &w->canStart);
+    numJobs++;
+    if (w->exit)
+      return;
+    /* the hash thread alternates the two steps, with a join after each */
+    if (numJobs & 1)
+      MatchFinderMt_HashSlice(mt, w->part);
+    else
+      MatchFinderMt_HashRange(mt, w->part);
+    MtSync_AdvanceCounter(&w->numDone, &w->ownerParked, &mt->hashDoneEvent);
+  }
+}
+
+static void MatchFinderMt_RunHashStep(CMatchFinderMt *mt, void (*step)(CMatchFinderMt *mt, UInt32 part))
+{
+  UInt32 i, numThreads = mt->numHashThreads;
+  for (i = 1; i < numThreads; i++)
+  {
+    CMtHashWorker *w = &mt->hashWorkers[i];
+    MtSync_AdvanceCounter(&w->numJobs, &w->workerParked, &w->canStart);
+  }
+  step(mt, 0);
+  for (i = 1; i < numThreads; i++)
+  {
+    CMtHashWorker *w = &mt->hashWorkers[i];
+    MtSync_WaitCounter(&w->numDone, w->numJobs - 1, &w->ownerParked, &mt->hashDoneEvent);
+  }
+}
+
+static void MatchFinderMt_GetHeads(CMatchFinderMt *mt, const Byte *buffer, UInt32 pos,
+    UInt32 *hash, UInt32 hashMask, UInt32 *heads, UInt32 numHeads, const UInt32 *crc)
+{
+  UInt32 next[kMtMaxHashThreads];
+  UInt32 i, s, numThreads = mt->numHashThreads, partShift = 0;
+  if (numThreads <= 1)
+  {
+    mt->GetHeadsFunc(buffer, pos, hash, hashMask, heads, numHeads, crc);
+    return;
+  }
+
+  /* hashMask + 1 is a power of 2: every thread owns a contiguous range of (hashMask + 1) / numThreads entries */
+  while ((hashMask >> partShift) >= numThreads)
+    partShift++;
+  mt->hashJobBuffer = buffer;
+  mt->hashJobPos = pos;
+  mt->hashJobNum = numHeads;
+  mt->hashJobShift = partShift;
+  MatchFinderMt_RunHashStep(mt, MatchFinderMt_HashSlice);
+  MatchFinderMt_RunHashStep(mt, MatchFinderMt_HashRange);
+
+  /* the heads of every slice come back from its owner lists in position order */
+  for (s = 0; s < numThreads; s++)
+  {
+    UInt32 o, end = numHeads * (s + 1) / numThreads;
+    for (o = 0; o < numThreads; o++)
+      next[o] = mt->hashStarts[s][o];
+    for (i = numHeads * s / numThreads; i < end; i++)
+      heads[i] = mt->hashOrder[next[mt->hashValues[i] >> partShift]++];
+  }
+}
+
 void HashThreadFunc(CMatchFinderMt *mt)
 {
   CMtSync *p = &mt->hashSync;
@@ -171,7 +429,7 @@ void HashThreadFunc(CMatchFinderMt *mt)
         return;
       EnterGlobalLock();
       TraceObjectSync("HashThreadFunc:stop", p);
-      if (p->stopWriting)
+      if (Atomic_Load32(&p->stopWriting))
       {
         TraceObjectSync("HashThreadFunc:stop", p);
         LeaveGlobalLock();
@@ -201,7 +459,7 @@ void HashThreadFunc(CMatchFinderMt *mt)
           continue;
         }
 
-        Semaphore_Wait(&p->freeSemaphore);
+        MtSync_WaitFree(p);
 
         MatchFinder_ReadIfRequired(mf);
         if (mf->pos > (kMtMaxValForNormalize - kMtHashBlockSize))
@@ -220,7 +478,7 @@ void HashThreadFunc(CMatchFinderMt *mt)
             num = num - mf->numHashBytes + 1;
             if (num > kMtHashBlockSize - 2)
               num = kMtHashBlockSize - 2;
-            mt->GetHeadsFunc(mf->buffer, mf->pos, mf->hash + mf->fixedHashSize, mf->hashMask, heads + 2, num, mf->crc);
+            MatchFinderMt_GetHeads(mt, mf->buffer, mf->pos, mf->hash + mf->fixedHashSize, mf->hashMask, heads + 2, num, mf->crc);
             heads[0] += num;
           }
           mf->pos += num;
@@ -228,7 +486,7 @@ void HashThreadFunc(CMatchFinderMt *mt)
         }
       }
 
-      Semaphore_Release1(&p->filledSemaphore);
+      MtSync_ReleaseFilled(p);
     }
   }
 }
@@ -437,7 +695,7 @@ void BtThreadFunc(CMatchFinderMt *mt)
         return;
       EnterGlobalLock();
       TraceObjectSync("BtThreadFunc:stop", p);
-      if (p->stopWriting)
+      if (Atomic_Load32(&p->stopWriting))
       {
         TraceObjectSync("BtThreadFunc:stop", p);
         LeaveGlobalLock();
@@ -448,9 +706,9 @@ void BtThreadFunc(CMatchFinderMt *mt)
       }
       TraceObjectSync("BtThreadFunc:stop", p);
       LeaveGlobalLock();
-      Semaphore_Wait(&p->freeSemaphore);
+      MtSync_WaitFree(p);
       BtFillBlock(mt, blockIndex++);
-      Semaphore_Release1(&p->filledSemaphore);
+      MtSync_ReleaseFilled(p);
     }
   }
 }
@@ -459,10 +717,51 @@ void MatchFinderMt_Construct(CMatchFinderMt *p)
 {
   TR("MatchFinderMt_Construct",0);
   p->hashBuf = 0;
+  p->numHashThreads = 1;
+  p->hashWorkers = 0;
+  p->hashValues = 0;
+  Event_Construct(&p->hashDoneEvent);
   MtSync_Construct(&p->hashSync);
   MtSync_Construct(&p->btSync);
 }
 
+#define HashWorker_ThreadWasCreated(w) (Thread_WasCreated(&(w)->thread) || (w)->loopThread != NULL)
+
+static void MatchFinderMt_DestructHashWorkers(CMatchFinderMt *p, ISzAlloc *alloc)
+{
+  UInt32 i;
+  if (p->hashWorkers == 0)
+    return;
+  for (i = 1; i < p->numHashThreads; i++)
+  {
+    CMtHashWorker *w = &p->hashWorkers[i];
+    if (HashWorker_ThreadWasCreated(w))
+    {
+      w->exit = True;
+      MtSync_AdvanceCounter(&w->numJobs, &w->workerParked, &w->canStart);
+      if (w->loopThread)
+      {
+        LoopThread_WaitSubThread(w->loopThread);
+        ThreadPool_Release(p->hashSync.threadPool, w->loopThread);
+        w->loopThread = NULL;
+      }
+      else
+      {
+        Thread_Wait(&w->thread);
+        Thread_Close(&w->thread);
+      }
+    }
+    if (Event_IsCreated(&w->canStart))
+      Event_Close(&w->canStart);
+  }
+  if (Event_IsCreated(&p->hashDoneEvent))
+    Event_Close(&p->hashDoneEvent);
+  alloc->Free(alloc, p->hashValues);
+  alloc->Free(alloc, p->hashWorkers);
+  p->hashWorkers = 0;
+  p->hashValues = 0;
+}
+
 void MatchFinderMt_FreeMem(CMatchFinderMt *p, ISzAlloc *alloc)
 {
   alloc->Free(alloc, p->hashBuf);
@@ -473,6 +772,7 @@ void MatchFinderMt_Destruct(CMatchFinderMt *p, ISzAlloc *alloc)
 {
   MtSync_Destruct(&p->hashSync);
   MtSync_Destruct(&p->btSync);
+  MatchFinderMt_DestructHashWorkers(p, alloc);
   MatchFinderMt_FreeMem(p, alloc);
 }
 
@@ -480,6 +780,61 @@ void MatchFinderMt_Destruct(CMatchFinderMt *p, ISzAlloc *alloc)
 #define kBtBufferSize (kMtBtBlockSize * kMtBtNumBlocks)
 
 static unsigned MY_STD_CALL HashThreadFunc2(void *p) { HashThreadFunc((CMatchFinderMt *)p);  return 0; }
+static unsigned MY_STD_CALL HashWorkerFunc2(void *p) { HashWorkerFunc((CMtHashWorker *)p);  return 0; }
+
+static SRes MatchFinderMt_CreateHashWorkers(CMatchFinderMt *p, ISzAlloc *alloc)
+{
+  UInt32 i, numThreads = p->numHashThreads;
+  if (numThreads <= 1 || p->hashWorkers != 0)
+    return SZ_OK;
+
+  p->hashWorkers = (CMtHashWorker *)alloc->Alloc(alloc, numThreads * sizeof(CMtHashWorker));
+  if (p->hashWorkers == 0)
+    return SZ_ERROR_MEM;
+  p->hashValues = (UInt32 *)alloc->Alloc(alloc, 2 * kMtHashBlockSize * sizeof(UInt32));
+  for (i = 0; i < numThreads; i++)
+  {
+    CMtHashWorker *w = &p->hashWorkers[i];
+    w->mt = p;
+    w->part = i;
+    w->exit = False;
+    w->loopThread = NULL;
+    w->numJobs = w->numDone = 0;
+    w->ownerParked = w->workerParked = 0;
+    Thread_Construct(&w->thread);
+    Event_Construct(&w->canStart);
+  }
+  if (p->hashValues == 0)
+    return SZ_ERROR_MEM;
+  p->hashOrder = p->hashValues + kMtHashBlockSize;
+
+  RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&p->hashDoneEvent));
+  for (i = 1; i < numThreads; i++)
+  {
+    CMtHashWorker *w = &p->hashWorkers[i];
+    RINOK_THREAD(AutoResetEvent_CreateNotSignaled(&w->canStart));
+    if (p->hashSync.threadPool)
+    {
+      CLoopThread *lt = ThreadPool_Acquire(p->hashSync.threadPool);
+      if (lt == NULL)
+        return SZ_ERROR_THREAD;
+      lt->func = HashWorkerFunc2;
+      lt->param = w;
+      LoopThread_InheritAffinity(lt);
+      if (LoopThread_StartSubThread(lt) != 0)
+      {
+        ThreadPool_Release(p->hashSync.threadPool, lt);
+        return SZ_ERROR_THREAD;
+      }
+      w->loopThread = lt;
+    }
+    else
+    {
+      RINOK_THREAD(Thread_Create(&w->thread, HashWorkerFunc2, w));
+    }
+  }
+  return SZ_OK;
+}
 static unsigned MY_STD_CALL BtThreadFunc2(void *p)
 {
   Byte allocaDummy[0x180];
@@ -506,12 +861,46 @@ SRes MatchFinderMt_Create(CMatchFinderMt *p, UInt32 historySize, UInt32 keepAddB
   }
   keepAddBufferBefore += (kHashBufferSize + kBtBufferSize);
   keepAddBufferAfter += kMtHashBlockSize;
+  mf->pos64 = 0; /* the hash and BT threads normalize 32-bit positions, LzmaEnc limits them to 1 GB dictionaries */
   if (!MatchFinder_Create(mf, historySize, keepAddBufferBefore, matchMaxLen, keepAddBufferAfter, alloc))
     return SZ_ERROR_MEM;
 
   RINOK(MtSync_Create(&p->hashSync, HashThreadFunc2, p, kMtHashNumBlocks));
   RINOK(MtSync_Create(&p->btSync, BtThreadFunc2, p, kMtBtNumBlocks));
-  return SZ_OK;
+  {
+    SRes res = MatchFinderMt_CreateHashWorkers(p, alloc);
+    if (res != SZ_OK)
+      MatchFinderMt_DestructHashWorkers(p, alloc);
+    return res;
+  }
+}
+
+void MatchFinderMt_SetThreadPool(CMatchFinderMt *p, CThreadPool *threadPool)
+{
+  /* a running sync object keeps the pool it leased its thread from */
+  if (!p->hashSync.wasCreated)
+    p->hashSync.threadPool = threadPool;
+  if (!p->btSync.wasCreated)
+    p->btSync.threadPool = threadPool;
+}
+
+void MatchFinderMt_SetNumHashThreads(CMatchFinderMt *p, UInt32 numHashThreads)
+{
+  if (p->hashWorkers != 0)
+    return;
+  if (numHashThreads > kMtMaxHashThreads)
+    numHashThreads = kMtMaxHashThreads;
+  while ((numHashThreads & (numHashThreads - 1)) != 0)
+    numHashThreads &= numHashThreads - 1;
+  p->numHashThreads = (numHashThreads == 0 ? 1 : numHashThreads);
+}
+
+void MatchFinderMt_SetLockFree(CMatchFinderMt *p, Bool lockFree)
+{
+  if (!p->hashSync.wasCreated)
+    p->hashSync.lockFree = lockFree;
+  if (!p->btSync.wasCreated)
+    p->btSync.lockFree = lockFree;
 }
 
 /* Call it after ReleaseStream / SetStream */
@@ -798,18 +1187,21 @@ void MatchFinderMt_CreateVTable(CMatchFinderMt *p, IMatchFinder *vTable)
   {
     case 2:
       p->GetHeadsFunc = GetHeads2;
+      p->GetHashValuesFunc = GetHashValues2;
       p->MixMatchesFunc = (Mf_Mix_Matches)0;
       vTable->Skip = (Mf_Skip_Func)MatchFinderMt0_Skip;
       vTable->GetMatches = (Mf_GetMatches_Func)MatchFinderMt2_GetMatches;
       break;
     case 3:
       p->GetHeadsFunc = GetHeads3;
+      p->GetHashValuesFunc = GetHashValues3;
       p->MixMatchesFunc = (Mf_Mix_Matches)MixMatches2;
       vTable->Skip = (Mf_Skip_Func)MatchFinderMt2_Skip;
       break;
     default:
     /* case 4: */
       p->GetHeadsFunc = p->MatchFinder->bigHash ? GetHeads4b : GetHeads4;
+      p->GetHashValuesFunc = p->MatchFinder->bigHash ? GetHashValues4b : GetHashValues4;
       /* p->GetHeadsFunc = GetHeads4; */
       p->MixMatchesFunc = (Mf_Mix_Matches)MixMatches3;
       vTable->Skip = (Mf_Skip_Func)MatchFinderMt3_Skip;
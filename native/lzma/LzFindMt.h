@@ -5,6 +5,7 @@
 #define __LZ_FIND_MT_H
 
 #include "LzFind.h"
+#include "MtCoder.h"
 #include "Threads.h"
 
 #ifdef __cplusplus
@@ -19,6 +20,12 @@ extern "C" {
 #define kMtBtNumBlocks (1 << 6)
 #define kMtBtNumBlocksMask (kMtBtNumBlocks - 1)
 
+/* kMtCacheLineDummy must be >= size_of_CPU_cache_line */
+#define kMtCacheLineDummy 128
+
+/* number of polls before a waiting ring side parks on its event */
+#define kMtRingSpinCount (1 << 10)
+
 typedef struct _CMtSync
 {
   Bool wasCreated;
@@ -36,16 +43,63 @@ typedef struct _CMtSync
   Bool csWasEntered;
   CCriticalSection cs;
   UInt32 numProcessedBlocks;
+
+  CThreadPool *threadPool; /* optional, NULL - the sync object creates its own thread */
+  CLoopThread *loopThread; /* worker leased from threadPool while the sync object exists */
+
+  /* Lock-free mode replaces the two semaphores with a single-producer/single-consumer
+     ring of block counters. Each side writes only the counters on its own cache line
+     and parks on its event after kMtRingSpinCount polls without progress. */
+  Bool lockFree;
+  UInt32 numBlocks;
+  CAutoResetEvent filledEvent;
+  CAutoResetEvent freeEvent;
+
+  Byte producerDummy[kMtCacheLineDummy];
+  volatile UInt32 numReserved;  /* blocks the producer has started to fill */
+  volatile UInt32 numFilled;    /* blocks the producer has published */
+  volatile UInt32 producerParked;
+
+  Byte consumerDummy[kMtCacheLineDummy];
+  volatile UInt32 numAcquired;  /* blocks the consumer has taken */
+  volatile UInt32 numFreed;     /* blocks the consumer has handed back */
+  volatile UInt32 consumerParked;
+  Byte ringDummy[kMtCacheLineDummy];
 } CMtSync;
 
 typedef UInt32 * (*Mf_Mix_Matches)(void *p, UInt32 matchMinPos, UInt32 *distances);
 
-/* kMtCacheLineDummy must be >= size_of_CPU_cache_line */
-#define kMtCacheLineDummy 128
-
 typedef void (*Mf_GetHeads)(const Byte *buffer, UInt32 pos,
   UInt32 *hash, UInt32 hashMask, UInt32 *heads, UInt32 numHeads, const UInt32 *crc);
 
+typedef void (*Mf_GetHashValues)(const Byte *buffer, UInt32 *values, UInt32 numValues,
+  UInt32 hashMask, const UInt32 *crc);
+
+#define kMtMaxHashThreads 16
+
+/* One thread of the hash stage. Entry 0 is the hash thread itself, the others
+   run HashWorkerFunc. Every block is done in two steps: each thread hashes one slice
+   of the positions, then each thread updates one contiguous range of the hash table
+   (the high bits of the hash value), so they never write the same cache lines; the
+   hash thread puts the heads back in position order. */
+typedef struct _CMtHashWorker
+{
+  struct _CMatchFinderMt *mt;
+  UInt32 part;
+  Bool exit;
+  CThread thread;
+  CLoopThread *loopThread;
+  CAutoResetEvent canStart;
+
+  Byte ownerDummy[kMtCacheLineDummy];
+  volatile UInt32 numJobs;   /* written by the hash thread */
+  volatile UInt32 ownerParked;
+
+  Byte workerDummy[kMtCacheLineDummy];
+  volatile UInt32 numDone;   /* written by the worker */
+  volatile UInt32 workerParked;
+} CMtHashWorker;
+
 typedef struct _CMatchFinderMt
 {
   /* LZ */
@@ -89,6 +143,19 @@ typedef struct _CMatchFinderMt
   /* Hash */
   Mf_GetHeads GetHeadsFunc;
   CMatchFinder *MatchFinder;
+
+  /* Hash + hash workers */
+  UInt32 numHashThreads; /* power of 2, 1 - the hash thread works alone */
+  CMtHashWorker *hashWorkers;
+  UInt32 *hashValues;  /* kMtHashBlockSize hash values of the block */
+  UInt32 *hashOrder;   /* kMtHashBlockSize position indexes sorted by owner, then their heads */
+  UInt32 hashStarts[kMtMaxHashThreads][kMtMaxHashThreads + 1];
+  CAutoResetEvent hashDoneEvent;
+  Mf_GetHashValues GetHashValuesFunc;
+  const Byte *hashJobBuffer;
+  UInt32 hashJobPos;
+  UInt32 hashJobNum;
+  UInt32 hashJobShift;
 } CMatchFinderMt;
 
 void MatchFinderMt_Construct(CMatchFinderMt *p);
@@ -98,6 +165,18 @@ SRes MatchFinderMt_Create(CMatchFinderMt *p, UInt32 historySize, UInt32 keepAddB
 void MatchFinderMt_CreateVTable(CMatchFinderMt *p, IMatchFinder *vTable);
 void MatchFinderMt_ReleaseStream(CMatchFinderMt *p);
 
+/* call it before MatchFinderMt_Create; the pool must outlive the match finder */
+void MatchFinderMt_SetThreadPool(CMatchFinderMt *p, CThreadPool *threadPool);
+
+/* call it before MatchFinderMt_Create; lock-free block handoff is the default
+   when tracing is disabled, traced builds keep the semaphores of the managed port */
+void MatchFinderMt_SetLockFree(CMatchFinderMt *p, Bool lockFree);
+
+/* call it before MatchFinderMt_Create; the count is rounded down to a power of 2
+   and limited to kMtMaxHashThreads, every thread above one runs in addition to
+   the hash and BT threads */
+void MatchFinderMt_SetNumHashThreads(CMatchFinderMt *p, UInt32 numHashThreads);
+
 #ifdef __cplusplus
 }
 #endif
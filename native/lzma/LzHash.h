@@ -19,11 +19,15 @@
   hash2Value = temp & (kHash2Size - 1); \
   hashValue = (temp ^ ((UInt32)cur[2] << 8)) & p->hashMask; }
 
+/* the main hash of HASH4_CALC for the 4 bytes at c, also used to prefetch the bucket of the next position */
+#define HASH4_VALUE(c) \
+  ((p->crc[(c)[0]] ^ (c)[1] ^ ((UInt32)(c)[2] << 8) ^ (p->crc[(c)[3]] << 5)) & p->hashMask)
+
 #define HASH4_CALC { \
   UInt32 temp = p->crc[cur[0]] ^ cur[1]; \
   hash2Value = temp & (kHash2Size - 1); \
   hash3Value = (temp ^ ((UInt32)cur[2] << 8)) & (kHash3Size - 1); \
-  hashValue = (temp ^ ((UInt32)cur[2] << 8) ^ (p->crc[cur[3]] << 5)) & p->hashMask; }
+  hashValue = HASH4_VALUE(cur); }
 
 #define HASH5_CALC { \
   UInt32 temp = p->crc[cur[0]] ^ cur[1]; \
@@ -33,6 +37,20 @@
   hashValue = (hash4Value ^ (p->crc[cur[4]] << 3)) & p->hashMask; \
   hash4Value &= (kHash4Size - 1); }
 
+/* HB4 (btMode 2): the hash2 and hash3 values of HASH4_CALC, and a multiplicative hash of the first
+   4 bytes that takes the high bits of the product to select one of (hashMask + 1) buckets */
+#define kHbBucketSize 8 /* heads of a bucket, 32 bytes */
+#define kHbHashMul 0x9E3779B1 /* 2^32 / golden ratio */
+
+#define HB4_CALC { \
+  UInt32 temp = p->crc[cur[0]] ^ cur[1]; \
+  hash2Value = temp & (kHash2Size - 1); \
+  hash3Value = (temp ^ ((UInt32)cur[2] << 8)) & (kHash3Size - 1); \
+  hashValue = HB4_BUCKET(cur); }
+
+#define HB4_BUCKET(cur) ((UInt32)(((UInt64)(UInt32)(((cur)[0] | ((UInt32)(cur)[1] << 8) | \
+  ((UInt32)(cur)[2] << 16) | ((UInt32)(cur)[3] << 24)) * kHbHashMul) * (p->hashMask + 1)) >> 32))
+
 /* #define HASH_ZIP_CALC hashValue = ((cur[0] | ((UInt32)cur[1] << 8)) ^ p->crc[cur[2]]) & 0xFFFF; */
 #define HASH_ZIP_CALC hashValue = ((cur[2] | ((UInt32)cur[0] << 8)) ^ p->crc[cur[1]]) & 0xFFFF;
 
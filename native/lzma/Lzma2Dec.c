@@ -331,6 +331,20 @@ SRes Lzma2Dec_DecodeToBuf(CLzma2Dec *p, Byte *dest, SizeT *destLen, const Byte *
   }
 }
 
+SRes Lzma2Dec_DecodeToDest(CLzma2Dec *p, Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status)
+{
+  CLzmaDec *dec = &p->decoder;
+  SizeT histSize = (dec->checkDicSize != 0) ? dec->checkDicSize : dec->processedPos;
+  SRes res;
+  dec->dic = dest - histSize;
+  dec->dicPos = histSize;
+  dec->dicBufSize = histSize + *destLen;
+  res = Lzma2Dec_DecodeToDic(p, dec->dicBufSize, src, srcLen, finishMode, status);
+  *destLen = dec->dicPos - histSize;
+  dec->dic = 0;
+  return res;
+}
+
 SRes Lzma2Decode(Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen,
     Byte prop, ELzmaFinishMode finishMode, ELzmaStatus *status, ISzAlloc *alloc)
 {
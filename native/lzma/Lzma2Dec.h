@@ -54,6 +54,13 @@ SRes Lzma2Dec_DecodeToDic(CLzma2Dec *p, SizeT dicLimit,
 SRes Lzma2Dec_DecodeToBuf(CLzma2Dec *p, Byte *dest, SizeT *destLen,
     const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status);
 
+/* Lzma2Dec_DecodeToDest uses the caller's buffer as the dictionary, like LzmaDec_DecodeToDest:
+   allocate the state with Lzma2Dec_AllocateProbs and let the output of every call directly
+   follow the output of the previous calls (at least the last dictionary size bytes of it). */
+
+SRes Lzma2Dec_DecodeToDest(CLzma2Dec *p, Byte *dest, SizeT *destLen,
+    const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status);
+
 
 /* ---------- One Call Interface ---------- */
 
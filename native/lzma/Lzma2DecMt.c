@@ -0,0 +1,297 @@
+/* Lzma2DecMt.c -- Multi-thread LZMA2 Decoder
+2026-10-17 : Public domain */
+
+#include "Lzma2DecMt.h"
+
+#ifndef _7ZIP_ST
+#include "MtCoder.h"
+#endif
+
+/* see the chunk format in Lzma2Dec.c */
+
+#define LZMA2_CONTROL_LZMA (1 << 7)
+#define LZMA2_CONTROL_COPY_RESET_DIC 1
+#define LZMA2_CONTROL_EOF 0
+
+#define LZMA2_GET_LZMA_MODE(control) (((control) >> 5) & 3)
+#define LZMA2_IS_THERE_PROP(mode) ((mode) >= 2)
+
+#ifndef _7ZIP_ST
+
+typedef struct
+{
+  SizeT srcPos;
+  SizeT destPos;
+  SizeT srcLen;  /* size of the segment, after decoding the processed size */
+  SizeT destLen;
+  SRes res;
+  ELzmaStatus status;
+  Bool decoded;
+} CLzma2DecMtSegment;
+
+/* Lzma2DecMt_Scan follows the chunk headers like Lzma2Dec_UpdateState and stores the start
+   of every chunk after the first one that resets the dictionary (up to maxSegments).
+   It stops at the end marker and at the first chunk that is malformed, truncated or does
+   not fit into destLen; that chunk and the rest of the input stay in the last segment.
+   Returns the number of segments. */
+
+static SizeT Lzma2DecMt_Scan(const Byte *src, SizeT srcLen, SizeT destLen,
+    CLzma2DecMtSegment *segments, SizeT maxSegments)
+{
+  SizeT srcPos = 0, destPos = 0, numSegments = 1;
+  if (maxSegments != 0)
+  {
+    segments[0].srcPos = 0;
+    segments[0].destPos = 0;
+  }
+  while (srcPos < srcLen)
+  {
+    unsigned control = src[srcPos];
+    SizeT headerSize, packSize, unpackSize;
+    Bool resetDic;
+    if (control == LZMA2_CONTROL_EOF)
+      break;
+    if ((control & LZMA2_CONTROL_LZMA) == 0)
+    {
+      if (control > 2)
+        break;
+      headerSize = 3;
+      resetDic = (control == LZMA2_CONTROL_COPY_RESET_DIC);
+    }
+    else
+    {
+      unsigned mode = LZMA2_GET_LZMA_MODE(control);
+      headerSize = LZMA2_IS_THERE_PROP(mode) ? 6 : 5;
+      resetDic = (mode == 3);
+    }
+    if (srcLen - srcPos < headerSize)
+      break;
+    unpackSize = ((SizeT)src[srcPos + 1] << 8) + src[srcPos + 2] + 1;
+    if ((control & LZMA2_CONTROL_LZMA) != 0)
+    {
+      unpackSize += (SizeT)(control & 0x1F) << 16;
+      packSize = ((SizeT)src[srcPos + 3] << 8) + src[srcPos + 4] + 1;
+    }
+    else
+      packSize = unpackSize;
+    if (srcLen - srcPos - headerSize < packSize || destLen - destPos < unpackSize)
+      break;
+    if (resetDic && srcPos != 0)
+    {
+      if (numSegments < maxSegments)
+      {
+        segments[numSegments].srcPos = srcPos;
+        segments[numSegments].destPos = destPos;
+      }
+      numSegments++;
+    }
+    srcPos += headerSize + packSize;
+    destPos += unpackSize;
+  }
+  return numSegments;
+}
+
+typedef struct
+{
+  Byte *dest;
+  const Byte *src;
+  Byte prop;
+  ELzmaFinishMode finishMode;
+  ISzAlloc *alloc;
+  CLzma2DecMtSegment *segments;
+  SizeT numSegments;
+  CCriticalSection cs;
+  SizeT nextSegment;
+  SizeT failedSegment; /* numSegments - no segment has failed */
+} CLzma2DecMt;
+
+/* A segment starts with a dictionary reset, so a fresh decoder is in the same state as the
+   sequential one at that point. Every segment but the last must end exactly at the control
+   byte of the next segment, which the decoder reports as LZMA_STATUS_NEEDS_MORE_INPUT. */
+
+static Bool Lzma2DecMt_DecodeSegment(CLzma2DecMt *p, CLzma2Dec *dec, CLzma2DecMtSegment *s, Bool last)
+{
+  SizeT srcLen = s->srcLen;
+  Lzma2Dec_Init(dec);
+  dec->decoder.dic = p->dest + s->destPos;
+  dec->decoder.dicBufSize = s->destLen;
+  s->res = Lzma2Dec_DecodeToDic(dec, s->destLen, p->src + s->srcPos, &srcLen,
+      last ? p->finishMode : LZMA_FINISH_END, &s->status);
+  s->decoded = True;
+  if (!last && (s->res != SZ_OK || s->status != LZMA_STATUS_NEEDS_MORE_INPUT ||
+      srcLen != s->srcLen || dec->decoder.dicPos != s->destLen))
+    return False;
+  s->srcLen = srcLen;
+  s->destLen = dec->decoder.dicPos;
+  return True;
+}
+
+static void Lzma2DecMt_Work(CLzma2DecMt *p)
+{
+  CLzma2Dec dec;
+  Lzma2Dec_Construct(&dec);
+  if (Lzma2Dec_AllocateProbs(&dec, p->prop, p->alloc) != SZ_OK)
+    return;
+  for (;;)
+  {
+    SizeT i;
+    Bool stop;
+    CriticalSection_Enter(&p->cs);
+    i = p->nextSegment;
+    stop = (i >= p->failedSegment);
+    if (!stop)
+      p->nextSegment++;
+    CriticalSection_Leave(&p->cs);
+    if (stop)
+      break;
+    if (!Lzma2DecMt_DecodeSegment(p, &dec, &p->segments[i], i + 1 == p->numSegments))
+    {
+      CriticalSection_Enter(&p->cs);
+      if (i < p->failedSegment)
+        p->failedSegment = i;
+      CriticalSection_Leave(&p->cs);
+    }
+  }
+  Lzma2Dec_FreeProbs(&dec, p->alloc);
+}
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE Lzma2DecMt_ThreadFunc(void *pp)
+{
+  Lzma2DecMt_Work((CLzma2DecMt *)pp);
+  return 0;
+}
+
+typedef struct
+{
+  CThread thread;
+  CLoopThread *loopThread;
+} CLzma2DecMtThread;
+
+/* Returns False if the segments could not all be decoded (no memory or a failed segment). */
+
+static Bool Lzma2DecMt_Run(CLzma2DecMt *p, unsigned numThreads, CThreadPool *threadPool)
+{
+  CLzma2DecMtThread *threads;
+  unsigned numHelpers = numThreads - 1, i;
+  SizeT k;
+  threads = (CLzma2DecMtThread *)IAlloc_Alloc(p->alloc, numHelpers * sizeof(CLzma2DecMtThread));
+  if (threads == 0)
+    return False;
+  if (CriticalSection_Init(&p->cs) != 0)
+  {
+    IAlloc_Free(p->alloc, threads);
+    return False;
+  }
+
+  /* a helper that cannot be started just leaves its segments to the others */
+  for (i = 0; i < numHelpers; i++)
+  {
+    CLzma2DecMtThread *t = &threads[i];
+    Thread_Construct(&t->thread);
+    t->loopThread = NULL;
+    if (threadPool)
+    {
+      CLoopThread *lt = ThreadPool_Acquire(threadPool);
+      if (lt == NULL)
+        continue;
+      lt->func = Lzma2DecMt_ThreadFunc;
+      lt->param = p;
+      if (LoopThread_StartSubThread(lt) != 0)
+        ThreadPool_Release(threadPool, lt);
+      else
+        t->loopThread = lt;
+    }
+    else if (Thread_Create(&t->thread, Lzma2DecMt_ThreadFunc, p) != 0)
+      Thread_Construct(&t->thread);
+  }
+
+  Lzma2DecMt_Work(p);
+
+  for (i = 0; i < numHelpers; i++)
+  {
+    CLzma2DecMtThread *t = &threads[i];
+    if (t->loopThread)
+    {
+      LoopThread_WaitSubThread(t->loopThread);
+      ThreadPool_Release(threadPool, t->loopThread);
+    }
+    else if (Thread_WasCreated(&t->thread))
+    {
+      Thread_Wait(&t->thread);
+      Thread_Close(&t->thread);
+    }
+  }
+  CriticalSection_Delete(&p->cs);
+  IAlloc_Free(p->alloc, threads);
+
+  if (p->failedSegment != p->numSegments)
+    return False;
+  for (k = 0; k < p->numSegments; k++)
+    if (!p->segments[k].decoded)
+      return False;
+  return True;
+}
+
+#endif
+
+SRes Lzma2DecMt_Decode(Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen,
+    Byte prop, ELzmaFinishMode finishMode, ELzmaStatus *status,
+    unsigned numThreads, struct _CThreadPool *threadPool, ISzAlloc *alloc)
+{
+  #ifndef _7ZIP_ST
+  SizeT numSegments;
+  CLzma2DecMt p;
+  #ifndef DISABLE_TRACE
+  /* traced builds decode sequentially, so that the trace stays in lockstep with the managed port */
+  numThreads = 1;
+  #endif
+  numSegments = (numThreads > 1) ? Lzma2DecMt_Scan(src, *srcLen, *destLen, NULL, 0) : 1;
+  p.segments = NULL;
+  if (numSegments > 1)
+    p.segments = (CLzma2DecMtSegment *)IAlloc_Alloc(alloc, numSegments * sizeof(CLzma2DecMtSegment));
+  if (p.segments != 0)
+  {
+    SizeT i;
+    Bool decoded;
+    Lzma2DecMt_Scan(src, *srcLen, *destLen, p.segments, numSegments);
+    for (i = 0; i < numSegments; i++)
+    {
+      CLzma2DecMtSegment *s = &p.segments[i];
+      s->srcLen = (i + 1 < numSegments ? s[1].srcPos : *srcLen) - s->srcPos;
+      s->destLen = (i + 1 < numSegments ? s[1].destPos : *destLen) - s->destPos;
+      s->decoded = False;
+    }
+    p.dest = dest;
+    p.src = src;
+    p.prop = prop;
+    p.finishMode = finishMode;
+    p.alloc = alloc;
+    p.numSegments = numSegments;
+    p.nextSegment = 0;
+    p.failedSegment = numSegments;
+    if (numThreads > numSegments)
+      numThreads = (unsigned)numSegments;
+    if (numThreads > NUM_MT_CODER_THREADS_MAX)
+      numThreads = NUM_MT_CODER_THREADS_MAX;
+
+    decoded = Lzma2DecMt_Run(&p, numThreads, threadPool);
+    if (decoded)
+    {
+      const CLzma2DecMtSegment *last = &p.segments[numSegments - 1];
+      SRes res = last->res;
+      *destLen = last->destPos + last->destLen;
+      *srcLen = last->srcPos + last->srcLen;
+      *status = last->status;
+      if (res == SZ_OK && *status == LZMA_STATUS_NEEDS_MORE_INPUT)
+        res = SZ_ERROR_INPUT_EOF;
+      IAlloc_Free(alloc, p.segments);
+      return res;
+    }
+    IAlloc_Free(alloc, p.segments);
+  }
+  #else
+  numThreads = numThreads;
+  threadPool = threadPool;
+  #endif
+  return Lzma2Decode(dest, destLen, src, srcLen, prop, finishMode, status, alloc);
+}
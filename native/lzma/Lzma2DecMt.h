@@ -0,0 +1,40 @@
+/* Lzma2DecMt.h -- Multi-thread LZMA2 Decoder
+2026-10-17 : Public domain */
+
+#ifndef __LZMA2_DEC_MT_H
+#define __LZMA2_DEC_MT_H
+
+#include "Lzma2Dec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _CThreadPool;
+
+/* ---------- One Call Interface ---------- */
+
+/* Lzma2DecMt_Decode is Lzma2Decode on up to numThreads threads.
+
+   An LZMA2 chunk that resets the dictionary (control 1 or 111uuuuu) does not depend on
+   anything before it. Lzma2DecMt_Decode scans the chunk headers, splits the stream at these
+   chunks and decodes the segments concurrently, each into its own part of dest.
+   The last segment takes everything the scan does not understand (a bad control byte,
+   a truncated chunk, a chunk that does not fit into dest) and is decoded with finishMode,
+   so that results, status and sizes are the same as those of Lzma2Decode.
+   If an earlier segment fails, the whole stream is decoded again by Lzma2Decode.
+
+   The calling thread decodes too, helper threads are leased from threadPool (may be NULL).
+   Streams without a dictionary reset after the first chunk, numThreads <= 1 and traced
+   builds (see Trace.h) use Lzma2Decode directly.
+   Lzma2DecMt_Decode returns the same codes as Lzma2Decode. */
+
+SRes Lzma2DecMt_Decode(Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen,
+    Byte prop, ELzmaFinishMode finishMode, ELzmaStatus *status,
+    unsigned numThreads, struct _CThreadPool *threadPool, ISzAlloc *alloc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,7 @@
 
 /* #define _7ZIP_ST */
 
+#include "Alloc.h"
 #include "Lzma2Enc.h"
 
 #ifndef _7ZIP_ST
@@ -172,6 +173,7 @@ void Lzma2EncProps_Init(CLzma2EncProps *p)
   LzmaEncProps_Init(&p->lzmaProps);
   p->numTotalThreads = -1;
   p->numBlockThreads = -1;
+  p->workStealing = -1;
   p->blockSize = 0;
 }
 
@@ -181,7 +183,7 @@ void Lzma2EncProps_Normalize(CLzma2EncProps *p)
   {
     CLzmaEncProps lzmaProps = p->lzmaProps;
     LzmaEncProps_Normalize(&lzmaProps);
-    t1n = lzmaProps.numThreads;
+    t1n = lzmaProps.numThreads; /* includes the extra hash threads of the match finder */
   }
 
   t1 = p->lzmaProps.numThreads;
@@ -222,6 +224,16 @@ void Lzma2EncProps_Normalize(CLzma2EncProps *p)
   p->numTotalThreads = t3;
   LzmaEncProps_Normalize(&p->lzmaProps);
 
+  if (p->workStealing < 0)
+  {
+    /* traced runs must replay the turn order of the managed MtCoder */
+    #ifdef DISABLE_TRACE
+    p->workStealing = 1;
+    #else
+    p->workStealing = 0;
+    #endif
+  }
+
   if (p->blockSize == 0)
   {
     UInt32 dictSize = p->lzmaProps.dictSize;
@@ -251,8 +263,13 @@ typedef struct
 
   ISzAlloc *alloc;
   ISzAlloc *allocBig;
+  struct _CThreadPool *threadPool;
+  const struct _CCpuTopology *topology;
+  CFirstTouchAlloc touchAlloc;
+  CFirstTouchAlloc touchAllocBig;
 
-  CLzma2EncInt coders[NUM_MT_CODER_THREADS_MAX];
+  CLzma2EncInt *coders;
+  unsigned numCoders;
 
   #ifndef _7ZIP_ST
   CMtCoder mtCoder;
@@ -261,6 +278,15 @@ typedef struct
 } CLzma2Enc;
 
 
+static SRes Lzma2EncInt_Create(CLzma2EncInt *p, CLzma2Enc *mainEncoder, ISzAlloc *alloc)
+{
+  p->enc = LzmaEnc_Create(alloc);
+  if (p->enc == NULL)
+    return SZ_ERROR_MEM;
+  LzmaEnc_SetThreadPool(p->enc, mainEncoder->threadPool);
+  return SZ_OK;
+}
+
 /* ---------- Lzma2EncThread ---------- */
 
 static SRes Lzma2Enc_EncodeMt1(CLzma2EncInt *p, CLzma2Enc *mainEncoder,
@@ -315,6 +341,8 @@ static SRes MtCallbackImp_Code(void *pp, unsigned index, Byte *dest, size_t *des
   CMtCallbackImp *imp = (CMtCallbackImp *)pp;
   CLzma2Enc *mainEncoder = imp->lzma2Enc;
   CLzma2EncInt *p = &mainEncoder->coders[index];
+  ISzAlloc *alloc = mainEncoder->alloc;
+  ISzAlloc *allocBig = mainEncoder->allocBig;
 
   SRes res = SZ_OK;
   {
@@ -323,10 +351,21 @@ static SRes MtCallbackImp_Code(void *pp, unsigned index, Byte *dest, size_t *des
 
     if (srcSize != 0)
     {
+      /* with a topology this thread is bound to its node: it creates its own encoder
+         and touches the encoder's memory first, so that the memory is local to the node */
+      if (mainEncoder->topology)
+      {
+        alloc = &mainEncoder->touchAlloc.funcTable;
+        allocBig = &mainEncoder->touchAllocBig.funcTable;
+      }
+      if (p->enc == NULL)
+      {
+        RINOK(Lzma2EncInt_Create(p, mainEncoder, alloc));
+      }
       RINOK(Lzma2EncInt_Init(p, &mainEncoder->props));
      
       RINOK(LzmaEnc_MemPrepare(p->enc, src, srcSize, LZMA2_KEEP_WINDOW_SIZE,
-          mainEncoder->alloc, mainEncoder->allocBig));
+          alloc, allocBig));
      
       while (p->srcPos < srcSize)
       {
@@ -376,11 +415,12 @@ CLzma2EncHandle Lzma2Enc_Create(ISzAlloc *alloc, ISzAlloc *allocBig)
   p->outBuf = 0;
   p->alloc = alloc;
   p->allocBig = allocBig;
-  {
-    unsigned i;
-    for (i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
-      p->coders[i].enc = 0;
-  }
+  p->threadPool = NULL;
+  p->topology = NULL;
+  FirstTouchAlloc_Construct(&p->touchAlloc, alloc);
+  FirstTouchAlloc_Construct(&p->touchAllocBig, allocBig);
+  p->coders = NULL;
+  p->numCoders = 0;
   #ifndef _7ZIP_ST
   MtCoder_Construct(&p->mtCoder);
   #endif
@@ -392,7 +432,7 @@ void Lzma2Enc_Destroy(CLzma2EncHandle pp)
 {
   CLzma2Enc *p = (CLzma2Enc *)pp;
   unsigned i;
-  for (i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
+  for (i = 0; i < p->numCoders; i++)
   {
     CLzma2EncInt *t = &p->coders[i];
     if (t->enc)
@@ -406,6 +446,7 @@ void Lzma2Enc_Destroy(CLzma2EncHandle pp)
   MtCoder_Destruct(&p->mtCoder);
   #endif
 
+  IAlloc_Free(p->alloc, p->coders);
   IAlloc_Free(p->alloc, p->outBuf);
   IAlloc_Free(p->alloc, pp);
 }
@@ -437,6 +478,41 @@ TR("Lzma2Enc_SetProps:numTotalThreads",props->numTotalThreads);
   return SZ_OK;
 }
 
+void Lzma2Enc_SetThreadPool(CLzma2EncHandle pp, struct _CThreadPool *threadPool)
+{
+  CLzma2Enc *p = (CLzma2Enc *)pp;
+  unsigned i;
+  p->threadPool = threadPool;
+  for (i = 0; i < p->numCoders; i++)
+    if (p->coders[i].enc)
+      LzmaEnc_SetThreadPool(p->coders[i].enc, threadPool);
+  #ifndef _7ZIP_ST
+  p->mtCoder.threadPool = threadPool;
+  #endif
+}
+
+void Lzma2Enc_SetTopology(CLzma2EncHandle pp, const struct _CCpuTopology *topology)
+{
+  CLzma2Enc *p = (CLzma2Enc *)pp;
+  p->topology = topology;
+  #ifndef _7ZIP_ST
+  p->mtCoder.topology = topology;
+  #endif
+}
+
+unsigned Lzma2Enc_GetPlacement(CLzma2EncHandle pp, struct _CMtPlacement *items, unsigned maxItems)
+{
+  #ifndef _7ZIP_ST
+  CLzma2Enc *p = (CLzma2Enc *)pp;
+  return MtCoder_GetPlacement(&p->mtCoder, items, maxItems);
+  #else
+  pp = pp;
+  items = items;
+  maxItems = maxItems;
+  return 0;
+  #endif
+}
+
 Byte Lzma2Enc_WriteProperties(CLzma2EncHandle pp)
 {
   CLzma2Enc *p = (CLzma2Enc *)pp;
@@ -455,14 +531,31 @@ SRes Lzma2Enc_Encode(CLzma2EncHandle pp,
   CLzma2Enc *p = (CLzma2Enc *)pp;
   int i;
 
+  if ((unsigned)p->props.numBlockThreads > p->numCoders)
+  {
+    unsigned num = (unsigned)p->props.numBlockThreads;
+    unsigned k;
+    CLzma2EncInt *coders = (CLzma2EncInt *)IAlloc_Alloc(p->alloc, num * sizeof(CLzma2EncInt));
+    if (coders == 0)
+      return SZ_ERROR_MEM;
+    for (k = 0; k < p->numCoders; k++)
+      coders[k] = p->coders[k];
+    for (; k < num; k++)
+      coders[k].enc = 0;
+    IAlloc_Free(p->alloc, p->coders);
+    p->coders = coders;
+    p->numCoders = num;
+  }
+
+  /* with a topology the block threads create their encoders, see MtCallbackImp_Code */
   for (i = 0; i < p->props.numBlockThreads; i++)
   {
     CLzma2EncInt *t = &p->coders[i];
+    if (p->topology && p->props.numBlockThreads > 1)
+      break;
     if (t->enc == NULL)
     {
-      t->enc = LzmaEnc_Create(p->alloc);
-      if (t->enc == NULL)
-        return SZ_ERROR_MEM;
+      RINOK(Lzma2EncInt_Create(t, p, p->alloc));
     }
   }
 
@@ -488,6 +581,8 @@ SRes Lzma2Enc_Encode(CLzma2EncHandle pp,
     p->mtCoder.blockSize = p->props.blockSize;
     p->mtCoder.destBlockSize = p->props.blockSize + (p->props.blockSize >> 10) + 16;
     p->mtCoder.numThreads = p->props.numBlockThreads;
+    p->mtCoder.workStealing = p->props.workStealing;
+    p->mtCoder.cpusPerThread = (unsigned)p->props.lzmaProps.numThreads;
     
     return MtCoder_Code(&p->mtCoder);
   }
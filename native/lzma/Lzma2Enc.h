@@ -16,6 +16,7 @@ typedef struct
   size_t blockSize;
   int numBlockThreads;
   int numTotalThreads;
+  int workStealing; /* -1 - auto, 0 - threads take turns reading and writing, 1 - idle threads take the next block */
 } CLzma2EncProps;
 
 void Lzma2EncProps_Init(CLzma2EncProps *p);
@@ -42,6 +43,25 @@ Byte Lzma2Enc_WriteProperties(CLzma2EncHandle p);
 SRes Lzma2Enc_Encode(CLzma2EncHandle p,
     ISeqOutStream *outStream, ISeqInStream *inStream, ICompressProgress *progress);
 
+/* Lzma2Enc_SetThreadPool attaches the block coder threads and the match finder
+   threads of all internal encoders to threadPool (see MtCoder.h), so that they stay
+   parked in the pool between encodes and between handles. The pool must outlive the handle. */
+
+struct _CThreadPool;
+void Lzma2Enc_SetThreadPool(CLzma2EncHandle p, struct _CThreadPool *threadPool);
+
+/* Lzma2Enc_SetTopology binds the block coder threads to the cpus of topology (see MtCoder.h):
+   every block thread gets numThreads cpus of one node for itself and its match finder threads,
+   and creates and first-touches its encoder there. NULL (the default) leaves threads unbound.
+   Lzma2Enc_GetPlacement reports the mapping of the last Lzma2Enc_Encode call and returns the
+   number of placed threads (0 if the encode was not multithreaded or had no topology).
+   The topology must outlive the handle. */
+
+struct _CCpuTopology;
+struct _CMtPlacement;
+void Lzma2Enc_SetTopology(CLzma2EncHandle p, const struct _CCpuTopology *topology);
+unsigned Lzma2Enc_GetPlacement(CLzma2EncHandle p, struct _CMtPlacement *items, unsigned maxItems);
+
 /* ---------- One Call Interface ---------- */
 
 /* Lzma2Encode
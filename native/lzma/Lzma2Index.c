@@ -0,0 +1,304 @@
+/* Lzma2Index.c -- Chunk index for random access into LZMA2 streams
+2026-10-17 : Public domain */
+
+#include <string.h>
+
+#include "Lzma2Index.h"
+
+/* see the chunk format in Lzma2Dec.c */
+
+#define LZMA2_CONTROL_LZMA (1 << 7)
+#define LZMA2_CONTROL_COPY_RESET_DIC 1
+#define LZMA2_CONTROL_EOF 0
+
+#define LZMA2_GET_LZMA_MODE(control) (((control) >> 5) & 3)
+#define LZMA2_IS_THERE_PROP(mode) ((mode) >= 2)
+
+#define LZMA2_INDEX_VERSION 1
+#define LZMA2_INDEX_FLAGS_MASK 0xF
+
+void Lzma2Index_Free(CLzma2Index *p, ISzAlloc *alloc)
+{
+  IAlloc_Free(alloc, p->chunks);
+  p->chunks = 0;
+  p->numChunks = 0;
+}
+
+/* Lzma2Index_Walk stores up to maxChunks chunks and returns the number of all chunks in *numChunks. */
+
+static SRes Lzma2Index_Walk(const Byte *src, SizeT srcLen, CLzma2IndexChunk *chunks, size_t maxChunks,
+    size_t *numChunks, UInt64 *packSize, UInt64 *unpackSize)
+{
+  SizeT pos = 0;
+  UInt64 unpackPos = 0;
+  size_t num = 0;
+  for (;;)
+  {
+    unsigned control;
+    SizeT headerSize, chunkPackSize, chunkUnpackSize;
+    Byte flags;
+    if (pos == srcLen)
+      return SZ_ERROR_INPUT_EOF;
+    control = src[pos];
+    if (control == LZMA2_CONTROL_EOF)
+      break;
+    if ((control & LZMA2_CONTROL_LZMA) == 0)
+    {
+      if (control > 2)
+        return SZ_ERROR_DATA;
+      headerSize = 3;
+      flags = LZMA2_INDEX_UNCOMPRESSED;
+      if (control == LZMA2_CONTROL_COPY_RESET_DIC)
+        flags |= LZMA2_INDEX_RESET_DIC;
+    }
+    else
+    {
+      unsigned mode = LZMA2_GET_LZMA_MODE(control);
+      headerSize = LZMA2_IS_THERE_PROP(mode) ? 6 : 5;
+      flags = 0;
+      if (mode == 3)
+        flags |= LZMA2_INDEX_RESET_DIC;
+      if (mode > 0)
+        flags |= LZMA2_INDEX_RESET_STATE;
+      if (LZMA2_IS_THERE_PROP(mode))
+        flags |= LZMA2_INDEX_NEW_PROP;
+    }
+    if (num == 0 && (flags & LZMA2_INDEX_RESET_DIC) == 0)
+      return SZ_ERROR_DATA;
+    if (srcLen - pos < headerSize)
+      return SZ_ERROR_INPUT_EOF;
+    chunkUnpackSize = ((SizeT)src[pos + 1] << 8) + src[pos + 2] + 1;
+    if ((control & LZMA2_CONTROL_LZMA) != 0)
+    {
+      chunkUnpackSize += (SizeT)(control & 0x1F) << 16;
+      chunkPackSize = ((SizeT)src[pos + 3] << 8) + src[pos + 4] + 1;
+    }
+    else
+      chunkPackSize = chunkUnpackSize;
+    if (srcLen - pos - headerSize < chunkPackSize)
+      return SZ_ERROR_INPUT_EOF;
+    if (num < maxChunks)
+    {
+      chunks[num].packPos = pos;
+      chunks[num].unpackPos = unpackPos;
+      chunks[num].flags = flags;
+    }
+    num++;
+    pos += headerSize + chunkPackSize;
+    unpackPos += chunkUnpackSize;
+  }
+  *numChunks = num;
+  *packSize = (UInt64)pos + 1;
+  *unpackSize = unpackPos;
+  return SZ_OK;
+}
+
+SRes Lzma2Index_Build(CLzma2Index *p, const Byte *src, SizeT srcLen, Byte prop, ISzAlloc *alloc)
+{
+  size_t numChunks;
+  Lzma2Index_Free(p, alloc);
+  if (prop > 40)
+    return SZ_ERROR_UNSUPPORTED;
+  p->prop = prop;
+  RINOK(Lzma2Index_Walk(src, srcLen, NULL, 0, &numChunks, &p->packSize, &p->unpackSize));
+  if (numChunks != 0)
+  {
+    p->chunks = (CLzma2IndexChunk *)IAlloc_Alloc(alloc, numChunks * sizeof(CLzma2IndexChunk));
+    if (p->chunks == 0)
+      return SZ_ERROR_MEM;
+    p->numChunks = numChunks;
+    Lzma2Index_Walk(src, srcLen, p->chunks, numChunks, &numChunks, &p->packSize, &p->unpackSize);
+  }
+  return SZ_OK;
+}
+
+size_t Lzma2Index_FindResetChunk(const CLzma2Index *p, UInt64 offset)
+{
+  size_t left = 0, right = p->numChunks;
+  if (right == 0)
+    return 0;
+  /* the last chunk with unpackPos <= offset */
+  while (right - left > 1)
+  {
+    size_t mid = left + (right - left) / 2;
+    if (p->chunks[mid].unpackPos <= offset)
+      left = mid;
+    else
+      right = mid;
+  }
+  while (left != 0 && (p->chunks[left].flags & LZMA2_INDEX_RESET_DIC) == 0)
+    left--;
+  return left;
+}
+
+SRes Lzma2Index_Read(const CLzma2Index *p, const Byte *src, SizeT srcLen,
+    UInt64 offset, Byte *dest, SizeT *destLen, ISzAlloc *alloc)
+{
+  SizeT size = *destLen;
+  const CLzma2IndexChunk *chunk;
+  CLzma2Dec dec;
+  Byte *dic;
+  SizeT dicBufSize;
+  const Byte *in;
+  SizeT inLen;
+  UInt64 pos, end;
+  SRes res = SZ_OK;
+
+  *destLen = 0;
+  if (offset >= p->unpackSize)
+    return SZ_OK;
+  if (size > p->unpackSize - offset)
+    size = (SizeT)(p->unpackSize - offset);
+  if (size == 0)
+    return SZ_OK;
+  if (srcLen < p->packSize)
+    return SZ_ERROR_DATA;
+
+  chunk = &p->chunks[Lzma2Index_FindResetChunk(p, offset)];
+  pos = chunk->unpackPos;
+  end = offset + size;
+
+  Lzma2Dec_Construct(&dec);
+  RINOK(Lzma2Dec_AllocateProbs(&dec, p->prop, alloc));
+
+  /* the dictionary never has to hold more than what is decoded from the reset on */
+  dicBufSize = dec.decoder.prop.dicSize;
+  if (end - pos < dicBufSize)
+    dicBufSize = (SizeT)(end - pos);
+  dic = (Byte *)IAlloc_Alloc(alloc, dicBufSize);
+  if (dic == 0)
+  {
+    Lzma2Dec_FreeProbs(&dec, alloc);
+    return SZ_ERROR_MEM;
+  }
+  dec.decoder.dic = dic;
+  dec.decoder.dicBufSize = dicBufSize;
+  Lzma2Dec_Init(&dec);
+
+  in = src + (SizeT)chunk->packPos;
+  inLen = (SizeT)(p->packSize - chunk->packPos);
+  while (pos < end)
+  {
+    SizeT dicPos, dicLimit, inProcessed = inLen, outProcessed;
+    ELzmaStatus status;
+    if (dec.decoder.dicPos == dicBufSize)
+      dec.decoder.dicPos = 0;
+    dicPos = dec.decoder.dicPos;
+    dicLimit = dicBufSize;
+    if (end - pos < dicLimit - dicPos)
+      dicLimit = dicPos + (SizeT)(end - pos);
+
+    res = Lzma2Dec_DecodeToDic(&dec, dicLimit, in, &inProcessed, LZMA_FINISH_ANY, &status);
+    in += inProcessed;
+    inLen -= inProcessed;
+    outProcessed = dec.decoder.dicPos - dicPos;
+
+    if (pos + outProcessed > offset)
+    {
+      SizeT skip = (pos < offset) ? (SizeT)(offset - pos) : 0;
+      memcpy(dest + (SizeT)(pos + skip - offset), dic + dicPos + skip, outProcessed - skip);
+    }
+    pos += outProcessed;
+
+    if (res != SZ_OK)
+      break;
+    /* the stream ended or ran out of input before the end that the index promised */
+    if (outProcessed == 0)
+    {
+      res = SZ_ERROR_DATA;
+      break;
+    }
+  }
+  *destLen = (pos > offset) ? (SizeT)(pos - offset) : 0;
+
+  IAlloc_Free(alloc, dic);
+  Lzma2Dec_FreeProbs(&dec, alloc);
+  return res;
+}
+
+static void Lzma2Index_SetUi64(Byte *p, UInt64 v)
+{
+  unsigned i;
+  for (i = 0; i < 8; i++)
+    p[i] = (Byte)(v >> (8 * i));
+}
+
+static UInt64 Lzma2Index_GetUi64(const Byte *p)
+{
+  UInt64 v = 0;
+  unsigned i;
+  for (i = 8; i != 0; i--)
+    v = (v << 8) | p[i - 1];
+  return v;
+}
+
+size_t Lzma2Index_GetSerializedSize(const CLzma2Index *p)
+{
+  return LZMA2_INDEX_HEADER_SIZE + p->numChunks * LZMA2_INDEX_CHUNK_SIZE;
+}
+
+void Lzma2Index_Serialize(const CLzma2Index *p, Byte *buf)
+{
+  size_t i;
+  buf[0] = 'L';
+  buf[1] = '2';
+  buf[2] = 'I';
+  buf[3] = 'X';
+  buf[4] = LZMA2_INDEX_VERSION;
+  buf[5] = p->prop;
+  Lzma2Index_SetUi64(buf + 6, p->packSize);
+  Lzma2Index_SetUi64(buf + 14, p->unpackSize);
+  Lzma2Index_SetUi64(buf + 22, p->numChunks);
+  buf += LZMA2_INDEX_HEADER_SIZE;
+  for (i = 0; i < p->numChunks; i++, buf += LZMA2_INDEX_CHUNK_SIZE)
+  {
+    Lzma2Index_SetUi64(buf, p->chunks[i].packPos);
+    Lzma2Index_SetUi64(buf + 8, p->chunks[i].unpackPos);
+    buf[16] = p->chunks[i].flags;
+  }
+}
+
+SRes Lzma2Index_Deserialize(CLzma2Index *p, const Byte *buf, size_t size, ISzAlloc *alloc)
+{
+  UInt64 numChunks;
+  size_t i;
+  Lzma2Index_Free(p, alloc);
+  if (size < 5 || memcmp(buf, "L2IX", 4) != 0 || buf[4] != LZMA2_INDEX_VERSION)
+    return SZ_ERROR_UNSUPPORTED;
+  if (size < LZMA2_INDEX_HEADER_SIZE)
+    return SZ_ERROR_DATA;
+  p->prop = buf[5];
+  if (p->prop > 40)
+    return SZ_ERROR_UNSUPPORTED;
+  p->packSize = Lzma2Index_GetUi64(buf + 6);
+  p->unpackSize = Lzma2Index_GetUi64(buf + 14);
+  numChunks = Lzma2Index_GetUi64(buf + 22);
+  if (numChunks != (size - LZMA2_INDEX_HEADER_SIZE) / LZMA2_INDEX_CHUNK_SIZE ||
+      (size - LZMA2_INDEX_HEADER_SIZE) % LZMA2_INDEX_CHUNK_SIZE != 0 ||
+      (numChunks == 0) != (p->unpackSize == 0) || p->packSize == 0)
+    return SZ_ERROR_DATA;
+  if (numChunks == 0)
+    return SZ_OK;
+
+  p->chunks = (CLzma2IndexChunk *)IAlloc_Alloc(alloc, (size_t)numChunks * sizeof(CLzma2IndexChunk));
+  if (p->chunks == 0)
+    return SZ_ERROR_MEM;
+  p->numChunks = (size_t)numChunks;
+  buf += LZMA2_INDEX_HEADER_SIZE;
+  for (i = 0; i < p->numChunks; i++, buf += LZMA2_INDEX_CHUNK_SIZE)
+  {
+    CLzma2IndexChunk *c = &p->chunks[i];
+    c->packPos = Lzma2Index_GetUi64(buf);
+    c->unpackPos = Lzma2Index_GetUi64(buf + 8);
+    c->flags = buf[16];
+    if ((c->flags & ~LZMA2_INDEX_FLAGS_MASK) != 0 ||
+        (i == 0 ? (c->packPos != 0 || c->unpackPos != 0 || (c->flags & LZMA2_INDEX_RESET_DIC) == 0) :
+          (c->packPos <= c[-1].packPos || c->unpackPos <= c[-1].unpackPos)) ||
+        c->packPos >= p->packSize || c->unpackPos >= p->unpackSize)
+    {
+      Lzma2Index_Free(p, alloc);
+      return SZ_ERROR_DATA;
+    }
+  }
+  return SZ_OK;
+}
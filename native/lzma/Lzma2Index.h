@@ -0,0 +1,93 @@
+/* Lzma2Index.h -- Chunk index for random access into LZMA2 streams
+2026-10-17 : Public domain */
+
+#ifndef __LZMA2_INDEX_H
+#define __LZMA2_INDEX_H
+
+#include "Lzma2Dec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CLzma2Index lists the chunks of a packed LZMA2 stream. Decoding can start at any chunk
+   that resets the dictionary, because nothing after it refers to data before it.
+   Streams written by Lzma2Enc with several block threads reset the dictionary at every block. */
+
+#define LZMA2_INDEX_RESET_DIC      (1 << 0)
+#define LZMA2_INDEX_RESET_STATE    (1 << 1)
+#define LZMA2_INDEX_NEW_PROP       (1 << 2)
+#define LZMA2_INDEX_UNCOMPRESSED   (1 << 3)
+
+typedef struct
+{
+  UInt64 packPos;   /* offset of the chunk header in the packed stream */
+  UInt64 unpackPos; /* offset of the chunk data in the unpacked stream */
+  Byte flags;       /* LZMA2_INDEX_* */
+} CLzma2IndexChunk;
+
+typedef struct
+{
+  CLzma2IndexChunk *chunks;
+  size_t numChunks;
+  UInt64 packSize;   /* including the end marker */
+  UInt64 unpackSize;
+  Byte prop;         /* dictionary size property of the stream */
+} CLzma2Index;
+
+#define Lzma2Index_Construct(p) { (p)->chunks = 0; (p)->numChunks = 0; }
+void Lzma2Index_Free(CLzma2Index *p, ISzAlloc *alloc);
+
+/* Lzma2Index_Build walks the chunk headers of the stream in src once, the chunk data is
+   not decoded. The stream must start with a dictionary reset and end with the end marker.
+Returns:
+  SZ_OK
+  SZ_ERROR_DATA        - malformed chunk header
+  SZ_ERROR_INPUT_EOF   - src ends before the end marker
+  SZ_ERROR_UNSUPPORTED - unsupported prop
+  SZ_ERROR_MEM         - memory allocation error
+*/
+
+SRes Lzma2Index_Build(CLzma2Index *p, const Byte *src, SizeT srcLen, Byte prop, ISzAlloc *alloc);
+
+/* Lzma2Index_FindResetChunk returns the index of the last chunk that resets the dictionary
+   and starts at or before the unpacked offset. */
+
+size_t Lzma2Index_FindResetChunk(const CLzma2Index *p, UInt64 offset);
+
+/* Lzma2Index_Read decodes *destLen bytes starting at the unpacked offset. src is the packed stream
+   the index was built from. Decoding starts at Lzma2Index_FindResetChunk(offset) with a CLzma2Dec
+   whose dictionary holds at most the prop dictionary size. Bytes before offset are decoded but not
+   stored. *destLen is reduced if the range ends after the end of the stream.
+Returns:
+  SZ_OK
+  SZ_ERROR_DATA        - data error, or src does not match the index
+  SZ_ERROR_MEM         - memory allocation error
+*/
+
+SRes Lzma2Index_Read(const CLzma2Index *p, const Byte *src, SizeT srcLen,
+    UInt64 offset, Byte *dest, SizeT *destLen, ISzAlloc *alloc);
+
+/* Serialized index, all numbers are little endian:
+     4 bytes  signature "L2IX"
+     1 byte   version (1)
+     1 byte   prop
+     8 bytes  packSize
+     8 bytes  unpackSize
+     8 bytes  numChunks
+     numChunks * (8 bytes packPos, 8 bytes unpackPos, 1 byte flags)
+   Lzma2Index_Deserialize checks that the chunks are in order and within the sizes, and returns
+   SZ_ERROR_UNSUPPORTED for another signature or version and SZ_ERROR_DATA for a damaged index. */
+
+#define LZMA2_INDEX_HEADER_SIZE 30
+#define LZMA2_INDEX_CHUNK_SIZE 17
+
+size_t Lzma2Index_GetSerializedSize(const CLzma2Index *p);
+void Lzma2Index_Serialize(const CLzma2Index *p, Byte *buf);
+SRes Lzma2Index_Deserialize(CLzma2Index *p, const Byte *buf, size_t size, ISzAlloc *alloc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,6 +5,10 @@
 
 #include <string.h>
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define LZMA_DEC_X64_KERNEL
+#endif
+
 #define kNumTopBits 24
 #define kTopValue ((UInt32)1 << kNumTopBits)
 
@@ -115,6 +119,80 @@ StopCompilingDueBUG
 
 #define LZMA_DIC_MIN (1 << 12)
 
+/* ---------- Match copy ---------- */
+
+/* A match copies len bytes from rep0 bytes back in the dictionary. Short matches use a byte
+   loop. Longer ones are copied in units of 16 or 32 bytes (a fixed size memcpy is a single
+   vector load and store), which needs rep0 >= unit so that a unit does not read bytes it writes.
+   A shorter rep0 is a repeating pattern: after copying rep0 bytes the pattern also repeats with
+   2 * rep0, so the distance is doubled until it reaches the unit. The last unit ends exactly at
+   the end of the match and may rewrite bytes that the previous unit already wrote. */
+
+#define MATCH_COPY_UNIT 16
+
+static void LzmaDec_CopyForward(Byte *dest, SizeT dist, unsigned len)
+{
+  const Byte *src;
+  Byte *lim;
+  if (len < MATCH_COPY_UNIT)
+  {
+    src = dest - dist;
+    do
+      *dest++ = *src++;
+    while (--len != 0);
+    return;
+  }
+  if (dist == 1)
+  {
+    memset(dest, dest[-1], len);
+    return;
+  }
+  while (dist < MATCH_COPY_UNIT)
+  {
+    if (len <= dist)
+    {
+      memcpy(dest, dest - dist, len);
+      return;
+    }
+    memcpy(dest, dest - dist, dist);
+    dest += dist;
+    len -= (unsigned)dist;
+    dist += dist;
+  }
+  if (len <= MATCH_COPY_UNIT)
+  {
+    memcpy(dest, dest - dist, len);
+    return;
+  }
+  src = dest - dist;
+  lim = dest + len - MATCH_COPY_UNIT;
+  if (dist >= MATCH_COPY_UNIT * 2)
+    for (; dest + MATCH_COPY_UNIT * 2 <= lim; dest += MATCH_COPY_UNIT * 2, src += MATCH_COPY_UNIT * 2)
+      memcpy(dest, src, MATCH_COPY_UNIT * 2);
+  for (; dest < lim; dest += MATCH_COPY_UNIT, src += MATCH_COPY_UNIT)
+    memcpy(dest, src, MATCH_COPY_UNIT);
+  memcpy(lim, lim - dist, MATCH_COPY_UNIT);
+}
+
+/* The dictionary is a ring of dicBufSize bytes and dicPos + len <= dicBufSize. If the match
+   starts before the beginning of the ring, its first part is read from the end of the ring,
+   the rest follows at distance rep0 from dic[0]. */
+
+static void LzmaDec_CopyMatch(Byte *dic, SizeT dicPos, SizeT dicBufSize, UInt32 rep0, unsigned len)
+{
+  if (dicPos < rep0)
+  {
+    SizeT pos = dicPos - rep0 + dicBufSize;
+    unsigned cur = (dicBufSize - pos < len) ? (unsigned)(dicBufSize - pos) : len;
+    memmove(dic + dicPos, dic + pos, cur);
+    dicPos += cur;
+    len -= cur;
+    if (len == 0)
+      return;
+  }
+  LzmaDec_CopyForward(dic + dicPos, rep0, len);
+}
+
 /* First LZMA-symbol is always decoded.
 And it decodes new LZMA-symbols while (buf < bufLimit), but "buf" is without last normalization
 Out:
@@ -128,302 +206,65 @@ Out:
     = kMatchSpecLenStart + 2 : State Init Marker
 */
 
-static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, SizeT limit, const Byte *bufLimit)
-{
-  CLzmaProb *probs = p->probs;
-
-  unsigned state = p->state;
-  UInt32 rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
-  unsigned pbMask = ((unsigned)1 << (p->prop.pb)) - 1;
-  unsigned lpMask = ((unsigned)1 << (p->prop.lp)) - 1;
-  unsigned lc = p->prop.lc;
-
-  Byte *dic = p->dic;
-  SizeT dicBufSize = p->dicBufSize;
-  SizeT dicPos = p->dicPos;
-  
-  UInt32 processedPos = p->processedPos;
-  UInt32 checkDicSize = p->checkDicSize;
-  unsigned len = 0;
-
-  const Byte *buf = p->buf;
-  UInt32 range = p->range;
-  UInt32 code = p->code;
-
-  do
-  {
-    CLzmaProb *prob;
-    UInt32 bound;
-    unsigned ttt;
-    unsigned posState = processedPos & pbMask;
+#define LZMA_DEC_REAL LzmaDec_DecodeReal
+#define DEC_LOCALS unsigned ttt;
+#define DEC_BIT(p, i) GET_BIT(p, i)
+#define DEC_MATCHED_BIT(p, i, o, m) GET_BIT2(p, i, o &= ~(m), o &= (m))
+#define DEC_TREE(probs, limit, i) TREE_DECODE(probs, limit, i)
+#define DEC_TREE_6(probs, i) TREE_6_DECODE(probs, i)
+#define DEC_BIT_OR(p, i, dest, mask) GET_BIT2(p, i, ; , dest |= (mask))
+
+#include "LzmaDecReal.h"
+
+#undef LZMA_DEC_REAL
+#undef DEC_LOCALS
+#undef DEC_BIT
+#undef DEC_MATCHED_BIT
+#undef DEC_TREE
+#undef DEC_TREE_6
+#undef DEC_BIT_OR
+
+#ifdef LZMA_DEC_X64_KERNEL
+
+/* LzmaDec_DecodeRealX64 is the loop of LzmaDec_DecodeReal with the bits of literals, lengths and distances
+   decoded without branches. These bits are close to random, so a branch on them is mispredicted
+   often. The decoded bit is turned into a mask that selects the new range and code, and the
+   probability moves towards 2048 (bit 0) or 31 (bit 1): for bit 1 the arithmetic shift of
+   (31 - ttt) gives the same -(ttt >> 5) as the reference update. Compilers undo plain ternaries
+   into branches, the masks stay setcc/and/sub sequences. The coder arithmetic is unchanged,
+   so both kernels produce the same output and the same errors for every stream. */
+
+#define GET_BIT_MASK(p, i, b) \
+  { UInt32 mask_; ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * ttt; \
+  b = (code >= bound); \
+  mask_ = 0 - (UInt32)b; \
+  range = bound + ((range - bound - bound) & mask_); \
+  code -= bound & mask_; \
+  *(p) = (CLzmaProb)(ttt + (unsigned)((Int32)(kBitModelTotal - ((kBitModelTotal - 31) & mask_) - ttt) >> kNumMoveBits)); \
+  i = (i + i) + b; }
+
+#define TREE_DECODE_MASK(probs, limit, i) \
+  { i = 1; do { GET_BIT_MASK(probs + i, i, bit) } while (i < limit); i -= limit; }
+
+#define LZMA_DEC_REAL LzmaDec_DecodeRealX64
+#define DEC_LOCALS unsigned ttt, bit;
+#define DEC_BIT(p, i) GET_BIT_MASK(p, i, bit)
+#define DEC_MATCHED_BIT(p, i, o, m) { GET_BIT_MASK(p, i, bit) o &= (m) ^ (bit - 1); }
+#define DEC_TREE(probs, limit, i) TREE_DECODE_MASK(probs, limit, i)
+#define DEC_TREE_6(probs, i) TREE_DECODE_MASK(probs, (1 << 6), i)
+#define DEC_BIT_OR(p, i, dest, mask) { GET_BIT_MASK(p, i, bit) dest |= (mask) & (0 - (UInt32)bit); }
+
+#include "LzmaDecReal.h"
+
+#undef LZMA_DEC_REAL
+#undef DEC_LOCALS
+#undef DEC_BIT
+#undef DEC_MATCHED_BIT
+#undef DEC_TREE
+#undef DEC_TREE_6
+#undef DEC_BIT_OR
 
-    prob = probs + IsMatch + (state << kNumPosBitsMax) + posState;
-    IF_BIT_0(prob)
-    {
-      unsigned symbol;
-      UPDATE_0(prob);
-      prob = probs + Literal;
-      if (checkDicSize != 0 || processedPos != 0)
-        prob += (LZMA_LIT_SIZE * (((processedPos & lpMask) << lc) +
-        (dic[(dicPos == 0 ? dicBufSize : dicPos) - 1] >> (8 - lc))));
-
-      if (state < kNumLitStates)
-      {
-        state -= (state < 4) ? state : 3;
-        symbol = 1;
-        do { GET_BIT(prob + symbol, symbol) } while (symbol < 0x100);
-      }
-      else
-      {
-        unsigned matchByte = p->dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
-        unsigned offs = 0x100;
-        state -= (state < 10) ? 3 : 6;
-        symbol = 1;
-        do
-        {
-          unsigned bit;
-          CLzmaProb *probLit;
-          matchByte <<= 1;
-          bit = (matchByte & offs);
-          probLit = prob + offs + bit + symbol;
-          GET_BIT2(probLit, symbol, offs &= ~bit, offs &= bit)
-        }
-        while (symbol < 0x100);
-      }
-      dic[dicPos++] = (Byte)symbol;
-      processedPos++;
-      continue;
-    }
-    else
-    {
-      UPDATE_1(prob);
-      prob = probs + IsRep + state;
-      IF_BIT_0(prob)
-      {
-        UPDATE_0(prob);
-        state += kNumStates;
-        prob = probs + LenCoder;
-      }
-      else
-      {
-        UPDATE_1(prob);
-        if (checkDicSize == 0 && processedPos == 0)
-          return SZ_ERROR_DATA;
-        prob = probs + IsRepG0 + state;
-        IF_BIT_0(prob)
-        {
-          UPDATE_0(prob);
-          prob = probs + IsRep0Long + (state << kNumPosBitsMax) + posState;
-          IF_BIT_0(prob)
-          {
-            UPDATE_0(prob);
-            dic[dicPos] = dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
-            dicPos++;
-            processedPos++;
-            state = state < kNumLitStates ? 9 : 11;
-            continue;
-          }
-          UPDATE_1(prob);
-        }
-        else
-        {
-          UInt32 distance;
-          UPDATE_1(prob);
-          prob = probs + IsRepG1 + state;
-          IF_BIT_0(prob)
-          {
-            UPDATE_0(prob);
-            distance = rep1;
-          }
-          else
-          {
-            UPDATE_1(prob);
-            prob = probs + IsRepG2 + state;
-            IF_BIT_0(prob)
-            {
-              UPDATE_0(prob);
-              distance = rep2;
-            }
-            else
-            {
-              UPDATE_1(prob);
-              distance = rep3;
-              rep3 = rep2;
-            }
-            rep2 = rep1;
-          }
-          rep1 = rep0;
-          rep0 = distance;
-        }
-        state = state < kNumLitStates ? 8 : 11;
-        prob = probs + RepLenCoder;
-      }
-      {
-        unsigned limit, offset;
-        CLzmaProb *probLen = prob + LenChoice;
-        IF_BIT_0(probLen)
-        {
-          UPDATE_0(probLen);
-          probLen = prob + LenLow + (posState << kLenNumLowBits);
-          offset = 0;
-          limit = (1 << kLenNumLowBits);
-        }
-        else
-        {
-          UPDATE_1(probLen);
-          probLen = prob + LenChoice2;
-          IF_BIT_0(probLen)
-          {
-            UPDATE_0(probLen);
-            probLen = prob + LenMid + (posState << kLenNumMidBits);
-            offset = kLenNumLowSymbols;
-            limit = (1 << kLenNumMidBits);
-          }
-          else
-          {
-            UPDATE_1(probLen);
-            probLen = prob + LenHigh;
-            offset = kLenNumLowSymbols + kLenNumMidSymbols;
-            limit = (1 << kLenNumHighBits);
-          }
-        }
-        TREE_DECODE(probLen, limit, len);
-        len += offset;
-      }
-
-      if (state >= kNumStates)
-      {
-        UInt32 distance;
-        prob = probs + PosSlot +
-            ((len < kNumLenToPosStates ? len : kNumLenToPosStates - 1) << kNumPosSlotBits);
-        TREE_6_DECODE(prob, distance);
-        if (distance >= kStartPosModelIndex)
-        {
-          unsigned posSlot = (unsigned)distance;
-          int numDirectBits = (int)(((distance >> 1) - 1));
-          distance = (2 | (distance & 1));
-          if (posSlot < kEndPosModelIndex)
-          {
-            distance <<= numDirectBits;
-            prob = probs + SpecPos + distance - posSlot - 1;
-            {
-              UInt32 mask = 1;
-              unsigned i = 1;
-              do
-              {
-                GET_BIT2(prob + i, i, ; , distance |= mask);
-                mask <<= 1;
-              }
-              while (--numDirectBits != 0);
-            }
-          }
-          else
-          {
-            numDirectBits -= kNumAlignBits;
-            do
-            {
-              NORMALIZE
-              range >>= 1;
-              
-              {
-                UInt32 t;
-                code -= range;
-                t = (0 - ((UInt32)code >> 31)); /* (UInt32)((Int32)code >> 31) */
-                distance = (distance << 1) + (t + 1);
-                code += range & t;
-              }
-              /*
-              distance <<= 1;
-              if (code >= range)
-              {
-                code -= range;
-                distance |= 1;
-              }
-              */
-            }
-            while (--numDirectBits != 0);
-            prob = probs + Align;
-            distance <<= kNumAlignBits;
-            {
-              unsigned i = 1;
-              GET_BIT2(prob + i, i, ; , distance |= 1);
-              GET_BIT2(prob + i, i, ; , distance |= 2);
-              GET_BIT2(prob + i, i, ; , distance |= 4);
-              GET_BIT2(prob + i, i, ; , distance |= 8);
-            }
-            if (distance == (UInt32)0xFFFFFFFF)
-            {
-              len += kMatchSpecLenStart;
-              state -= kNumStates;
-              break;
-            }
-          }
-        }
-        rep3 = rep2;
-        rep2 = rep1;
-        rep1 = rep0;
-        rep0 = distance + 1;
-        if (checkDicSize == 0)
-        {
-          if (distance >= processedPos)
-            return SZ_ERROR_DATA;
-        }
-        else if (distance >= checkDicSize)
-          return SZ_ERROR_DATA;
-        state = (state < kNumStates + kNumLitStates) ? kNumLitStates : kNumLitStates + 3;
-      }
-
-      len += kMatchMinLen;
-
-      if (limit == dicPos)
-        return SZ_ERROR_DATA;
-      {
-        SizeT rem = limit - dicPos;
-        unsigned curLen = ((rem < len) ? (unsigned)rem : len);
-        SizeT pos = (dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0);
-
-        processedPos += curLen;
-
-        len -= curLen;
-        if (pos + curLen <= dicBufSize)
-        {
-          Byte *dest = dic + dicPos;
-          ptrdiff_t src = (ptrdiff_t)pos - (ptrdiff_t)dicPos;
-          const Byte *lim = dest + curLen;
-          dicPos += curLen;
-          do
-            *(dest) = (Byte)*(dest + src);
-          while (++dest != lim);
-        }
-        else
-        {
-          do
-          {
-            dic[dicPos++] = dic[pos];
-            if (++pos == dicBufSize)
-              pos = 0;
-          }
-          while (--curLen != 0);
-        }
-      }
-    }
-  }
-  while (dicPos < limit && buf < bufLimit);
-  NORMALIZE;
-  p->buf = buf;
-  p->range = range;
-  p->code = code;
-  p->remainLen = len;
-  p->dicPos = dicPos;
-  p->processedPos = processedPos;
-  p->reps[0] = rep0;
-  p->reps[1] = rep1;
-  p->reps[2] = rep2;
-  p->reps[3] = rep3;
-  p->state = state;
-
-  return SZ_OK;
-}
+#endif
 
 static void MY_FAST_CALL LzmaDec_WriteRem(CLzmaDec *p, SizeT limit)
 {
@@ -442,10 +283,10 @@ static void MY_FAST_CALL LzmaDec_WriteRem(CLzmaDec *p, SizeT limit)
 
     p->processedPos += len;
     p->remainLen -= len;
-    while (len-- != 0)
+    if (len != 0)
     {
-      dic[dicPos] = dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
-      dicPos++;
+      LzmaDec_CopyMatch(dic, dicPos, dicBufSize, rep0, len);
+      dicPos += len;
     }
     p->dicPos = dicPos;
   }
@@ -462,7 +303,16 @@ static int MY_FAST_CALL LzmaDec_DecodeReal2(CLzmaDec *p, SizeT limit, const Byte
       if (limit - p->dicPos > rem)
         limit2 = p->dicPos + rem;
     }
-    RINOK(LzmaDec_DecodeReal(p, limit2, bufLimit));
+    #ifdef LZMA_DEC_X64_KERNEL
+    if (p->kernel == LZMA_DEC_KERNEL_X64)
+    {
+      RINOK(LzmaDec_DecodeRealX64(p, limit2, bufLimit));
+    }
+    else
+    #endif
+    {
+      RINOK(LzmaDec_DecodeReal(p, limit2, bufLimit));
+    }
     if (p->processedPos >= p->prop.dicSize)
       p->checkDicSize = p->prop.dicSize;
     LzmaDec_WriteRem(p, limit);
@@ -877,6 +727,21 @@ SRes LzmaDec_DecodeToBuf(CLzmaDec *p, Byte *dest, SizeT *destLen, const Byte *sr
   }
 }
 
+SRes LzmaDec_DecodeToDest(CLzmaDec *p, Byte *dest, SizeT *destLen,
+    const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status)
+{
+  /* matches reach back at most checkDicSize (or processedPos before that) bytes */
+  SizeT histSize = (p->checkDicSize != 0) ? p->checkDicSize : p->processedPos;
+  SRes res;
+  p->dic = dest - histSize;
+  p->dicPos = histSize;
+  p->dicBufSize = histSize + *destLen;
+  res = LzmaDec_DecodeToDic(p, p->dicBufSize, src, srcLen, finishMode, status);
+  *destLen = p->dicPos - histSize;
+  p->dic = 0;
+  return res;
+}
+
 void LzmaDec_FreeProbs(CLzmaDec *p, ISzAlloc *alloc)
 {
   alloc->Free(alloc, p->probs);
@@ -921,6 +786,16 @@ SRes LzmaProps_Decode(CLzmaProps *p, const Byte *data, unsigned size)
   return SZ_OK;
 }
 
+unsigned LzmaDec_GetDefaultKernel(void)
+{
+  /* the x64 kernel uses only base x86-64 instructions, so every x64 cpu runs it */
+  #ifdef LZMA_DEC_X64_KERNEL
+  return LZMA_DEC_KERNEL_X64;
+  #else
+  return LZMA_DEC_KERNEL_PORTABLE;
+  #endif
+}
+
 static SRes LzmaDec_AllocateProbs2(CLzmaDec *p, const CLzmaProps *propNew, ISzAlloc *alloc)
 {
   UInt32 numProbs = LzmaProps_GetNumProbs(propNew);
@@ -932,6 +807,7 @@ static SRes LzmaDec_AllocateProbs2(CLzmaDec *p, const CLzmaProps *propNew, ISzAl
     if (p->probs == 0)
       return SZ_ERROR_MEM;
   }
+  p->kernel = LzmaDec_GetDefaultKernel();
   return SZ_OK;
 }
 
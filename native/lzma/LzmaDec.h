@@ -65,6 +65,7 @@ typedef struct
   int needInitState;
   UInt32 numProbs;
   unsigned tempBufSize;
+  unsigned kernel; /* LZMA_DEC_KERNEL_*, see LzmaDec_GetDefaultKernel */
   Byte tempBuf[LZMA_REQUIRED_INPUT_MAX];
 } CLzmaDec;
 
@@ -137,6 +138,20 @@ void LzmaDec_FreeProbs(CLzmaDec *p, ISzAlloc *alloc);
 SRes LzmaDec_Allocate(CLzmaDec *state, const Byte *prop, unsigned propsSize, ISzAlloc *alloc);
 void LzmaDec_Free(CLzmaDec *state, ISzAlloc *alloc);
 
+/* Decode kernels:
+     LZMA_DEC_KERNEL_PORTABLE - the reference decoder.
+     LZMA_DEC_KERNEL_X64      - decodes literal, length and distance bits without branches.
+                                It is compiled for x86-64 only and runs on every x86-64 cpu.
+   Both kernels produce the same output and the same errors for every stream.
+   LzmaDec_GetDefaultKernel returns the fastest kernel compiled into this build.
+   LzmaDec_Allocate* sets CLzmaDec::kernel to it; you can change CLzmaDec::kernel
+   between LzmaDec_DecodeToDic calls. A kernel that is not available falls back to the portable one. */
+
+#define LZMA_DEC_KERNEL_PORTABLE 0
+#define LZMA_DEC_KERNEL_X64 1
+
+unsigned LzmaDec_GetDefaultKernel(void);
+
 /* ---------- Dictionary Interface ---------- */
 
 /* You can use it, if you want to eliminate the overhead for data copying from
@@ -199,6 +214,20 @@ SRes LzmaDec_DecodeToBuf(CLzmaDec *p, Byte *dest, SizeT *destLen,
     const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status);
 
 
+/* ---------- Direct Interface ---------- */
+
+/* LzmaDec_DecodeToDest decodes into the caller's buffer and uses that buffer itself as
+   the dictionary, so there is no dictionary buffer and no copy from it.
+   Allocate the state with LzmaDec_AllocateProbs, CLzmaDec::dic is not used between calls.
+   The output of every call must directly follow the output of the previous calls in memory:
+   the last min(number of bytes decoded so far, dictionary size) bytes before dest must still
+   hold them. A single call with the whole output buffer always meets that condition.
+   destLen, srcLen, finishMode and the return codes are those of LzmaDec_DecodeToBuf. */
+
+SRes LzmaDec_DecodeToDest(CLzmaDec *p, Byte *dest, SizeT *destLen,
+    const Byte *src, SizeT *srcLen, ELzmaFinishMode finishMode, ELzmaStatus *status);
+
+
 /* ---------- One Call Interface ---------- */
 
 /* LzmaDecode
@@ -0,0 +1,225 @@
+/* LzmaDecBatch.c -- Decoding of many independent LZMA streams on several threads
+2026-10-17 : Public domain */
+
+#include <stdlib.h>
+
+#include "LzmaDecBatch.h"
+
+#ifndef _7ZIP_ST
+#include "MtCoder.h"
+#endif
+
+#define RC_INIT_SIZE 5
+
+typedef struct
+{
+  SizeT size;
+  SizeT index;
+} CLzmaDecBatchOrder;
+
+typedef struct
+{
+  CLzmaDecBatchItem *items;
+  const CLzmaDecBatchOrder *order;
+  SizeT numItems;
+  ELzmaFinishMode finishMode;
+  ISzAlloc *alloc;
+  #ifndef _7ZIP_ST
+  CCriticalSection cs;
+  #endif
+  SizeT nextItem;
+} CLzmaDecBatch;
+
+static int LzmaDecBatch_CompareOrder(const void *a, const void *b)
+{
+  const CLzmaDecBatchOrder *x = (const CLzmaDecBatchOrder *)a;
+  const CLzmaDecBatchOrder *y = (const CLzmaDecBatchOrder *)b;
+  if (x->size != y->size)
+    return (x->size > y->size) ? -1 : 1;
+  return (x->index < y->index) ? -1 : (x->index > y->index);
+}
+
+/* same as LzmaDecode, but with the probabilities of dec */
+
+static void LzmaDecBatch_DecodeItem(CLzmaDec *dec, CLzmaDecBatchItem *item, ELzmaFinishMode finishMode, ISzAlloc *alloc)
+{
+  SizeT inSize = item->srcLen;
+  SizeT outSize = item->destLen;
+  item->srcLen = item->destLen = 0;
+  item->status = LZMA_STATUS_NOT_SPECIFIED;
+  if (inSize < RC_INIT_SIZE)
+  {
+    item->res = SZ_ERROR_INPUT_EOF;
+    return;
+  }
+  item->res = LzmaDec_AllocateProbs(dec, item->props, item->propsSize, alloc);
+  if (item->res != SZ_OK)
+    return;
+  dec->dic = item->dest;
+  dec->dicBufSize = outSize;
+  LzmaDec_Init(dec);
+  item->srcLen = inSize;
+  item->res = LzmaDec_DecodeToDic(dec, outSize, item->src, &item->srcLen, finishMode, &item->status);
+  if (item->res == SZ_OK && item->status == LZMA_STATUS_NEEDS_MORE_INPUT)
+    item->res = SZ_ERROR_INPUT_EOF;
+  item->destLen = dec->dicPos;
+  dec->dic = 0;
+}
+
+/* LzmaDecBatch_Claim hands out the next item of the order, or the next items up to
+   LZMA_DEC_BATCH_SMALL_SIZE bytes of input, and returns their number (0 at the end). */
+
+static SizeT LzmaDecBatch_Claim(CLzmaDecBatch *p, SizeT *first)
+{
+  SizeT end, groupSize = 0;
+  #ifndef _7ZIP_ST
+  CriticalSection_Enter(&p->cs);
+  #endif
+  *first = end = p->nextItem;
+  while (end < p->numItems)
+  {
+    groupSize += p->order[end++].size;
+    if (groupSize >= LZMA_DEC_BATCH_SMALL_SIZE)
+      break;
+  }
+  p->nextItem = end;
+  #ifndef _7ZIP_ST
+  CriticalSection_Leave(&p->cs);
+  #endif
+  return end - *first;
+}
+
+static void LzmaDecBatch_Work(CLzmaDecBatch *p)
+{
+  CLzmaDec dec;
+  LzmaDec_Construct(&dec);
+  for (;;)
+  {
+    SizeT first, num = LzmaDecBatch_Claim(p, &first);
+    if (num == 0)
+      break;
+    for (; num != 0; num--, first++)
+      LzmaDecBatch_DecodeItem(&dec, &p->items[p->order[first].index], p->finishMode, p->alloc);
+  }
+  LzmaDec_FreeProbs(&dec, p->alloc);
+}
+
+#if !defined(_7ZIP_ST) && defined(DISABLE_TRACE)
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE LzmaDecBatch_ThreadFunc(void *pp)
+{
+  LzmaDecBatch_Work((CLzmaDecBatch *)pp);
+  return 0;
+}
+
+typedef struct
+{
+  CThread thread;
+  CLoopThread *loopThread;
+} CLzmaDecBatchThread;
+
+static void LzmaDecBatch_Run(CLzmaDecBatch *p, unsigned numThreads, CThreadPool *threadPool)
+{
+  CLzmaDecBatchThread *threads;
+  unsigned numHelpers = numThreads - 1, i;
+  threads = (CLzmaDecBatchThread *)IAlloc_Alloc(p->alloc, numHelpers * sizeof(CLzmaDecBatchThread));
+  if (threads == 0)
+    numHelpers = 0;
+
+  /* a helper that cannot be started just leaves its items to the others */
+  for (i = 0; i < numHelpers; i++)
+  {
+    CLzmaDecBatchThread *t = &threads[i];
+    Thread_Construct(&t->thread);
+    t->loopThread = NULL;
+    if (threadPool)
+    {
+      CLoopThread *lt = ThreadPool_Acquire(threadPool);
+      if (lt == NULL)
+        continue;
+      lt->func = LzmaDecBatch_ThreadFunc;
+      lt->param = p;
+      if (LoopThread_StartSubThread(lt) != 0)
+        ThreadPool_Release(threadPool, lt);
+      else
+        t->loopThread = lt;
+    }
+    else if (Thread_Create(&t->thread, LzmaDecBatch_ThreadFunc, p) != 0)
+      Thread_Construct(&t->thread);
+  }
+
+  LzmaDecBatch_Work(p);
+
+  for (i = 0; i < numHelpers; i++)
+  {
+    CLzmaDecBatchThread *t = &threads[i];
+    if (t->loopThread)
+    {
+      LoopThread_WaitSubThread(t->loopThread);
+      ThreadPool_Release(threadPool, t->loopThread);
+    }
+    else if (Thread_WasCreated(&t->thread))
+    {
+      Thread_Wait(&t->thread);
+      Thread_Close(&t->thread);
+    }
+  }
+  IAlloc_Free(p->alloc, threads);
+}
+
+#endif
+
+SRes LzmaDecBatch_Decode(CLzmaDecBatchItem *items, SizeT numItems, ELzmaFinishMode finishMode,
+    unsigned numThreads, struct _CThreadPool *threadPool, ISzAlloc *alloc)
+{
+  CLzmaDecBatch p;
+  CLzmaDecBatchOrder *order;
+  SizeT i;
+  if (numItems == 0)
+    return SZ_OK;
+  order = (CLzmaDecBatchOrder *)IAlloc_Alloc(alloc, numItems * sizeof(CLzmaDecBatchOrder));
+  if (order == 0)
+    return SZ_ERROR_MEM;
+  for (i = 0; i < numItems; i++)
+  {
+    order[i].size = items[i].srcLen;
+    order[i].index = i;
+  }
+  qsort(order, numItems, sizeof(CLzmaDecBatchOrder), LzmaDecBatch_CompareOrder);
+
+  p.items = items;
+  p.order = order;
+  p.numItems = numItems;
+  p.finishMode = finishMode;
+  p.alloc = alloc;
+  p.nextItem = 0;
+
+  #ifndef _7ZIP_ST
+  if (CriticalSection_Init(&p.cs) != 0)
+  {
+    IAlloc_Free(alloc, order);
+    return SZ_ERROR_MEM;
+  }
+  #endif
+
+  #if !defined(_7ZIP_ST) && defined(DISABLE_TRACE)
+  if (numThreads > numItems)
+    numThreads = (unsigned)numItems;
+  if (numThreads > NUM_MT_CODER_THREADS_MAX)
+    numThreads = NUM_MT_CODER_THREADS_MAX;
+  if (numThreads > 1)
+    LzmaDecBatch_Run(&p, numThreads, threadPool);
+  else
+    LzmaDecBatch_Work(&p);
+  #else
+  numThreads = numThreads;
+  threadPool = threadPool;
+  LzmaDecBatch_Work(&p);
+  #endif
+
+  #ifndef _7ZIP_ST
+  CriticalSection_Delete(&p.cs);
+  #endif
+  IAlloc_Free(alloc, order);
+  return SZ_OK;
+}
@@ -0,0 +1,51 @@
+/* LzmaDecBatch.h -- Decoding of many independent LZMA streams on several threads
+2026-10-17 : Public domain */
+
+#ifndef __LZMA_DEC_BATCH_H
+#define __LZMA_DEC_BATCH_H
+
+#include "LzmaDec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _CThreadPool;
+
+typedef struct
+{
+  Byte *dest;
+  SizeT destLen;       /* size of dest on input, size of the decoded data on output */
+  const Byte *src;
+  SizeT srcLen;        /* size of src on input, number of used bytes on output */
+  const Byte *props;
+  unsigned propsSize;
+  SRes res;            /* result of LzmaDecode for this item */
+  ELzmaStatus status;
+} CLzmaDecBatchItem;
+
+/* LzmaDecBatch_Decode decodes every item like LzmaDecode with finishMode, on up to numThreads
+   threads. The calling thread decodes too, helper threads are leased from threadPool (may be NULL).
+   Every thread keeps one decoder for all its items, so the probabilities are allocated once per
+   thread and not once per item.
+
+   The items are handed out largest first, so that a large item does not start last and keep
+   one thread busy while the others are idle. Items smaller than LZMA_DEC_BATCH_SMALL_SIZE are
+   handed out in groups of about that size to keep the handoff cheaper than the decoding.
+   Traced builds (see Trace.h) decode all items on the calling thread.
+
+Returns:
+  SZ_OK        - all items were decoded, see res of each item for its result
+  SZ_ERROR_MEM - memory allocation error, no item was decoded
+*/
+
+#define LZMA_DEC_BATCH_SMALL_SIZE (1 << 16)
+
+SRes LzmaDecBatch_Decode(CLzmaDecBatchItem *items, SizeT numItems, ELzmaFinishMode finishMode,
+    unsigned numThreads, struct _CThreadPool *threadPool, ISzAlloc *alloc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+/* LzmaDecPool.c -- Pool of reusable LZMA and LZMA2 decoders
+2026-10-17 : Public domain */
+
+#include "LzmaDecPool.h"
+
+#define LZMA2_PROP_MAX 40
+
+WRes LzmaDecPool_Create(CLzmaDecPool *p, ISzAlloc *alloc)
+{
+  p->idle = 0;
+  p->numIdle = 0;
+  p->maxIdle = LZMA_DEC_POOL_MAX_IDLE_DEFAULT;
+  p->hits = 0;
+  p->misses = 0;
+  p->alloc = alloc;
+  return CriticalSection_Init(&p->cs);
+}
+
+static void LzmaDecPool_FreeItem(CLzmaDecPool *p, CLzmaDecPoolItem *item)
+{
+  LzmaDec_Free(&item->dec.decoder, item->allocBig);
+  IAlloc_Free(p->alloc, item);
+}
+
+void LzmaDecPool_Destruct(CLzmaDecPool *p)
+{
+  while (p->idle != 0)
+  {
+    CLzmaDecPoolItem *item = p->idle;
+    p->idle = item->next;
+    LzmaDecPool_FreeItem(p, item);
+  }
+  p->numIdle = 0;
+  CriticalSection_Delete(&p->cs);
+}
+
+static Bool LzmaDecPool_SameKey(const CLzmaDecPoolItem *a, const CLzmaDecPoolItem *b)
+{
+  if (a->isLzma2 != b->isLzma2 || a->withDic != b->withDic)
+    return False;
+  if (a->isLzma2)
+    return a->lzma2Prop == b->lzma2Prop;
+  return a->props.lc == b->props.lc && a->props.lp == b->props.lp &&
+      a->props.pb == b->props.pb && a->props.dicSize == b->props.dicSize;
+}
+
+/* The idle list is most recently released first, so a hit gets the decoder whose
+   probabilities were touched last. */
+
+static SRes LzmaDecPool_Acquire(CLzmaDecPool *p, const CLzmaDecPoolItem *key,
+    const Byte *props, unsigned propsSize, ISzAlloc *allocBig, CLzmaDecPoolItem **item)
+{
+  CLzmaDecPoolItem **link;
+  CLzmaDecPoolItem *found = 0;
+  SRes res;
+
+  CriticalSection_Enter(&p->cs);
+  for (link = &p->idle; *link != 0; link = &(*link)->next)
+    if (LzmaDecPool_SameKey(*link, key))
+    {
+      found = *link;
+      *link = found->next;
+      p->numIdle--;
+      break;
+    }
+  if (found != 0)
+    p->hits++;
+  else
+    p->misses++;
+  CriticalSection_Leave(&p->cs);
+
+  if (found == 0)
+  {
+    found = (CLzmaDecPoolItem *)IAlloc_Alloc(p->alloc, sizeof(CLzmaDecPoolItem));
+    if (found == 0)
+      return SZ_ERROR_MEM;
+    *found = *key;
+    found->allocBig = allocBig;
+    Lzma2Dec_Construct(&found->dec);
+    if (key->isLzma2)
+      res = key->withDic ?
+          Lzma2Dec_Allocate(&found->dec, key->lzma2Prop, allocBig) :
+          Lzma2Dec_AllocateProbs(&found->dec, key->lzma2Prop, allocBig);
+    else
+      res = key->withDic ?
+          LzmaDec_Allocate(&found->dec.decoder, props, propsSize, allocBig) :
+          LzmaDec_AllocateProbs(&found->dec.decoder, props, propsSize, allocBig);
+    if (res != SZ_OK)
+    {
+      LzmaDecPool_FreeItem(p, found);
+      return res;
+    }
+  }
+  found->next = 0;
+  *item = found;
+  return SZ_OK;
+}
+
+SRes LzmaDecPool_AcquireLzma(CLzmaDecPool *p, const Byte *props, unsigned propsSize, Bool withDic,
+    ISzAlloc *allocBig, CLzmaDecPoolItem **item)
+{
+  CLzmaDecPoolItem key;
+  RINOK(LzmaProps_Decode(&key.props, props, propsSize));
+  key.isLzma2 = 0;
+  key.lzma2Prop = 0;
+  key.withDic = (Byte)(withDic ? 1 : 0);
+  return LzmaDecPool_Acquire(p, &key, props, propsSize, allocBig, item);
+}
+
+SRes LzmaDecPool_AcquireLzma2(CLzmaDecPool *p, Byte prop, Bool withDic,
+    ISzAlloc *allocBig, CLzmaDecPoolItem **item)
+{
+  CLzmaDecPoolItem key;
+  if (prop > LZMA2_PROP_MAX)
+    return SZ_ERROR_UNSUPPORTED;
+  key.props.lc = key.props.lp = key.props.pb = 0;
+  key.props.dicSize = 0;
+  key.isLzma2 = 1;
+  key.lzma2Prop = prop;
+  key.withDic = (Byte)(withDic ? 1 : 0);
+  return LzmaDecPool_Acquire(p, &key, 0, 0, allocBig, item);
+}
+
+void LzmaDecPool_Release(CLzmaDecPool *p, CLzmaDecPoolItem *item)
+{
+  CriticalSection_Enter(&p->cs);
+  if (p->numIdle < p->maxIdle)
+  {
+    item->next = p->idle;
+    p->idle = item;
+    p->numIdle++;
+    item = 0;
+  }
+  CriticalSection_Leave(&p->cs);
+  if (item != 0)
+    LzmaDecPool_FreeItem(p, item);
+}
+
+void LzmaDecPool_SetMaxIdle(CLzmaDecPool *p, unsigned maxIdle)
+{
+  CLzmaDecPoolItem *surplus = 0;
+  CriticalSection_Enter(&p->cs);
+  p->maxIdle = maxIdle;
+  if (p->numIdle > maxIdle)
+  {
+    /* keep the most recently released decoders */
+    CLzmaDecPoolItem **link = &p->idle;
+    unsigned i;
+    for (i = 0; i < maxIdle; i++)
+      link = &(*link)->next;
+    surplus = *link;
+    *link = 0;
+    p->numIdle = maxIdle;
+  }
+  CriticalSection_Leave(&p->cs);
+  while (surplus != 0)
+  {
+    CLzmaDecPoolItem *item = surplus;
+    surplus = item->next;
+    LzmaDecPool_FreeItem(p, item);
+  }
+}
+
+void LzmaDecPool_GetCounters(CLzmaDecPool *p, UInt64 *hits, UInt64 *misses, unsigned *numIdle)
+{
+  CriticalSection_Enter(&p->cs);
+  *hits = p->hits;
+  *misses = p->misses;
+  *numIdle = p->numIdle;
+  CriticalSection_Leave(&p->cs);
+}
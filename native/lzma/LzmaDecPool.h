@@ -0,0 +1,70 @@
+/* LzmaDecPool.h -- Pool of reusable LZMA and LZMA2 decoders
+2026-10-17 : Public domain */
+
+#ifndef __LZMA_DEC_POOL_H
+#define __LZMA_DEC_POOL_H
+
+#include "Lzma2Dec.h"
+#include "Threads.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CLzmaDecPool keeps decoders with allocated probabilities (and dictionary) between calls,
+   so that decoding many small streams with the same properties does not allocate every time.
+   A decoder is keyed by lc, lp, pb and dicSize for LZMA, by the dictionary property for LZMA2,
+   and by whether it owns a dictionary. LzmaDecPool_AcquireLzma / AcquireLzma2 return an idle
+   decoder with the same key (a hit) or allocate a new one with allocBig (a miss); the caller
+   initializes it with LzmaDec_Init / Lzma2Dec_Init. LzmaDecPool_Release keeps the decoder for
+   the next caller, or frees it if maxIdle decoders are idle already.
+   All functions except Create and Destruct may be called from several threads. */
+
+#define LZMA_DEC_POOL_MAX_IDLE_DEFAULT 16
+
+typedef struct _CLzmaDecPoolItem
+{
+  struct _CLzmaDecPoolItem *next;
+  CLzma2Dec dec;       /* LZMA decoders use dec.decoder */
+  ISzAlloc *allocBig;  /* allocator of the probabilities and the dictionary */
+  CLzmaProps props;
+  Byte isLzma2;
+  Byte lzma2Prop;
+  Byte withDic;
+} CLzmaDecPoolItem;
+
+typedef struct
+{
+  CCriticalSection cs;
+  CLzmaDecPoolItem *idle;
+  unsigned numIdle;
+  unsigned maxIdle;
+  UInt64 hits;
+  UInt64 misses;
+  ISzAlloc *alloc;     /* allocator of the items */
+} CLzmaDecPool;
+
+WRes LzmaDecPool_Create(CLzmaDecPool *p, ISzAlloc *alloc);
+void LzmaDecPool_Destruct(CLzmaDecPool *p);
+
+/* Returns:
+  SZ_OK
+  SZ_ERROR_UNSUPPORTED - unsupported properties
+  SZ_ERROR_MEM         - memory allocation error
+*/
+
+SRes LzmaDecPool_AcquireLzma(CLzmaDecPool *p, const Byte *props, unsigned propsSize, Bool withDic,
+    ISzAlloc *allocBig, CLzmaDecPoolItem **item);
+SRes LzmaDecPool_AcquireLzma2(CLzmaDecPool *p, Byte prop, Bool withDic,
+    ISzAlloc *allocBig, CLzmaDecPoolItem **item);
+void LzmaDecPool_Release(CLzmaDecPool *p, CLzmaDecPoolItem *item);
+
+/* LzmaDecPool_SetMaxIdle frees the idle decoders above the new limit, 0 disables pooling. */
+void LzmaDecPool_SetMaxIdle(CLzmaDecPool *p, unsigned maxIdle);
+void LzmaDecPool_GetCounters(CLzmaDecPool *p, UInt64 *hits, UInt64 *misses, unsigned *numIdle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
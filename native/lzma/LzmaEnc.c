@@ -47,6 +47,7 @@ void LzmaEncProps_Init(CLzmaEncProps *p)
   p->level = 5;
   p->dictSize = p->mc = 0;
   p->lc = p->lp = p->pb = p->algo = p->fb = p->btMode = p->numHashBytes = p->numThreads = -1;
+  p->numHashThreads = -1;
   p->writeEndMark = 0;
 }
 
@@ -67,10 +68,24 @@ void LzmaEncProps_Normalize(CLzmaEncProps *p)
   if (p->numThreads < 0)
     p->numThreads =
       #ifndef _7ZIP_ST
-      ((p->btMode && p->algo) ? 2 : 1);
+      ((p->btMode == 1 && p->algo) ? 2 : 1);
       #else
       1;
       #endif
+
+  /* the multithreaded match finder runs the LZ, BT and hash stages as 2 threads of
+     numThreads; every additional hash thread counts as one more. Extra hash threads
+     are only used when numHashThreads asks for them. */
+  if (p->numThreads <= 1 || p->numHashThreads < 1)
+    p->numHashThreads = 1;
+  if (p->numHashThreads > 16)
+    p->numHashThreads = 16;
+  while ((p->numHashThreads & (p->numHashThreads - 1)) != 0)
+    p->numHashThreads &= p->numHashThreads - 1;
+  if (p->numHashThreads > 1)
+    p->numThreads = 1 + p->numHashThreads;
+  else if (p->numThreads > 2)
+    p->numThreads = 2;
 }
 
 UInt32 LzmaEncProps_GetDictSize(const CLzmaEncProps *props2)
@@ -161,6 +176,7 @@ typedef struct
 #define kNumPosSlotBits 6
 #define kDicLogSizeMin 0
 #define kDicLogSizeMax 32
+#define kMtDictSizeMax ((UInt32)1 << 30)
 #define kDistTableSizeMax (kDicLogSizeMax * 2)
 
 
@@ -408,9 +424,15 @@ TR("LzmaEnc_SetProps:writeEndMark", props2->writeEndMark);
 TR("LzmaEnc_SetProps:numThreads", props2->numThreads);
   LzmaEncProps_Normalize(&props);
 
-  if (props.lc > LZMA_LC_MAX || props.lp > LZMA_LP_MAX || props.pb > LZMA_PB_MAX ||
-      props.dictSize > ((UInt32)1 << kDicLogSizeMaxCompress) || props.dictSize > ((UInt32)1 << 30))
+  if (props.lc > LZMA_LC_MAX || props.lp > LZMA_LP_MAX || props.pb > LZMA_PB_MAX || props.btMode > 2 ||
+      props.dictSize > ((UInt32)1 << kDicLogSizeMaxCompress))
+    return SZ_ERROR_PARAM;
+  #ifndef _7ZIP_ST
+  /* the single-threaded match finder uses 64-bit positions (pos64), the multithreaded one
+     normalizes 32-bit positions and keeps the 1 GB limit (see mtMode in LzmaEnc_Alloc) */
+  if (props.numThreads > 1 && props.algo != 0 && props.btMode != 0 && props.dictSize > kMtDictSizeMax)
     return SZ_ERROR_PARAM;
+  #endif
   p->dictSize = props.dictSize;
   p->matchFinderCycles = props.mc;
   {
@@ -428,7 +450,7 @@ TR("LzmaEnc_SetProps:numThreads", props2->numThreads);
   p->matchFinderBase.btMode = props.btMode;
   {
     UInt32 numHashBytes = 4;
-    if (props.btMode)
+    if (props.btMode == 1)
     {
       if (props.numHashBytes < 2)
         numHashBytes = 2;
@@ -451,6 +473,7 @@ TR("LzmaEnc_SetProps:numThreads", props2->numThreads);
   }
   */
   p->multiThread = (props.numThreads > 1);
+  MatchFinderMt_SetNumHashThreads(&p->matchFinderMt, (UInt32)props.numHashThreads);
   #endif
 
   return SZ_OK;
@@ -1760,6 +1783,17 @@ void LzmaEnc_Destroy(CLzmaEncHandle p, ISzAlloc *alloc, ISzAlloc *allocBig)
   alloc->Free(alloc, p);
 }
 
+void LzmaEnc_SetThreadPool(CLzmaEncHandle pp, struct _CThreadPool *threadPool)
+{
+  #ifndef _7ZIP_ST
+  CLzmaEnc *p = (CLzmaEnc *)pp;
+  MatchFinderMt_SetThreadPool(&p->matchFinderMt, threadPool);
+  #else
+  pp = pp;
+  threadPool = threadPool;
+  #endif
+}
+
 static SRes LzmaEnc_CodeOneBlock(CLzmaEnc *p, Bool useLimits, UInt32 maxPackSize, UInt32 maxUnpackSize)
 {
   UInt32 nowPos32, startPos32;
@@ -1948,7 +1982,7 @@ static SRes LzmaEnc_Alloc(CLzmaEnc *p, UInt32 keepWindowSize, ISzAlloc *alloc, I
   Bool btMode;
   if (!RangeEnc_Alloc(&p->rc, alloc))
     return SZ_ERROR_MEM;
-  btMode = (p->matchFinderBase.btMode != 0);
+  btMode = (p->matchFinderBase.btMode == 1);
   #ifndef _7ZIP_ST
   p->mtMode = (p->multiThread && !p->fastMode && btMode);
   #endif
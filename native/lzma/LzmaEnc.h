@@ -16,18 +16,23 @@ typedef struct _CLzmaEncProps
 {
   int level;       /*  0 <= level <= 9 */
   UInt32 dictSize; /* (1 << 12) <= dictSize <= (1 << 27) for 32-bit version
-                      (1 << 12) <= dictSize <= (1 << 30) for 64-bit version
+                      (1 << 12) <= dictSize <= (1 << 31) for 64-bit version,
+                      (1 << 30) with the multithreaded match finder (numThreads > 1, algo 1, btMode 1 or 2)
                        default = (1 << 24) */
   int lc;          /* 0 <= lc <= 8, default = 3 */
   int lp;          /* 0 <= lp <= 4, default = 0 */
   int pb;          /* 0 <= pb <= 4, default = 2 */
   int algo;        /* 0 - fast, 1 - normal, default = 1 */
   int fb;          /* 5 <= fb <= 273, default = 32 */
-  int btMode;      /* 0 - hashChain Mode, 1 - binTree mode - normal, default = 1 */
+  int btMode;      /* 0 - hashChain Mode, 1 - binTree mode - normal, 2 - hash buckets (see LzFind.h), default = 1 */
   int numHashBytes; /* 2, 3 or 4, default = 4 */
   UInt32 mc;        /* 1 <= mc <= (1 << 30), default = 32 */
   unsigned writeEndMark;  /* 0 - do not write EOPM, 1 - write EOPM, default = 0 */
-  int numThreads;  /* 1 or 2, default = 2 */
+  int numThreads;  /* 1 or 2, default = 2;
+                      LzmaEncProps_Normalize overrides a value > 1 with 1 + numHashThreads: the BT thread
+                      and the hash threads of the multithreaded match finder */
+  int numHashThreads; /* 1 <= numHashThreads <= 16, power of 2 (rounded down), default = 1;
+                      ignored (set to 1) when numThreads <= 1 */
 } CLzmaEncProps;
 
 void LzmaEncProps_Init(CLzmaEncProps *p);
@@ -58,6 +63,13 @@ SRes LzmaEnc_Encode(CLzmaEncHandle p, ISeqOutStream *outStream, ISeqInStream *in
 SRes LzmaEnc_MemEncode(CLzmaEncHandle p, Byte *dest, SizeT *destLen, const Byte *src, SizeT srcLen,
     int writeEndMark, ICompressProgress *progress, ISzAlloc *alloc, ISzAlloc *allocBig);
 
+/* LzmaEnc_SetThreadPool makes the multithreaded match finder lease its threads from
+   threadPool (see MtCoder.h) instead of creating them. Call it before the first encode;
+   the pool must outlive the encoder. NULL restores the default. */
+
+struct _CThreadPool;
+void LzmaEnc_SetThreadPool(CLzmaEncHandle p, struct _CThreadPool *threadPool);
+
 /* ---------- One Call Interface ---------- */
 
 /* LzmaEncode
@@ -2,6 +2,9 @@
 2010-09-24 : Igor Pavlov : Public domain */
 
 #include <stdio.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
 
 #include "MtCoder.h"
 
@@ -10,6 +13,8 @@ void LoopThread_Construct(CLoopThread *p)
   Thread_Construct(&p->thread);
   Event_Construct(&p->startEvent);
   Event_Construct(&p->finishedEvent);
+  p->setAffinity = False;
+  p->affinityRes = 0;
 }
 
 void LoopThread_Close(CLoopThread *p)
@@ -35,7 +40,16 @@ static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE LoopThreadFunc(void *pp)
     }
     TraceObjectSync("LoopThreadFunc", p);
     LeaveGlobalLock();
-    p->res = p->func(p->param);
+    if (p->setAffinity)
+    {
+      CCpuSet prevAffinity;
+      p->affinityRes = Thread_SetAffinity(&p->affinity, &prevAffinity);
+      p->res = p->func(p->param);
+      if (p->affinityRes == 0)
+        Thread_SetAffinity(&prevAffinity, NULL);
+    }
+    else
+      p->res = p->func(p->param);
     if (Event_Set(&p->finishedEvent) != 0)
       return SZ_ERROR_THREAD;
   }
@@ -68,33 +82,215 @@ WRes LoopThread_StopAndWait(CLoopThread *p)
 WRes LoopThread_StartSubThread(CLoopThread *p) { return Event_Set(&p->startEvent); }
 WRes LoopThread_WaitSubThread(CLoopThread *p) { return Event_Wait(&p->finishedEvent); }
 
+void LoopThread_InheritAffinity(CLoopThread *p)
+{
+  p->setAffinity = (Thread_GetAffinity(&p->affinity) == 0);
+  p->affinityRes = 0;
+}
+
+/* ---------- CThreadPool ---------- */
+
+typedef struct _CPoolThread
+{
+  CLoopThread thread; /* must be first: ThreadPool_Release casts back from it */
+  struct _CPoolThread *next;
+} CPoolThread;
+
+void ThreadPool_Construct(CThreadPool *p)
+{
+  p->alloc = NULL;
+  p->csWasInitialized = False;
+  p->freeThreads = NULL;
+  p->numThreads = 0;
+  p->numFreeThreads = 0;
+}
+
+SRes ThreadPool_Create(CThreadPool *p, ISzAlloc *alloc)
+{
+  p->alloc = alloc;
+  if (!p->csWasInitialized)
+  {
+    if (CriticalSection_Init(&p->cs) != 0)
+      return SZ_ERROR_THREAD;
+    p->csWasInitialized = True;
+  }
+  return SZ_OK;
+}
+
+static void PoolThread_Free(CThreadPool *p, CPoolThread *t)
+{
+  if (Thread_WasCreated(&t->thread.thread))
+    LoopThread_StopAndWait(&t->thread);
+  LoopThread_Close(&t->thread);
+  IAlloc_Free(p->alloc, t);
+}
+
+void ThreadPool_Destruct(CThreadPool *p)
+{
+  while (p->freeThreads)
+  {
+    CPoolThread *t = p->freeThreads;
+    p->freeThreads = t->next;
+    PoolThread_Free(p, t);
+  }
+  p->numThreads = 0;
+  p->numFreeThreads = 0;
+  if (p->csWasInitialized)
+  {
+    CriticalSection_Delete(&p->cs);
+    p->csWasInitialized = False;
+  }
+}
+
+CLoopThread *ThreadPool_Acquire(CThreadPool *p)
+{
+  CPoolThread *t;
+  CriticalSection_Enter(&p->cs);
+  t = p->freeThreads;
+  if (t)
+  {
+    p->freeThreads = t->next;
+    p->numFreeThreads--;
+  }
+  CriticalSection_Leave(&p->cs);
+  if (t)
+  {
+    t->thread.setAffinity = False;
+    return &t->thread;
+  }
+
+  t = (CPoolThread *)IAlloc_Alloc(p->alloc, sizeof(CPoolThread));
+  if (t == 0)
+    return NULL;
+  t->next = NULL;
+  LoopThread_Construct(&t->thread);
+  if (LoopThread_Create(&t->thread) != 0)
+  {
+    PoolThread_Free(p, t);
+    return NULL;
+  }
+  CriticalSection_Enter(&p->cs);
+  p->numThreads++;
+  CriticalSection_Leave(&p->cs);
+  return &t->thread;
+}
+
+void ThreadPool_Release(CThreadPool *p, CLoopThread *thread)
+{
+  CPoolThread *t = (CPoolThread *)thread;
+  CriticalSection_Enter(&p->cs);
+  t->next = p->freeThreads;
+  p->freeThreads = t;
+  p->numFreeThreads++;
+  CriticalSection_Leave(&p->cs);
+}
+
 static SRes Progress(ICompressProgress *p, UInt64 inSize, UInt64 outSize)
 {
   return (p && p->Progress(p, inSize, outSize) != SZ_OK) ? SZ_ERROR_PROGRESS : SZ_OK;
 }
 
-static void MtProgress_Init(CMtProgress *p, ICompressProgress *progress)
+#ifdef _WIN32
+#define MtProgress_GetTime() ((UInt32)GetTickCount())
+#else
+static UInt32 MtProgress_GetTime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (UInt32)ts.tv_sec * 1000 + (UInt32)(ts.tv_nsec / 1000000);
+}
+#endif
+
+static void MtProgress_Init(CMtProgress *p, ICompressProgress *progress, unsigned numThreads)
 {
   unsigned i;
-  for (i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
+  for (i = 0; i < numThreads; i++)
     p->inSizes[i] = p->outSizes[i] = 0;
   p->totalInSize = p->totalOutSize = 0;
   p->progress = progress;
   p->res = SZ_OK;
+  if (p->lockFree)
+  {
+    for (i = 0; i < numThreads; i++)
+    {
+      CMtProgressSlot *slot = &p->slots[i];
+      slot->inSize = slot->outSize = 0;
+      slot->doneInSize = slot->doneOutSize = 0;
+      slot->blockInSize = slot->blockOutSize = 0;
+    }
+    p->numThreads = numThreads;
+    p->sharedRes = SZ_OK;
+    p->reporting = 0;
+    p->nextReportTime = (progress ? MtProgress_GetTime() : 0);
+  }
 }
 
 static void MtProgress_Reinit(CMtProgress *p, unsigned index)
 {
+  if (p->lockFree)
+  {
+    CMtProgressSlot *slot = &p->slots[index];
+    slot->doneInSize += slot->blockInSize;
+    slot->doneOutSize += slot->blockOutSize;
+    slot->blockInSize = 0;
+    slot->blockOutSize = 0;
+    return;
+  }
   p->inSizes[index] = 0;
   p->outSizes[index] = 0;
 }
 
+static void MtProgress_SetSharedError(CMtProgress *p, SRes res)
+{
+  Atomic_CompareExchange32(&p->sharedRes, (UInt32)SZ_OK, (UInt32)res);
+}
+
+/* Only the thread that finds the interval elapsed and wins the reporting flag calls progress,
+   so the callback is never entered concurrently and the other threads never wait for it. */
+
+static void MtProgress_Report(CMtProgress *p)
+{
+  UInt32 now = MtProgress_GetTime();
+  UInt64 inSize = 0, outSize = 0;
+  unsigned i;
+  if ((Int32)(now - Atomic_Load32(&p->nextReportTime)) < 0)
+    return;
+  if (!Atomic_CompareExchange32(&p->reporting, 0, 1))
+    return;
+  Atomic_Store32(&p->nextReportTime, now + MTPROGRESS_REPORT_INTERVAL);
+  for (i = 0; i < p->numThreads; i++)
+  {
+    inSize += Atomic_Load64(&p->slots[i].inSize);
+    outSize += Atomic_Load64(&p->slots[i].outSize);
+  }
+  if (Atomic_Load32(&p->sharedRes) == SZ_OK && Progress(p->progress, inSize, outSize) != SZ_OK)
+    MtProgress_SetSharedError(p, SZ_ERROR_PROGRESS);
+  Atomic_Store32(&p->reporting, 0);
+}
+
 #define UPDATE_PROGRESS(size, prev, total) \
   if (size != (UInt64)(Int64)-1) { total += size - prev; prev = size; }
 
 SRes MtProgress_Set(CMtProgress *p, unsigned index, UInt64 inSize, UInt64 outSize)
 {
   SRes res;
+  if (p->lockFree)
+  {
+    CMtProgressSlot *slot = &p->slots[index];
+    if (inSize != (UInt64)(Int64)-1)
+    {
+      slot->blockInSize = inSize;
+      Atomic_Store64(&slot->inSize, slot->doneInSize + inSize);
+    }
+    if (outSize != (UInt64)(Int64)-1)
+    {
+      slot->blockOutSize = outSize;
+      Atomic_Store64(&slot->outSize, slot->doneOutSize + outSize);
+    }
+    if (p->progress)
+      MtProgress_Report(p);
+    return (SRes)Atomic_Load32(&p->sharedRes);
+  }
   CriticalSection_Enter(&p->cs);
   UPDATE_PROGRESS(inSize, p->inSizes[index], p->totalInSize)
   UPDATE_PROGRESS(outSize, p->outSizes[index], p->totalOutSize)
@@ -107,6 +303,11 @@ SRes MtProgress_Set(CMtProgress *p, unsigned index, UInt64 inSize, UInt64 outSiz
 
 static void MtProgress_SetError(CMtProgress *p, SRes res)
 {
+  if (p->lockFree)
+  {
+    MtProgress_SetSharedError(p, res);
+    return;
+  }
   CriticalSection_Enter(&p->cs);
   if (p->res == SZ_OK)
     p->res = res;
@@ -132,6 +333,7 @@ void CMtThread_Construct(CMtThread *p, CMtCoder *mtCoder)
   Event_Construct(&p->canRead);
   Event_Construct(&p->canWrite);
   LoopThread_Construct(&p->thread);
+  p->loopThread = NULL;
 }
 
 #define RINOK_THREAD(x) { if((x) != 0) return SZ_ERROR_THREAD; }
@@ -203,7 +405,7 @@ static SRes FullRead(ISeqInStream *stream, Byte *data, size_t *processedSize)
   return SZ_OK;
 }
 
-#define GET_NEXT_THREAD(p) &p->mtCoder->threads[p->index == p->mtCoder->numThreads  - 1 ? 0 : p->index + 1]
+#define GET_NEXT_THREAD(p) p->mtCoder->threads[p->index == p->mtCoder->numThreads  - 1 ? 0 : p->index + 1]
 
 static SRes MtThread_Process(CMtThread *p, Bool *stop)
 {
@@ -288,48 +490,287 @@ static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE ThreadFunc(void *pp)
   }
 }
 
-void MtCoder_Construct(CMtCoder* p)
+/* ---------- Work-stealing scheduler ---------- */
+
+/* Every thread loops: take a free block buffer from freeBlocks, read the next block
+   into it under readCs, code it with its own coder index, then publish it.
+   Blocks are read and written in order, so block k always lives in the buffers of
+   threads[k % numThreads] and a free token guarantees that its previous block was written.
+   On error or end of input stopReading is set; a thread that sees it passes its
+   freeBlocks token on, so that all waiting threads wake up and leave in turn. */
+
+#define MtCoder_GetBlockSlot(p, block) ((p)->threads[(unsigned)((block) % (p)->numThreads)])
+
+static void MtCoder_StopStealing(CMtCoder *p, SRes res)
 {
-  unsigned i;
-  p->alloc = 0;
-  for (i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
+  MtCoder_SetError(p, res);
+  MtProgress_SetError(&p->mtProgress, res);
+  CriticalSection_Enter(&p->cs);
+  p->stopWriting = True;
+  CriticalSection_Leave(&p->cs);
+  CriticalSection_Enter(&p->readCs);
+  p->stopReading = True;
+  CriticalSection_Leave(&p->readCs);
+  Semaphore_Release1(&p->freeBlocks);
+}
+
+/* The thread that completes the oldest pending block becomes the writer
+   and writes out every block that is ready at that point. */
+
+static SRes MtCoder_PublishBlock(CMtCoder *p, CMtThread *slot, size_t destSize)
+{
+  SRes res = SZ_OK;
+  CriticalSection_Enter(&p->cs);
+  slot->blockDestSize = destSize;
+  slot->blockCoded = True;
+  if (!p->writing)
   {
-    CMtThread *t = &p->threads[i];
-    t->index = i;
-    CMtThread_Construct(t, p);
+    p->writing = True;
+    for (;;)
+    {
+      CMtThread *next = MtCoder_GetBlockSlot(p, p->nextWriteBlock);
+      if (p->stopWriting || !next->blockCoded)
+        break;
+      CriticalSection_Leave(&p->cs);
+      if (p->outStream->Write(p->outStream, next->outBuf, next->blockDestSize) != next->blockDestSize)
+        res = SZ_ERROR_WRITE;
+      CriticalSection_Enter(&p->cs);
+      next->blockCoded = False;
+      p->nextWriteBlock++;
+      if (res != SZ_OK)
+        break;
+      Semaphore_Release1(&p->freeBlocks);
+    }
+    p->writing = False;
   }
+  CriticalSection_Leave(&p->cs);
+  return res;
+}
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE StealingThreadFunc(void *pp)
+{
+  CMtThread *t = (CMtThread *)pp;
+  CMtCoder *p = t->mtCoder;
+  for (;;)
+  {
+    CMtThread *slot;
+    size_t size = p->blockSize;
+    size_t destSize = 0;
+    Bool finished;
+    SRes res;
+
+    if (Semaphore_Wait(&p->freeBlocks) != 0)
+    {
+      MtCoder_StopStealing(p, SZ_ERROR_THREAD);
+      return SZ_ERROR_THREAD;
+    }
+
+    CriticalSection_Enter(&p->readCs);
+    if (p->stopReading)
+    {
+      CriticalSection_Leave(&p->readCs);
+      Semaphore_Release1(&p->freeBlocks);
+      return 0;
+    }
+    slot = MtCoder_GetBlockSlot(p, p->nextReadBlock);
+    p->nextReadBlock++;
+    res = FullRead(p->inStream, slot->inBuf, &size);
+    finished = (size != p->blockSize);
+    if (finished)
+      p->stopReading = True;
+    CriticalSection_Leave(&p->readCs);
+
+    if (res == SZ_OK)
+    {
+      destSize = slot->outBufSize;
+      res = p->mtCallback->Code(p->mtCallback, t->index, slot->outBuf, &destSize, slot->inBuf, size, finished);
+      MtProgress_Reinit(&p->mtProgress, t->index);
+    }
+    if (res == SZ_OK)
+      res = MtCoder_PublishBlock(p, slot, destSize);
+    if (res != SZ_OK)
+    {
+      MtCoder_StopStealing(p, res);
+      return res;
+    }
+  }
+}
+
+/* ---------- MtCoder ---------- */
+
+void MtCoder_Construct(CMtCoder* p)
+{
+  p->alloc = 0;
+  p->threadPool = NULL;
+  p->topology = NULL;
+  p->cpusPerThread = 1;
+  p->numPlacedThreads = 0;
+  p->workStealing = 0;
+  p->threads = NULL;
+  p->numAllocatedThreads = 0;
+  p->mtProgress.inSizes = NULL;
+  p->mtProgress.outSizes = NULL;
+  p->mtProgress.slots = NULL;
+  #ifdef DISABLE_TRACE
+  p->mtProgress.lockFree = True;
+  #else
+  p->mtProgress.lockFree = False;
+  #endif
+  Semaphore_Construct(&p->freeBlocks);
   CriticalSection_Init(&p->cs);
+  CriticalSection_Init(&p->readCs);
   CriticalSection_Init(&p->mtProgress.cs);
 }
 
 void MtCoder_Destruct(CMtCoder* p)
 {
   unsigned i;
-  for (i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
-    CMtThread_Destruct(&p->threads[i]);
+  for (i = 0; i < p->numAllocatedThreads; i++)
+  {
+    CMtThread_Destruct(p->threads[i]);
+    IAlloc_Free(p->alloc, p->threads[i]);
+  }
+  p->numAllocatedThreads = 0;
+  if (p->alloc)
+  {
+    IAlloc_Free(p->alloc, p->threads);
+    IAlloc_Free(p->alloc, p->mtProgress.inSizes);
+    IAlloc_Free(p->alloc, p->mtProgress.slots);
+  }
+  p->threads = NULL;
+  p->mtProgress.inSizes = NULL;
+  p->mtProgress.outSizes = NULL;
+  p->mtProgress.slots = NULL;
   CriticalSection_Delete(&p->cs);
+  CriticalSection_Delete(&p->readCs);
   CriticalSection_Delete(&p->mtProgress.cs);
 }
 
+/* Threads are constructed on first use and kept for later calls, so their
+   addresses (and the loop threads that point to them) stay valid when the
+   array grows. */
+
+static SRes MtCoder_AllocThreads(CMtCoder *p, unsigned numThreads)
+{
+  unsigned i;
+  CMtThread **threads;
+  UInt64 *sizes;
+  CMtProgressSlot *slots;
+
+  if (numThreads <= p->numAllocatedThreads)
+    return SZ_OK;
+
+  threads = (CMtThread **)IAlloc_Alloc(p->alloc, numThreads * sizeof(CMtThread *));
+  sizes = (UInt64 *)IAlloc_Alloc(p->alloc, numThreads * 2 * sizeof(UInt64));
+  slots = (CMtProgressSlot *)IAlloc_Alloc(p->alloc, numThreads * sizeof(CMtProgressSlot));
+  if (threads == 0 || sizes == 0 || slots == 0)
+  {
+    IAlloc_Free(p->alloc, threads);
+    IAlloc_Free(p->alloc, sizes);
+    IAlloc_Free(p->alloc, slots);
+    return SZ_ERROR_MEM;
+  }
+
+  for (i = 0; i < p->numAllocatedThreads; i++)
+    threads[i] = p->threads[i];
+  IAlloc_Free(p->alloc, p->threads);
+  IAlloc_Free(p->alloc, p->mtProgress.inSizes);
+  IAlloc_Free(p->alloc, p->mtProgress.slots);
+  p->threads = threads;
+  p->mtProgress.inSizes = sizes;
+  p->mtProgress.outSizes = sizes + numThreads;
+  p->mtProgress.slots = slots;
+
+  for (; i < numThreads; i++)
+  {
+    CMtThread *t = (CMtThread *)IAlloc_Alloc(p->alloc, sizeof(CMtThread));
+    if (t == 0)
+      return SZ_ERROR_MEM;
+    t->index = i;
+    CMtThread_Construct(t, p);
+    p->threads[i] = t;
+    p->numAllocatedThreads = i + 1;
+  }
+  return SZ_OK;
+}
+
+/* The k-th thread on a node gets the k-th group of cpusPerThread adjacent cpus of the node,
+   wrapping around when the node has fewer cpus than threads. */
+
+static void MtCoder_PlaceThread(CMtCoder *p, CMtThread *t, CLoopThread *lt)
+{
+  const CCpuTopology *topology = p->topology;
+  unsigned rank = t->index / topology->numNodes;
+  unsigned numGroupCpus = (p->cpusPerThread != 0 ? p->cpusPerThread : 1);
+  unsigned first, numCpus, i;
+
+  t->placement.node = CpuTopology_GetNode(topology, t->index % topology->numNodes, &first, &numCpus);
+  t->placement.firstCpu = topology->cpus[first + (rank * numGroupCpus) % numCpus];
+  CpuSet_Zero(&lt->affinity);
+  for (i = 0; i < numGroupCpus && i < numCpus; i++)
+    CpuSet_Add(&lt->affinity, topology->cpus[first + (rank * numGroupCpus + i) % numCpus]);
+  t->placement.numCpus = i;
+  t->placement.pinRes = 0;
+  lt->setAffinity = True;
+  lt->affinityRes = 0;
+}
+
+unsigned MtCoder_GetPlacement(const CMtCoder *p, CMtPlacement *items, unsigned maxItems)
+{
+  unsigned i;
+  for (i = 0; i < p->numPlacedThreads && i < maxItems; i++)
+    items[i] = p->threads[i]->placement;
+  return p->numPlacedThreads;
+}
+
 SRes MtCoder_Code(CMtCoder *p)
 {
-  unsigned i, numThreads = p->numThreads;
+  unsigned i, numThreads = p->numThreads, numLeased = 0;
   SRes res = SZ_OK;
   p->res = SZ_OK;
 
-  MtProgress_Init(&p->mtProgress, p->progress);
+  if (numThreads == 0 || numThreads > NUM_MT_CODER_THREADS_MAX)
+    return SZ_ERROR_PARAM;
+  RINOK(MtCoder_AllocThreads(p, numThreads));
+
+  MtProgress_Init(&p->mtProgress, p->progress, numThreads);
+  p->numPlacedThreads = 0;
 
   for (i = 0; i < numThreads; i++)
   {
-    RINOK(CMtThread_Prepare(&p->threads[i]));
+    RINOK(CMtThread_Prepare(p->threads[i]));
+  }
+
+  if (p->workStealing)
+  {
+    for (i = 0; i < numThreads; i++)
+      p->threads[i]->blockCoded = False;
+    p->nextReadBlock = 0;
+    p->nextWriteBlock = 0;
+    p->stopReading = False;
+    p->stopWriting = False;
+    p->writing = False;
+    if (Semaphore_Create(&p->freeBlocks, numThreads, numThreads) != 0)
+      return SZ_ERROR_THREAD;
   }
 
   for (i = 0; i < numThreads; i++)
   {
-    CMtThread *t = &p->threads[i];
+    CMtThread *t = p->threads[i];
     CLoopThread *lt = &t->thread;
 
-    if (!Thread_WasCreated(&lt->thread))
+    if (p->threadPool)
+    {
+      lt = ThreadPool_Acquire(p->threadPool);
+      if (lt == NULL)
+      {
+        res = SZ_ERROR_THREAD;
+        break;
+      }
+      numLeased++;
+      lt->param = t;
+    }
+    else if (!Thread_WasCreated(&lt->thread))
     {
       lt->func = ThreadFunc;
       lt->param = t;
@@ -340,6 +781,15 @@ SRes MtCoder_Code(CMtCoder *p)
         break;
       }
     }
+    if (lt == &t->thread)
+      lt->setAffinity = False;
+    lt->func = p->workStealing ? StealingThreadFunc : ThreadFunc;
+    if (p->topology && p->topology->numCpus != 0)
+    {
+      MtCoder_PlaceThread(p, t, lt);
+      p->numPlacedThreads = i + 1;
+    }
+    t->loopThread = lt;
   }
 
   if (res == SZ_OK)
@@ -347,27 +797,46 @@ SRes MtCoder_Code(CMtCoder *p)
     unsigned j;
     for (i = 0; i < numThreads; i++)
     {
-      CMtThread *t = &p->threads[i];
-      if (LoopThread_StartSubThread(&t->thread) != SZ_OK)
+      CMtThread *t = p->threads[i];
+      if (LoopThread_StartSubThread(t->loopThread) != SZ_OK)
       {
         res = SZ_ERROR_THREAD;
+        if (p->workStealing)
+        {
+          MtCoder_StopStealing(p, res);
+          break;
+        }
         EnterGlobalLock();
         TraceObjectSync("MtCoder_Code", p);
-        p->threads[0].stopReading = True;
+        p->threads[0]->stopReading = True;
         TraceObjectSync("MtCoder_Code", p);
         LeaveGlobalLock();
         break;
       }
     }
 
-    Event_Set(&p->threads[0].canWrite);
-    Event_Set(&p->threads[0].canRead);
+    if (!p->workStealing)
+    {
+      Event_Set(&p->threads[0]->canWrite);
+      Event_Set(&p->threads[0]->canRead);
+    }
 
     for (j = 0; j < i; j++)
-      LoopThread_WaitSubThread(&p->threads[j].thread);
+    {
+      CMtThread *t = p->threads[j];
+      LoopThread_WaitSubThread(t->loopThread);
+      t->placement.pinRes = t->loopThread->affinityRes;
+    }
   }
 
   for (i = 0; i < numThreads; i++)
-    CMtThread_CloseEvents(&p->threads[i]);
+    CMtThread_CloseEvents(p->threads[i]);
+  if (p->workStealing)
+    Semaphore_Close(&p->freeBlocks);
+  for (i = 0; i < numLeased; i++)
+  {
+    ThreadPool_Release(p->threadPool, p->threads[i]->loopThread);
+    p->threads[i]->loopThread = NULL;
+  }
   return (res == SZ_OK) ? p->res : res;
 }
@@ -18,6 +18,12 @@ typedef struct
   THREAD_FUNC_TYPE func;
   LPVOID param;
   THREAD_FUNC_RET_TYPE res;
+
+  /* if setAffinity, func runs bound to affinity (affinityRes is the result of binding),
+     and the thread returns to its previous cpus afterwards */
+  Bool setAffinity;
+  CCpuSet affinity;
+  WRes affinityRes;
 } CLoopThread;
 
 void LoopThread_Construct(CLoopThread *p);
@@ -26,13 +32,67 @@ WRes LoopThread_Create(CLoopThread *p);
 WRes LoopThread_StopAndWait(CLoopThread *p);
 WRes LoopThread_StartSubThread(CLoopThread *p);
 WRes LoopThread_WaitSubThread(CLoopThread *p);
+/* binds func of a leased worker to the cpus of the calling thread, as a created thread inherits them */
+void LoopThread_InheritAffinity(CLoopThread *p);
+
+/* ---------- CThreadPool ---------- */
+
+/* CThreadPool keeps CLoopThread workers parked between coding calls, so that
+   encoders attached to the same pool do not create and join threads on every call.
+   A worker is leased with ThreadPool_Acquire (a new one is created if none is parked),
+   driven with LoopThread_StartSubThread / LoopThread_WaitSubThread and handed back
+   with ThreadPool_Release once its function has returned.
+   A leased worker keeps the cpus it was created with unless the lessee binds it: a coder with
+   a topology binds its block threads (see MtCoder_Code), and the match finder binds its workers
+   to the cpus of the thread that leases them (LoopThread_InheritAffinity).
+   All leased workers must be released before ThreadPool_Destruct. */
+
+struct _CPoolThread;
+
+typedef struct _CThreadPool
+{
+  ISzAlloc *alloc;
+  CCriticalSection cs;
+  Bool csWasInitialized;
+  struct _CPoolThread *freeThreads;
+  unsigned numThreads;
+  unsigned numFreeThreads;
+} CThreadPool;
+
+void ThreadPool_Construct(CThreadPool *p);
+SRes ThreadPool_Create(CThreadPool *p, ISzAlloc *alloc);
+void ThreadPool_Destruct(CThreadPool *p);
+CLoopThread *ThreadPool_Acquire(CThreadPool *p);
+void ThreadPool_Release(CThreadPool *p, CLoopThread *thread);
+
+/* Thread state is allocated for the number of threads that is actually used,
+   NUM_MT_CODER_THREADS_MAX is only a sanity limit for the props. */
 
 #ifndef _7ZIP_ST
-#define NUM_MT_CODER_THREADS_MAX 32
+#define NUM_MT_CODER_THREADS_MAX 1024
 #else
 #define NUM_MT_CODER_THREADS_MAX 1
 #endif
 
+/* Progress of the coder threads. By default (traced builds) every MtProgress_Set takes cs
+   and calls progress. With lockFree every thread publishes its sizes in its own slot, and
+   progress is called by one thread at a time, which sums the slots, at most once per
+   MTPROGRESS_REPORT_INTERVAL milliseconds. The first error (SZ_ERROR_PROGRESS too)
+   is returned to every thread by its next MtProgress_Set in both modes. */
+
+#define MTPROGRESS_REPORT_INTERVAL 50
+
+typedef struct
+{
+  UInt64 inSize;       /* published: all sizes of the thread so far */
+  UInt64 outSize;
+  UInt64 doneInSize;   /* private to the thread: sizes of its finished blocks */
+  UInt64 doneOutSize;
+  UInt64 blockInSize;  /* private to the thread: sizes of its current block */
+  UInt64 blockOutSize;
+  Byte pad[128 - 6 * sizeof(UInt64)];
+} CMtProgressSlot;
+
 typedef struct
 {
   UInt64 totalInSize;
@@ -40,12 +100,32 @@ typedef struct
   ICompressProgress *progress;
   SRes res;
   CCriticalSection cs;
-  UInt64 inSizes[NUM_MT_CODER_THREADS_MAX];
-  UInt64 outSizes[NUM_MT_CODER_THREADS_MAX];
+  UInt64 *inSizes;
+  UInt64 *outSizes;
+
+  Bool lockFree;
+  unsigned numThreads;
+  CMtProgressSlot *slots;
+  volatile UInt32 sharedRes;
+  volatile UInt32 reporting;
+  volatile UInt32 nextReportTime;
 } CMtProgress;
 
 SRes MtProgress_Set(CMtProgress *p, unsigned index, UInt64 inSize, UInt64 outSize);
 
+/* Placement of a coder thread on a CCpuTopology: the thread is bound to numCpus cpus of one node,
+   starting at firstCpu. Its match finder threads run on the same cpus: created threads inherit
+   them, workers leased from a CThreadPool are bound to them (LoopThread_InheritAffinity).
+   pinRes is the result of binding the thread (0 - bound). */
+
+typedef struct _CMtPlacement
+{
+  unsigned node;
+  unsigned firstCpu;
+  unsigned numCpus;
+  WRes pinRes;
+} CMtPlacement;
+
 struct _CMtCoder;
 
 typedef struct
@@ -57,11 +137,18 @@ typedef struct
   size_t inBufSize;
   unsigned index;
   CLoopThread thread;
+  CLoopThread *loopThread; /* &thread, or a worker leased from mtCoder->threadPool */
 
   Bool stopReading;
   Bool stopWriting;
   CAutoResetEvent canRead;
   CAutoResetEvent canWrite;
+
+  /* work-stealing scheduler: the buffers of CMtThread k % numThreads hold block k */
+  Bool blockCoded;
+  size_t blockDestSize;
+
+  CMtPlacement placement;
 } CMtThread;
 
 typedef struct
@@ -75,24 +162,51 @@ typedef struct _CMtCoder
   size_t blockSize;
   size_t destBlockSize;
   unsigned numThreads;
+
+  /* 0 - blocks are handed round-robin through the canRead/canWrite ring of the threads,
+     1 - work stealing: an idle thread reads and codes the next block, and whichever
+         thread completes the oldest pending block writes out all blocks that are ready.
+     Both keep at most numThreads blocks (blockSize + destBlockSize each) in memory. */
+  int workStealing;
   
   ISeqInStream *inStream;
   ISeqOutStream *outStream;
   ICompressProgress *progress;
   ISzAlloc *alloc;
+  CThreadPool *threadPool; /* optional, NULL - each CMtThread owns its thread */
+
+  /* optional, NULL - threads are not bound. Otherwise the threads are spread round-robin
+     over the nodes, and each thread is bound to its own group of cpusPerThread cpus of its node. */
+  const CCpuTopology *topology;
+  unsigned cpusPerThread;
+  unsigned numPlacedThreads;
 
   IMtCoderCallback *mtCallback;
   CCriticalSection cs;
   SRes res;
 
   CMtProgress mtProgress;
-  CMtThread threads[NUM_MT_CODER_THREADS_MAX];
+  CMtThread **threads;
+  unsigned numAllocatedThreads;
+
+  /* work-stealing scheduler state */
+  CCriticalSection readCs;
+  CSemaphore freeBlocks;
+  UInt64 nextReadBlock;
+  UInt64 nextWriteBlock;
+  Bool stopReading;
+  Bool stopWriting;
+  Bool writing;
 } CMtCoder;
 
 void MtCoder_Construct(CMtCoder* p);
 void MtCoder_Destruct(CMtCoder* p);
 SRes MtCoder_Code(CMtCoder *p);
 
+/* MtCoder_GetPlacement copies the placement of the threads of the last MtCoder_Code call
+   to items and returns the number of placed threads (0 without a topology). */
+unsigned MtCoder_GetPlacement(const CMtCoder *p, CMtPlacement *items, unsigned maxItems);
+
 EXTERN_C_END
 
 #endif
@@ -1,12 +1,195 @@
 /* Threads.c -- multithreading library
 2009-09-20 : Igor Pavlov : Public domain */
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
 #ifndef _WIN32_WCE
 #include <process.h>
 #endif
+#endif
 
 #include "Threads.h"
 
+typedef struct TC
+{
+	THREAD_FUNC_TYPE func;
+	LPVOID param;
+	LPVOID master;
+} TC;
+
+/* The thread context carries the trace root into the new thread; without tracing it is NULL. */
+static TC *Thread_CreateContext(THREAD_FUNC_TYPE func, LPVOID param)
+{
+  TC *ctx = (TC*)malloc(sizeof(TC));
+  if (ctx != NULL)
+  {
+    ctx->func = func;
+    ctx->param = param;
+    ctx->master = GetRootContext();
+  }
+  return ctx;
+}
+
+static THREAD_FUNC_RET_TYPE Thread_RunContext(TC *context)
+{
+	THREAD_FUNC_RET_TYPE result;
+	TraceInitThread(context->master);
+	result = context->func(context->param);
+	TraceStopThread();
+	free(context);
+	return result;
+}
+
+/* ---------- Wait spinning ---------- */
+
+static volatile UInt32 g_WaitSpin =
+  #ifdef DISABLE_TRACE
+  THREAD_WAIT_SPIN_DEFAULT;
+  #else
+  0;
+  #endif
+
+void Thread_SetWaitSpin(UInt32 maxSpinCount) { g_WaitSpin = maxSpinCount; }
+UInt32 Thread_GetWaitSpin(void) { return g_WaitSpin; }
+
+/* WaitSpin_GetBudget returns the budget for the next wait of an object,
+   WaitSpin_Update adapts it after the wait: a wait that ended without blocking
+   restores the full limit, a wait that blocked halves the budget. */
+
+static UInt32 WaitSpin_GetBudget(volatile UInt32 *budget, UInt32 limit)
+{
+  UInt32 spin = Atomic_Load32(budget);
+  UInt32 minSpin = (limit >> 4) + 1;
+  if (spin == 0 || spin > limit)
+    return limit;
+  return spin < minSpin ? minSpin : spin;
+}
+
+static void WaitSpin_Update(volatile UInt32 *budget, UInt32 spin, UInt32 limit, int parked)
+{
+  Atomic_Store32(budget, parked ? spin >> 1 : limit);
+  TraceCountWait(parked, spin);
+}
+
+/* ---------- CPU affinity ---------- */
+
+void CpuSet_Zero(CCpuSet *p)
+{
+  memset(p, 0, sizeof(CCpuSet));
+}
+
+void CpuSet_Add(CCpuSet *p, unsigned cpu)
+{
+  if (cpu < CPU_SET_MAX_CPUS)
+    p->bits[cpu >> 5] |= (UInt32)1 << (cpu & 31);
+}
+
+Bool CpuSet_Contains(const CCpuSet *p, unsigned cpu)
+{
+  return cpu < CPU_SET_MAX_CPUS && (p->bits[cpu >> 5] & ((UInt32)1 << (cpu & 31))) != 0;
+}
+
+static const char *CpuList_ParseNumber(const char *s, unsigned *value)
+{
+  unsigned v = 0;
+  if (*s < '0' || *s > '9')
+    return NULL;
+  for (; *s >= '0' && *s <= '9'; s++)
+  {
+    v = v * 10 + (unsigned)(*s - '0');
+    if (v >= CPU_SET_MAX_CPUS)
+      return NULL;
+  }
+  *value = v;
+  return s;
+}
+
+/* Parses a cpu list like "0-3,8" (the format of the Linux cpulist files) into set.
+   Returns the first character after the list, or NULL if the list is malformed. */
+
+static const char *CpuList_Parse(const char *s, CCpuSet *set)
+{
+  CpuSet_Zero(set);
+  for (;;)
+  {
+    unsigned first, last;
+    s = CpuList_ParseNumber(s, &first);
+    if (s == NULL)
+      return NULL;
+    last = first;
+    if (*s == '-')
+    {
+      s = CpuList_ParseNumber(s + 1, &last);
+      if (s == NULL || last < first)
+        return NULL;
+    }
+    for (; first <= last; first++)
+      CpuSet_Add(set, first);
+    if (*s != ',')
+      return s;
+    s++;
+  }
+}
+
+static void CpuTopology_AddNode(CCpuTopology *p, unsigned node, const CCpuSet *set, const CCpuSet *allowed)
+{
+  unsigned cpu;
+  Bool added = False;
+  for (cpu = 0; cpu < CPU_SET_MAX_CPUS && p->numCpus < CPU_TOPOLOGY_MAX_CPUS; cpu++)
+    if (CpuSet_Contains(set, cpu) && (allowed == NULL || CpuSet_Contains(allowed, cpu)))
+    {
+      p->cpus[p->numCpus] = (UInt16)cpu;
+      p->nodes[p->numCpus] = (UInt16)node;
+      p->numCpus++;
+      added = True;
+    }
+  if (added)
+    p->numNodes++;
+}
+
+SRes CpuTopology_Parse(CCpuTopology *p, const char *s)
+{
+  unsigned node;
+  p->numCpus = 0;
+  p->numNodes = 0;
+  for (node = 0;; node++)
+  {
+    CCpuSet set;
+    s = CpuList_Parse(s, &set);
+    if (s == NULL)
+      return SZ_ERROR_PARAM;
+    CpuTopology_AddNode(p, node, &set, NULL);
+    if (*s == 0)
+      return SZ_OK;
+    if (*s != ';')
+      return SZ_ERROR_PARAM;
+    s++;
+  }
+}
+
+unsigned CpuTopology_GetNode(const CCpuTopology *p, unsigned nodeIndex, unsigned *firstIndex, unsigned *numCpus)
+{
+  unsigned i = 0, k;
+  for (k = 0; k < nodeIndex; k++)
+  {
+    unsigned node = p->nodes[i];
+    while (i < p->numCpus && p->nodes[i] == node)
+      i++;
+  }
+  *firstIndex = i;
+  for (k = i; k < p->numCpus && p->nodes[k] == p->nodes[i]; k++);
+  *numCpus = k - i;
+  return p->nodes[i];
+}
+
+#ifdef _WIN32
+
 static WRes GetError()
 {
   DWORD res = GetLastError();
@@ -29,31 +212,91 @@ WRes Handle_WaitObject(HANDLE h) {
   return (WRes)WaitForSingleObject(h, INFINITE);
 }
 
-typedef struct TC
+/* Events and semaphores keep their state in a user-space word that the waiters spin on.
+   The kernel object only parks the waiters: Set and Release signal it when a waiter has
+   registered in _waiters, and a waiter registers before it checks the word for the last
+   time, so a wakeup cannot be missed. A signal that finds the word already taken wakes
+   a later waiter early, which then checks the word again and blocks. */
+
+typedef Bool (*Wait_TryAcquireFunc)(void *p);
+
+static WRes Wait_SpinAcquire(HANDLE h, volatile LONG *waiters, volatile UInt32 *budget,
+    Wait_TryAcquireFunc tryAcquire, void *p)
 {
-	THREAD_FUNC_TYPE func;
-	LPVOID param;
-	LPVOID master;
-} TC;
+  UInt32 limit = g_WaitSpin;
+  UInt32 spin = 0, i;
+  int parked;
+  if (limit != 0)
+  {
+    spin = WaitSpin_GetBudget(budget, limit);
+    for (i = 0; i < spin; i++)
+    {
+      if (tryAcquire(p))
+      {
+        WaitSpin_Update(budget, i, limit, 0);
+        return 0;
+      }
+      Thread_SpinPause();
+    }
+  }
+  for (parked = 0;; parked = 1)
+  {
+    WRes res = 0;
+    Bool acquired;
+    InterlockedIncrement(waiters);
+    acquired = tryAcquire(p);
+    if (!acquired)
+      res = Handle_WaitObject(h);
+    InterlockedDecrement(waiters);
+    if (acquired)
+    {
+      WaitSpin_Update(budget, spin, limit, parked);
+      return 0;
+    }
+    if (res != 0)
+      return res;
+  }
+}
+
+static Bool Event_TryAcquire(void *p)
+{
+  CEvent *e = (CEvent *)p;
+  return e->_state == 1 && InterlockedCompareExchange(&e->_state, 0, 1) == 1;
+}
+
+static Bool Semaphore_TryAcquire(void *p)
+{
+  CSemaphore *s = (CSemaphore *)p;
+  LONG count;
+  while ((count = s->_count) > 0)
+    if (InterlockedCompareExchange(&s->_count, count - 1, count) == count)
+      return True;
+  return False;
+}
+
+/* there is no GetThreadAffinityMask: read the mask by setting the process mask and restoring it */
+static DWORD_PTR Thread_GetAffinityMask(DWORD_PTR *processMask)
+{
+  DWORD_PTR systemMask, prev;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), processMask, &systemMask))
+    return 0;
+  prev = SetThreadAffinityMask(GetCurrentThread(), *processMask);
+  if (prev != 0)
+    SetThreadAffinityMask(GetCurrentThread(), prev);
+  return prev;
+}
 
 static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE Thread_Stub(void *param)
 {
-	TC *context = (TC*)param;
-	THREAD_FUNC_RET_TYPE result;
-	TraceInitThread(context->master);
-	result = context->func(context->param);
-	TraceStopThread();
-	free(context);
-	return result;
+	return Thread_RunContext((TC*)param);
 }
 
 WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, LPVOID param)
 {
   unsigned threadId; /* Windows Me/98/95: threadId parameter may not be NULL in _beginthreadex/CreateThread functions */
-  TC *ctx = (TC*)malloc(sizeof(TC));
-  ctx->func = func;
-  ctx->param = param;
-  ctx->master = GetRootContext();
+  TC *ctx = Thread_CreateContext(func, param);
+  if (ctx == NULL)
+    return TSZ("Thread_Create", ERROR_NOT_ENOUGH_MEMORY);
   param = ctx;
   *p =
     #ifdef UNDER_CE
@@ -62,6 +305,19 @@ WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, LPVOID param)
     (HANDLE)_beginthreadex(NULL, 0, Thread_Stub, param, 0, &threadId);
     #endif
     /* maybe we must use errno here, but probably GetLastError() is also OK. */
+  if (*p == NULL)
+  {
+    WRes res = GetError();
+    free(ctx);
+    return TSZ("Thread_Create", res);
+  }
+  {
+    /* Windows threads start with the process mask; give it the cpus of its creator, like pthreads */
+    DWORD_PTR processMask;
+    DWORD_PTR mask = Thread_GetAffinityMask(&processMask);
+    if (mask != 0 && mask != processMask)
+      SetThreadAffinityMask(*p, mask);
+  }
   TRZC(*p);
   return TSZ("Thread_Create", HandleToWRes(*p));
 }
@@ -84,34 +340,39 @@ WRes Thread_Wait(CThread *p)
 WRes AutoResetEvent_CreateNotSignaled(CAutoResetEvent *p)
 {
   WRes res;
-  *p = CreateEvent(NULL, FALSE, FALSE, NULL);
-  TraceObjectCreate("Event_Create", *p);
-  res = HandleToWRes(*p);
+  p->_state = 0;
+  p->_waiters = 0;
+  p->_spin = 0;
+  p->_h = CreateEvent(NULL, FALSE, FALSE, NULL);
+  TraceObjectCreate("Event_Create", p->_h);
+  res = HandleToWRes(p->_h);
   TraceStatusCode("Event_Create", res);
   return res;
 }
 
 void Event_Close(CEvent *p)
 {
-  HANDLE h = *p;
-  HandlePtr_Close(p);
+  HANDLE h = p->_h;
+  HandlePtr_Close(&p->_h);
   TraceObjectDelete("Event_Close",h);
 }
 
 WRes Event_Wait(CEvent *p)
 {
   WRes res;
-  res = Handle_WaitObject(*p);
-  TraceObjectSync("Event_Wait",*p);
+  res = Wait_SpinAcquire(p->_h, &p->_waiters, &p->_spin, Event_TryAcquire, p);
+  TraceObjectSync("Event_Wait",p->_h);
   TraceStatusCode("Event_Wait",res);
   return res;
 }
 
 WRes Event_Set(CEvent *p)
 {
-  WRes res;
-  TraceObjectSync("Event_Set",*p);
-  res = BOOLToWRes(SetEvent(*p));
+  WRes res = 0;
+  TraceObjectSync("Event_Set",p->_h);
+  InterlockedExchange(&p->_state, 1);
+  if (Atomic_Load32(&p->_waiters) != 0)
+    res = BOOLToWRes(SetEvent(p->_h));
   TraceStatusCode("Event_Set",res);
   return res;
 }
@@ -119,33 +380,50 @@ WRes Event_Set(CEvent *p)
 WRes Event_Reset(CEvent *p)
 {
   WRes res;
-  TraceObjectSync("Event_Reset",*p);
-  res = BOOLToWRes(ResetEvent(*p));
+  TraceObjectSync("Event_Reset",p->_h);
+  InterlockedExchange(&p->_state, 0);
+  res = BOOLToWRes(ResetEvent(p->_h));
   TraceStatusCode("Event_Reset",res);
   return res;
 }
 
 WRes Semaphore_Create(CSemaphore *p, UInt32 initCount, UInt32 maxCount)
 {
-  *p = CreateSemaphore(NULL, (LONG)initCount, (LONG)maxCount, NULL);
-  TraceObjectCreate("Semaphore_Create",*p);
+  if (maxCount == 0 || maxCount > 0x7FFFFFFF || initCount > maxCount)
+    return TSZ("Semaphore_Create",ERROR_INVALID_PARAMETER);
+  p->_count = (LONG)initCount;
+  p->_waiters = 0;
+  p->_spin = 0;
+  p->_maxCount = maxCount;
+  /* the kernel count only counts wakeups, which may exceed maxCount */
+  p->_h = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+  TraceObjectCreate("Semaphore_Create",p->_h);
   TRI(initCount, maxCount);
-  return TSZ("Semaphore_Create",HandleToWRes(*p));
+  return TSZ("Semaphore_Create",HandleToWRes(p->_h));
 }
 
 void Semaphore_Close(CSemaphore *p)
 {
-  TraceObjectDelete("Semaphore_Close",*p);
-  HandlePtr_Close(p);
+  TraceObjectDelete("Semaphore_Close",p->_h);
+  HandlePtr_Close(&p->_h);
 }
 
 WRes Semaphore_Release1(CSemaphore *p)
 {
   // Sync must happen before release, otherwise we have a race condition!
   // Another thread may aquire the semaphore and write to the sync channel before we did!
-  WRes res;
-  TraceObjectSync("Semaphore_Release",*p);
-  res = BOOLToWRes(ReleaseSemaphore(*p, 1, NULL));
+  WRes res = 0;
+  LONG count;
+  TraceObjectSync("Semaphore_Release",p->_h);
+  do
+  {
+    count = p->_count;
+    if ((UInt32)count >= p->_maxCount)
+      return TSZ("Semaphore_Release",ERROR_TOO_MANY_POSTS);
+  }
+  while (InterlockedCompareExchange(&p->_count, count + 1, count) != count);
+  if (Atomic_Load32(&p->_waiters) != 0)
+    res = BOOLToWRes(ReleaseSemaphore(p->_h, 1, NULL));
   return TSZ("Semaphore_Release",res);
 }
 
@@ -153,8 +431,8 @@ WRes Semaphore_Wait(CSemaphore *p)
 {
   // Sync must happen after wait, otherwise we have a race condition!
   // Another thread may pass through the wait before we do and we would have synced a wrong order!
-  WRes res = Handle_WaitObject(*p);
-  TraceObjectSync("Semaphore_Wait",*p);
+  WRes res = Wait_SpinAcquire(p->_h, &p->_waiters, &p->_spin, Semaphore_TryAcquire, p);
+  TraceObjectSync("Semaphore_Wait",p->_h);
   return TSZ("Semaphore_Wait",res);
 }
 
@@ -192,3 +470,425 @@ void CriticalSection_Leave(CCriticalSection *p)
   TraceObjectSync("CriticalSection_Leave",p);
   LeaveCriticalSection(p);
 }
+
+static void CpuSet_FromMask(CCpuSet *p, DWORD_PTR mask)
+{
+  unsigned i;
+  CpuSet_Zero(p);
+  for (i = 0; i < sizeof(DWORD_PTR) * 8; i++)
+    if (mask & ((DWORD_PTR)1 << i))
+      CpuSet_Add(p, i);
+}
+
+WRes Thread_GetAffinity(CCpuSet *set)
+{
+  DWORD_PTR processMask;
+  DWORD_PTR mask = Thread_GetAffinityMask(&processMask);
+  if (mask == 0)
+    return GetError();
+  CpuSet_FromMask(set, mask);
+  return 0;
+}
+
+WRes Thread_SetAffinity(const CCpuSet *set, CCpuSet *prevSet)
+{
+  DWORD_PTR mask = 0, prev;
+  unsigned i;
+  for (i = 0; i < sizeof(DWORD_PTR) * 8; i++)
+    if (CpuSet_Contains(set, i))
+      mask |= (DWORD_PTR)1 << i;
+  prev = SetThreadAffinityMask(GetCurrentThread(), mask);
+  if (prev == 0)
+    return GetError();
+  if (prevSet)
+    CpuSet_FromMask(prevSet, prev);
+  return 0;
+}
+
+WRes CpuTopology_Detect(CCpuTopology *p)
+{
+  DWORD_PTR processMask, systemMask;
+  ULONG highest, node;
+  CCpuSet set;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+    return GetError();
+  p->numCpus = 0;
+  p->numNodes = 0;
+  if (!GetNumaHighestNodeNumber(&highest))
+    highest = 0;
+  for (node = 0; node <= highest; node++)
+  {
+    ULONGLONG nodeMask = processMask;
+    if (highest != 0 && !GetNumaNodeProcessorMask((UCHAR)node, &nodeMask))
+      continue;
+    CpuSet_FromMask(&set, (DWORD_PTR)nodeMask & processMask);
+    CpuTopology_AddNode(p, node, &set, NULL);
+  }
+  if (p->numCpus == 0)
+  {
+    CpuSet_FromMask(&set, processMask);
+    CpuTopology_AddNode(p, 0, &set, NULL);
+  }
+  return 0;
+}
+
+#else
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define Atomic_Load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define Atomic_Store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define Atomic_CompareExchange(p, expected, desired) \
+    __atomic_compare_exchange_n((p), &(expected), (desired), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define Atomic_Increment(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define Atomic_Decrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+
+/* Futex_Wait sleeps only while *addr still equals value, so a waker that changes
+   the word before calling Futex_Wake can never be missed. The waiter counters
+   let the uncontended Set/Release paths skip the syscall entirely. */
+
+#ifdef __linux__
+
+static void Futex_Wait(volatile int *addr, int value)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void Futex_Wake(volatile int *addr, int count)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#else
+
+static pthread_mutex_t g_FutexMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_FutexCond = PTHREAD_COND_INITIALIZER;
+
+static void Futex_Wait(volatile int *addr, int value)
+{
+  pthread_mutex_lock(&g_FutexMutex);
+  if (Atomic_Load(addr) == value)
+    pthread_cond_wait(&g_FutexCond, &g_FutexMutex);
+  pthread_mutex_unlock(&g_FutexMutex);
+}
+
+static void Futex_Wake(volatile int *addr, int count)
+{
+  (void)addr;
+  (void)count;
+  pthread_mutex_lock(&g_FutexMutex);
+  pthread_cond_broadcast(&g_FutexCond);
+  pthread_mutex_unlock(&g_FutexMutex);
+}
+
+#endif
+
+static void *Thread_Stub(void *param)
+{
+  Thread_RunContext((TC*)param);
+  return NULL;
+}
+
+WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, LPVOID param)
+{
+  WRes res;
+  TC *ctx = Thread_CreateContext(func, param);
+  if (ctx == NULL)
+    return ENOMEM;
+  res = pthread_create(&p->_tid, NULL, Thread_Stub, ctx);
+  if (res != 0)
+  {
+    free(ctx);
+    return res;
+  }
+  p->_created = 1;
+  p->_joined = 0;
+  return 0;
+}
+
+void Thread_Close(CThread *p)
+{
+  if (p->_created && !p->_joined)
+    pthread_detach(p->_tid);
+  p->_created = 0;
+  p->_joined = 0;
+}
+
+WRes Thread_Wait(CThread *p)
+{
+  WRes res;
+  if (!p->_created)
+    return EINVAL;
+  if (p->_joined)
+    return 0;
+  res = pthread_join(p->_tid, NULL);
+  if (res == 0)
+    p->_joined = 1;
+  return res;
+}
+
+WRes AutoResetEvent_CreateNotSignaled(CAutoResetEvent *p)
+{
+  p->_state = 0;
+  p->_waiters = 0;
+  p->_spin = 0;
+  p->_created = 1;
+  return 0;
+}
+
+void Event_Close(CEvent *p)
+{
+  p->_created = 0;
+}
+
+WRes Event_Wait(CEvent *p)
+{
+  UInt32 limit = g_WaitSpin;
+  UInt32 spin = 0, i;
+  int parked;
+  if (limit != 0)
+  {
+    spin = WaitSpin_GetBudget(&p->_spin, limit);
+    for (i = 0; i < spin; i++)
+    {
+      int signaled = 1;
+      if (Atomic_Load(&p->_state) == 1 && Atomic_CompareExchange(&p->_state, signaled, 0))
+      {
+        WaitSpin_Update(&p->_spin, i, limit, 0);
+        return 0;
+      }
+      Thread_SpinPause();
+    }
+  }
+  for (parked = 0;; parked = 1)
+  {
+    int signaled = 1;
+    if (Atomic_CompareExchange(&p->_state, signaled, 0))
+    {
+      WaitSpin_Update(&p->_spin, spin, limit, parked);
+      return 0;
+    }
+    Atomic_Increment(&p->_waiters);
+    Futex_Wait(&p->_state, 0);
+    Atomic_Decrement(&p->_waiters);
+  }
+}
+
+WRes Event_Set(CEvent *p)
+{
+  Atomic_Store(&p->_state, 1);
+  if (Atomic_Load(&p->_waiters) != 0)
+    Futex_Wake(&p->_state, 1);
+  return 0;
+}
+
+WRes Event_Reset(CEvent *p)
+{
+  Atomic_Store(&p->_state, 0);
+  return 0;
+}
+
+WRes Semaphore_Create(CSemaphore *p, UInt32 initCount, UInt32 maxCount)
+{
+  if (maxCount == 0 || maxCount > INT_MAX || initCount > maxCount)
+    return EINVAL;
+  p->_count = (int)initCount;
+  p->_waiters = 0;
+  p->_spin = 0;
+  p->_maxCount = maxCount;
+  p->_created = 1;
+  return 0;
+}
+
+void Semaphore_Close(CSemaphore *p)
+{
+  p->_created = 0;
+}
+
+WRes Semaphore_Release1(CSemaphore *p)
+{
+  int count = Atomic_Load(&p->_count);
+  do
+  {
+    if ((UInt32)count >= p->_maxCount)
+      return EINVAL;
+  }
+  while (!Atomic_CompareExchange(&p->_count, count, count + 1));
+  if (Atomic_Load(&p->_waiters) != 0)
+    Futex_Wake(&p->_count, 1);
+  return 0;
+}
+
+WRes Semaphore_Wait(CSemaphore *p)
+{
+  UInt32 limit = g_WaitSpin;
+  UInt32 spin = 0, i;
+  int parked;
+  if (limit != 0)
+  {
+    spin = WaitSpin_GetBudget(&p->_spin, limit);
+    for (i = 0; i < spin; i++)
+    {
+      int count = Atomic_Load(&p->_count);
+      while (count > 0)
+        if (Atomic_CompareExchange(&p->_count, count, count - 1))
+        {
+          WaitSpin_Update(&p->_spin, i, limit, 0);
+          return 0;
+        }
+      Thread_SpinPause();
+    }
+  }
+  for (parked = 0;; parked = 1)
+  {
+    int count = Atomic_Load(&p->_count);
+    while (count > 0)
+      if (Atomic_CompareExchange(&p->_count, count, count - 1))
+      {
+        WaitSpin_Update(&p->_spin, spin, limit, parked);
+        return 0;
+      }
+    Atomic_Increment(&p->_waiters);
+    Futex_Wait(&p->_count, 0);
+    Atomic_Decrement(&p->_waiters);
+  }
+}
+
+WRes CriticalSection_Init(CCriticalSection *p)
+{
+  /* CRITICAL_SECTION is recursive, keep the same semantics here */
+  pthread_mutexattr_t attr;
+  WRes res = pthread_mutexattr_init(&attr);
+  if (res != 0)
+    return res;
+  res = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  if (res == 0)
+    res = pthread_mutex_init(p, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return res;
+}
+
+void CriticalSection_Delete(CCriticalSection *p)
+{
+  pthread_mutex_destroy(p);
+}
+
+void CriticalSection_Enter(CCriticalSection *p)
+{
+  pthread_mutex_lock(p);
+}
+
+void CriticalSection_Leave(CCriticalSection *p)
+{
+  pthread_mutex_unlock(p);
+}
+
+#ifdef __linux__
+
+WRes Thread_GetAffinity(CCpuSet *set)
+{
+  cpu_set_t s;
+  unsigned i;
+  WRes res = pthread_getaffinity_np(pthread_self(), sizeof(s), &s);
+  if (res != 0)
+    return res;
+  CpuSet_Zero(set);
+  for (i = 0; i < CPU_SETSIZE && i < CPU_SET_MAX_CPUS; i++)
+    if (CPU_ISSET(i, &s))
+      CpuSet_Add(set, i);
+  return 0;
+}
+
+WRes Thread_SetAffinity(const CCpuSet *set, CCpuSet *prevSet)
+{
+  cpu_set_t s;
+  unsigned i;
+  if (prevSet)
+  {
+    RINOK(Thread_GetAffinity(prevSet));
+  }
+  CPU_ZERO(&s);
+  for (i = 0; i < CPU_SETSIZE && i < CPU_SET_MAX_CPUS; i++)
+    if (CpuSet_Contains(set, i))
+      CPU_SET(i, &s);
+  return pthread_setaffinity_np(pthread_self(), sizeof(s), &s);
+}
+
+/* Reads a cpu list file of sysfs; nodes without cpus have an empty list and fail to parse. */
+
+static Bool CpuList_ReadFile(const char *path, CCpuSet *set)
+{
+  char buf[4096];
+  Bool res = False;
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return False;
+  if (fgets(buf, sizeof(buf), f) != NULL)
+    res = (CpuList_Parse(buf, set) != NULL);
+  fclose(f);
+  return res;
+}
+
+WRes CpuTopology_Detect(CCpuTopology *p)
+{
+  CCpuSet allowed, nodes;
+  unsigned node;
+  RINOK(Thread_GetAffinity(&allowed));
+  p->numCpus = 0;
+  p->numNodes = 0;
+  if (CpuList_ReadFile("/sys/devices/system/node/online", &nodes))
+    for (node = 0; node < CPU_SET_MAX_CPUS; node++)
+    {
+      char path[64];
+      CCpuSet set;
+      if (!CpuSet_Contains(&nodes, node))
+        continue;
+      sprintf(path, "/sys/devices/system/node/node%u/cpulist", node);
+      if (CpuList_ReadFile(path, &set))
+        CpuTopology_AddNode(p, node, &set, &allowed);
+    }
+  if (p->numCpus == 0)
+    CpuTopology_AddNode(p, 0, &allowed, NULL);
+  return 0;
+}
+
+#else
+
+WRes Thread_GetAffinity(CCpuSet *set)
+{
+  CpuSet_Zero(set);
+  return ENOTSUP;
+}
+
+WRes Thread_SetAffinity(const CCpuSet *set, CCpuSet *prevSet)
+{
+  (void)set;
+  (void)prevSet;
+  return ENOTSUP;
+}
+
+WRes CpuTopology_Detect(CCpuTopology *p)
+{
+  CCpuSet set;
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long i;
+  CpuSet_Zero(&set);
+  for (i = 0; i < numCpus; i++)
+    CpuSet_Add(&set, (unsigned)i);
+  p->numCpus = 0;
+  p->numNodes = 0;
+  CpuTopology_AddNode(p, 0, &set, NULL);
+  return 0;
+}
+
+#endif
+
+#endif
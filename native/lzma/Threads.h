@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 
+#ifdef _WIN32
+
 typedef HANDLE CThread;
 #define Thread_Construct(p) *(p) = NULL
 #define Thread_WasCreated(p) (*(p) != NULL)
@@ -21,18 +23,32 @@ typedef unsigned THREAD_FUNC_RET_TYPE;
 typedef THREAD_FUNC_RET_TYPE (THREAD_FUNC_CALL_TYPE * THREAD_FUNC_TYPE)(void *);
 WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, LPVOID param);
 
-typedef HANDLE CEvent;
+/* the state is a user-space word, the handle only parks waiters (see Wait spinning) */
+typedef struct
+{
+  HANDLE _h;
+  volatile LONG _state;
+  volatile LONG _waiters;
+  volatile UInt32 _spin; /* adaptive spin budget, 0 - not adapted yet */
+} CEvent;
 typedef CEvent CAutoResetEvent;
-#define Event_Construct(p) *(p) = NULL
-#define Event_IsCreated(p) (*(p) != NULL)
+#define Event_Construct(p) (p)->_h = NULL
+#define Event_IsCreated(p) ((p)->_h != NULL)
 void Event_Close(CEvent *p);
 WRes Event_Wait(CEvent *p);
 WRes Event_Set(CEvent *p);
 WRes Event_Reset(CEvent *p);
 WRes AutoResetEvent_CreateNotSignaled(CAutoResetEvent *p);
 
-typedef HANDLE CSemaphore;
-#define Semaphore_Construct(p) (*p) = NULL
+typedef struct
+{
+  HANDLE _h;
+  volatile LONG _count;
+  volatile LONG _waiters;
+  volatile UInt32 _spin;
+  UInt32 _maxCount;
+} CSemaphore;
+#define Semaphore_Construct(p) (p)->_h = NULL
 void Semaphore_Close(CSemaphore *p);
 WRes Semaphore_Wait(CSemaphore *p);
 WRes Semaphore_Create(CSemaphore *p, UInt32 initCount, UInt32 maxCount);
@@ -44,6 +60,154 @@ void CriticalSection_Delete(CCriticalSection *p);
 void CriticalSection_Enter(CCriticalSection *p);
 void CriticalSection_Leave(CCriticalSection *p);
 
+/* sequentially consistent loads, stores and compare-exchange for lock-free handoffs;
+   Atomic_CompareExchange32 returns nonzero if *p was expected and is now desired */
+#define Atomic_Load32(p) ((UInt32)InterlockedCompareExchange((LONG volatile *)(p), 0, 0))
+#define Atomic_Store32(p, v) InterlockedExchange((LONG volatile *)(p), (LONG)(v))
+#define Atomic_CompareExchange32(p, expected, desired) \
+    ((UInt32)InterlockedCompareExchange((LONG volatile *)(p), (LONG)(desired), (LONG)(expected)) == (UInt32)(expected))
+#define Atomic_Load64(p) ((UInt64)InterlockedCompareExchange64((LONGLONG volatile *)(p), 0, 0))
+#define Atomic_Store64(p, v) InterlockedExchange64((LONGLONG volatile *)(p), (LONGLONG)(v))
+#define Thread_SpinPause() YieldProcessor()
+
+#else
+
+/* POSIX backend: pthreads for threads and critical sections, futex words for
+   events and semaphores (a shared mutex/condvar emulates the futex outside Linux). */
+
+#include <pthread.h>
+
+typedef void *LPVOID;
+
+typedef struct
+{
+  pthread_t _tid;
+  int _created;
+  int _joined;
+} CThread;
+#define Thread_Construct(p) ((p)->_created = 0, (p)->_joined = 0)
+#define Thread_WasCreated(p) ((p)->_created != 0)
+void Thread_Close(CThread *p);
+WRes Thread_Wait(CThread *p);
+typedef unsigned THREAD_FUNC_RET_TYPE;
+#define THREAD_FUNC_CALL_TYPE MY_STD_CALL
+#define THREAD_FUNC_DECL THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE
+typedef THREAD_FUNC_RET_TYPE (THREAD_FUNC_CALL_TYPE * THREAD_FUNC_TYPE)(void *);
+WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, LPVOID param);
+
+typedef struct
+{
+  volatile int _state;
+  volatile int _waiters;
+  volatile UInt32 _spin; /* adaptive spin budget, 0 - not adapted yet */
+  int _created;
+} CEvent;
+typedef CEvent CAutoResetEvent;
+#define Event_Construct(p) (p)->_created = 0
+#define Event_IsCreated(p) ((p)->_created != 0)
+void Event_Close(CEvent *p);
+WRes Event_Wait(CEvent *p);
+WRes Event_Set(CEvent *p);
+WRes Event_Reset(CEvent *p);
+WRes AutoResetEvent_CreateNotSignaled(CAutoResetEvent *p);
+
+typedef struct
+{
+  volatile int _count;
+  volatile int _waiters;
+  volatile UInt32 _spin;
+  UInt32 _maxCount;
+  int _created;
+} CSemaphore;
+#define Semaphore_Construct(p) (p)->_created = 0
+void Semaphore_Close(CSemaphore *p);
+WRes Semaphore_Wait(CSemaphore *p);
+WRes Semaphore_Create(CSemaphore *p, UInt32 initCount, UInt32 maxCount);
+WRes Semaphore_Release1(CSemaphore *p);
+
+typedef pthread_mutex_t CCriticalSection;
+WRes CriticalSection_Init(CCriticalSection *p);
+void CriticalSection_Delete(CCriticalSection *p);
+void CriticalSection_Enter(CCriticalSection *p);
+void CriticalSection_Leave(CCriticalSection *p);
+
+#define Atomic_Load32(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define Atomic_Store32(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define Atomic_CompareExchange32(p, expected, desired) __sync_bool_compare_and_swap((p), (expected), (desired))
+#define Atomic_Load64(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define Atomic_Store64(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#if defined(__i386__) || defined(__x86_64__)
+#define Thread_SpinPause() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define Thread_SpinPause() __asm__ __volatile__("yield")
+#else
+#define Thread_SpinPause() ((void)0)
+#endif
+
+#endif
+
+/* ---------- Wait spinning ---------- */
+
+/* Event_Wait and Semaphore_Wait spin before they block, because the handoffs between
+   coder threads are often satisfied within microseconds. They spin on the user-space state
+   of the object (no system call) and block on a futex (POSIX) or a kernel object (Windows)
+   only after the spin. Every event and semaphore adapts its own budget: it keeps spinning
+   up to the limit while waits end during the spin, and halves its budget (down to 1/16 of
+   the limit) after a wait that had to block. Thread_SetWaitSpin sets the limit
+   in pause iterations, 0 disables spinning. The default is THREAD_WAIT_SPIN_DEFAULT, and 0
+   in traced builds. Traced builds and builds with ENABLE_WAIT_COUNTERS count every wait
+   with TraceCountWait (see Trace.h). */
+
+#define THREAD_WAIT_SPIN_DEFAULT (1 << 12)
+
+void Thread_SetWaitSpin(UInt32 maxSpinCount);
+UInt32 Thread_GetWaitSpin(void);
+
+/* ---------- CPU affinity ---------- */
+
+/* CCpuSet is a bit set of cpu numbers below CPU_SET_MAX_CPUS.
+   Thread_SetAffinity binds the calling thread to set and returns its previous set in prevSet
+   (may be NULL). On Windows only the processor group of the thread (64 cpus) is used. */
+
+#define CPU_SET_MAX_CPUS 1024
+
+typedef struct
+{
+  UInt32 bits[CPU_SET_MAX_CPUS / 32];
+} CCpuSet;
+
+void CpuSet_Zero(CCpuSet *p);
+void CpuSet_Add(CCpuSet *p, unsigned cpu);
+Bool CpuSet_Contains(const CCpuSet *p, unsigned cpu);
+
+/* A new thread starts on the cpus of the thread that creates it (Thread_Create copies them on Windows). */
+WRes Thread_GetAffinity(CCpuSet *set);
+WRes Thread_SetAffinity(const CCpuSet *set, CCpuSet *prevSet);
+
+/* CCpuTopology lists the cpus the process may run on, grouped by NUMA node:
+   all cpus of a node are adjacent in cpus[] and nodes[] holds the node number of each of them.
+   CpuTopology_Detect reads the nodes of the machine (a machine without NUMA is one node).
+   CpuTopology_Parse builds a fake topology from a list like "0-3,8;4-7" (';' separates
+   the nodes, which are numbered from 0), so that placement can be exercised on a single node;
+   a cpu may be listed in several fake nodes. It returns SZ_ERROR_PARAM for a malformed list. */
+
+#define CPU_TOPOLOGY_MAX_CPUS CPU_SET_MAX_CPUS
+
+typedef struct _CCpuTopology
+{
+  unsigned numCpus;
+  unsigned numNodes;
+  UInt16 cpus[CPU_TOPOLOGY_MAX_CPUS];
+  UInt16 nodes[CPU_TOPOLOGY_MAX_CPUS];
+} CCpuTopology;
+
+WRes CpuTopology_Detect(CCpuTopology *p);
+SRes CpuTopology_Parse(CCpuTopology *p, const char *s);
+
+/* CpuTopology_GetNode returns the range of cpus[] that belongs to the node with index nodeIndex
+   (0 <= nodeIndex < numNodes) and the node number of that node. */
+unsigned CpuTopology_GetNode(const CCpuTopology *p, unsigned nodeIndex, unsigned *firstIndex, unsigned *numCpus);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,7 +4,7 @@
 #ifndef __7Z_TYPES_H
 #define __7Z_TYPES_H
 
-#include "../trace.h"
+#include "../Trace.h"
 
 #include <stddef.h>
 
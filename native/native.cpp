@@ -1,7 +1,19 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "native.h"
 #include "lzma/LzmaLib.h"
 #include "lzma/Lzma2Enc.h"
 #include "lzma/Lzma2Dec.h"
+#include "lzma/Lzma2DecMt.h"
+#include "lzma/Lzma2Index.h"
+#include "lzma/LzmaDecPool.h"
+#include "lzma/LzmaDecBatch.h"
+#include "lzma/EncStream.h"
+#include "lzma/7zCrc.h"
+#include "lzma/LzFind.h"
+#include "lzma/MtCoder.h"
+#include "lzma/Alloc.h"
 
 static void *SzAlloc(void *p, size_t size)
 {
@@ -14,6 +26,198 @@ static void SzFree(void *p, void *address)
 }
 static ISzAlloc g_Alloc = { SzAlloc, SzFree };
 
+struct NativeThreadPool
+{
+	CThreadPool pool;
+};
+
+static NativeThreadPool *g_ThreadPool = NULL;
+
+static CThreadPool *GetThreadPool()
+{
+	return g_ThreadPool ? &g_ThreadPool->pool : NULL;
+}
+
+NativeThreadPool *NativeCreateThreadPool()
+{
+	NativeThreadPool *p = new NativeThreadPool;
+	ThreadPool_Construct(&p->pool);
+	if(ThreadPool_Create(&p->pool, &g_Alloc) != SZ_OK)
+	{
+		ThreadPool_Destruct(&p->pool);
+		delete p;
+		return NULL;
+	}
+	return p;
+}
+
+void NativeDestroyThreadPool(NativeThreadPool *pool)
+{
+	if(pool == NULL)
+		return;
+	if(g_ThreadPool == pool)
+		g_ThreadPool = NULL;
+	ThreadPool_Destruct(&pool->pool);
+	delete pool;
+}
+
+void NativeSetThreadPool(NativeThreadPool *pool)
+{
+	g_ThreadPool = pool;
+}
+
+static CLargePageAlloc g_LargePageAlloc;
+static ISzAlloc *g_AllocBig = &g_Alloc;
+
+void NativeSetLargePageAlloc(bool enable)
+{
+	if(enable)
+	{
+		LargePageAlloc_Construct(&g_LargePageAlloc);
+		g_AllocBig = &g_LargePageAlloc.funcTable;
+	}
+	else
+	{
+		g_AllocBig = &g_Alloc;
+	}
+}
+
+unsigned NativeGetLargePageAllocBackings()
+{
+	return g_AllocBig == &g_Alloc ? 0 : g_LargePageAlloc.usedBackings;
+}
+
+static CCpuTopology g_Topology;
+static CCpuTopology *g_CpuTopology = NULL;
+static CMtPlacement g_Placement[NUM_MT_CODER_THREADS_MAX];
+static unsigned g_NumPlacement = 0;
+
+// Compressions on other threads replace the placement while it is read, so both globals are guarded.
+static CCriticalSection g_PlacementLock;
+
+static bool CreatePlacementLock()
+{
+	return CriticalSection_Init(&g_PlacementLock) == 0;
+}
+
+static const bool g_PlacementLockCreated = CreatePlacementLock();
+
+bool NativeSetCpuTopology(bool enable, const char *topology)
+{
+	g_CpuTopology = NULL;
+	if(!enable)
+		return true;
+	if(topology != NULL ? CpuTopology_Parse(&g_Topology, topology) != SZ_OK : CpuTopology_Detect(&g_Topology) != 0)
+		return false;
+	g_CpuTopology = &g_Topology;
+	return true;
+}
+
+int NativeGetCpuPlacement(NativeCpuPlacement *items, int maxItems)
+{
+	CriticalSection_Enter(&g_PlacementLock);
+	int count = (int)g_NumPlacement;
+	for(int i = 0; i < count && i < maxItems; i++)
+	{
+		items[i].node = (int)g_Placement[i].node;
+		items[i].firstCpu = (int)g_Placement[i].firstCpu;
+		items[i].numCpus = (int)g_Placement[i].numCpus;
+		items[i].pinned = g_Placement[i].pinRes == 0;
+	}
+	CriticalSection_Leave(&g_PlacementLock);
+	return count;
+}
+
+// The match finders extend matches and normalize positions with the fastest kernels of the cpu
+// (see LzFind.h). They are selected once when the library is loaded, before any encoder runs.
+static bool SelectMatchFinderKernels()
+{
+	LzFind_SetMatchLenKernel(LzFind_GetDefaultMatchLenKernel());
+	LzFind_SetNormalizeKernel(LzFind_GetDefaultNormalizeKernel());
+	return true;
+}
+
+static const bool g_MatchFinderKernelsSelected = SelectMatchFinderKernels();
+
+static int g_DecoderThreads = 0;
+static int g_EncoderHashThreads = 1;
+
+void NativeSetDecoderThreads(int numThreads)
+{
+	g_DecoderThreads = numThreads;
+}
+
+void NativeSetEncoderHashThreads(int numHashThreads)
+{
+	g_EncoderHashThreads = numHashThreads;
+}
+
+static unsigned DetectNumCpus()
+{
+	CCpuTopology *topology = new CCpuTopology;
+	unsigned numCpus = CpuTopology_Detect(topology) == 0 && topology->numCpus != 0 ? topology->numCpus : 1;
+	delete topology;
+	return numCpus;
+}
+
+static unsigned GetDecoderThreads()
+{
+	static const unsigned kNumCpus = DetectNumCpus();
+	return g_DecoderThreads > 0 ? (unsigned)g_DecoderThreads : kNumCpus;
+}
+
+static CLzmaDecPool *CreateDecoderPool()
+{
+	CLzmaDecPool *pool = new CLzmaDecPool;
+	if(LzmaDecPool_Create(pool, &g_Alloc) != 0)
+	{
+		delete pool;
+		return NULL;
+	}
+	return pool;
+}
+
+static CLzmaDecPool *GetDecoderPool()
+{
+	static CLzmaDecPool *const kPool = CreateDecoderPool();
+	return kPool;
+}
+
+// The CRC decoders stop after every step of this size and checksum the step in a separate pass while its
+// output is still in the cache, instead of in one pass over the whole output at the end.
+static const size_t kCrcStepSize = 1 << 17;
+
+static bool CreateCrcTable()
+{
+	CrcGenerateTable();
+	return true;
+}
+
+static void InitCrcTable()
+{
+	static const bool kInitialized = CreateCrcTable();
+	(void)kInitialized;
+}
+
+void NativeSetDecoderPoolSize(int maxIdle)
+{
+	CLzmaDecPool *pool = GetDecoderPool();
+	if(pool != NULL)
+		LzmaDecPool_SetMaxIdle(pool, maxIdle > 0 ? (unsigned)maxIdle : 0);
+}
+
+void NativeGetDecoderPoolCounters(NativeDecoderPoolCounters *counters)
+{
+	UInt64 hits = 0, misses = 0;
+	unsigned idle = 0;
+	CLzmaDecPool *pool = GetDecoderPool();
+	if(pool != NULL)
+		LzmaDecPool_GetCounters(pool, &hits, &misses, &idle);
+	counters->hits = hits;
+	counters->misses = misses;
+	counters->idle = (int)idle;
+}
+
 struct OutContext
 	: public ISeqOutStream
 {
@@ -106,7 +310,11 @@ ResultCode NativeLzmaCompressMemory_V1(unsigned char *dest, size_t *destLen, con
 ResultCode NativeLzmaCompressStream(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t srcLen, unsigned char *outProps, size_t *outPropsSize,
 	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads)
 {
+	ISzAlloc *allocBig = g_AllocBig;
 	CLzmaEncHandle handle = LzmaEnc_Create(&g_Alloc);
+	if(handle == NULL)
+		return ErrorCode_Memory;
+	LzmaEnc_SetThreadPool(handle, GetThreadPool());
 	CLzmaEncProps props;
 	LzmaEncProps_Init(&props);
 	props.level = level;
@@ -121,19 +329,20 @@ ResultCode NativeLzmaCompressStream(unsigned char *dest, size_t *destLen, const
 	props.mc = mc;
 	props.writeEndMark = endMark;
 	props.numThreads = numThreads;
+	props.numHashThreads = g_EncoderHashThreads;
 	SRes res = LzmaEnc_SetProps(handle, &props);
 	if(res == SZ_OK)
 	{
 		OutContext oc(NativeLzmaCompress2_Write, dest, *destLen);
 		InContext ic(NativeLzmaCompress2_Read, src, srcLen);
-		res = LzmaEnc_Encode(handle, &oc, &ic, NULL, &g_Alloc, &g_Alloc);
+		res = LzmaEnc_Encode(handle, &oc, &ic, NULL, &g_Alloc, allocBig);
 		if(res == SZ_OK)
 		{
 			*destLen = oc.offset;
 			res = LzmaEnc_WriteProperties(handle, outProps, outPropsSize);
 		}
 	}
-	LzmaEnc_Destroy(handle, &g_Alloc, &g_Alloc);
+	LzmaEnc_Destroy(handle, &g_Alloc, allocBig);
 	return GetEncoderResult(res);
 }
 
@@ -142,28 +351,60 @@ ResultCode NativeLzmaUncompress(unsigned char *dest, size_t *destLen, const unsi
 	return GetDecoderResult(LzmaUncompress(dest, destLen, src, srcLen, props, propsSize));
 }
 
-ResultCode NativeLzmaUncompress_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark)
+ResultCode NativeLzmaUncompressBatch(NativeLzmaBatchItem *items, int numItems)
 {
-	SRes res;
-	CLzmaDec dec;
-	LzmaDec_Construct(&dec);
-	res = LzmaDec_Allocate(&dec, props, propsSize, &g_Alloc);
-	if(res != SZ_OK)
-		return ErrorCode_Unknown;
-	LzmaDec_Init(&dec);
+	if(numItems <= 0)
+		return StatusCode_Ok;
+	CLzmaDecBatchItem *batch = (CLzmaDecBatchItem *)malloc(numItems * sizeof(CLzmaDecBatchItem));
+	if(batch == NULL)
+		return ErrorCode_Memory;
+	for(int i = 0; i < numItems; i++)
+	{
+		batch[i].dest = items[i].dest;
+		batch[i].destLen = items[i].destLen;
+		batch[i].src = items[i].src;
+		batch[i].srcLen = items[i].srcLen;
+		batch[i].props = items[i].props;
+		batch[i].propsSize = (unsigned)items[i].propsSize;
+	}
+	SRes res = LzmaDecBatch_Decode(batch, numItems, LZMA_FINISH_ANY, GetDecoderThreads(), GetThreadPool(), &g_Alloc);
+	if(res == SZ_OK)
+	{
+		for(int i = 0; i < numItems; i++)
+		{
+			items[i].destLen = batch[i].destLen;
+			items[i].srcLen = batch[i].srcLen;
+			items[i].result = GetDecoderResult(batch[i].res);
+		}
+	}
+	free(batch);
+	return GetDecoderResult(res);
+}
 
+// With crc, the output is decoded in steps of kCrcStepSize and *crc is updated after every step.
+static ResultCode LzmaUncompress_V1(CLzmaDec *dec, unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, bool endMark, UInt32 *crc)
+{
+	SRes res;
 	SizeT writtenTotal = 0;
 	SizeT usedTotal = 0;
 	for(;;)
 	{
 		SizeT written = *destLen;
 		SizeT used = *srcLen;
+		ELzmaFinishMode finishMode = LZMA_FINISH_END;
+		if(crc != NULL && written > kCrcStepSize)
+		{
+			written = kCrcStepSize;
+			finishMode = LZMA_FINISH_ANY;
+		}
 
 		ELzmaStatus status;
-		res = LzmaDec_DecodeToBuf(&dec, dest, &written, src, &used, LZMA_FINISH_END, &status);
+		res = LzmaDec_DecodeToDest(dec, dest, &written, src, &used, finishMode, &status);
 		if(res != SZ_OK)
 			return ErrorCode_Unknown;
 
+		if(crc != NULL)
+			*crc = CrcUpdate(*crc, dest, written);
 		writtenTotal += written;
 		dest += written;
 		*destLen -= written;
@@ -174,6 +415,10 @@ ResultCode NativeLzmaUncompress_V1(unsigned char *dest, size_t *destLen, const u
 		if(status == LZMA_STATUS_NEEDS_MORE_INPUT || status == LZMA_STATUS_NOT_FINISHED)
 			continue;
 
+		// the end of a step may look like the end of a stream without end mark
+		if(finishMode == LZMA_FINISH_ANY && status == LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
+			continue;
+
 		if(status == LZMA_STATUS_FINISHED_WITH_MARK)
 		{
 			if(endMark)
@@ -191,18 +436,49 @@ ResultCode NativeLzmaUncompress_V1(unsigned char *dest, size_t *destLen, const u
 		return ErrorCode_Unknown;
 	}
 
-	LzmaDec_Free(&dec, &g_Alloc);
-
 	*destLen = writtenTotal;
 	*srcLen = usedTotal;
 
 	return StatusCode_Ok;
 }
 
+static ResultCode LzmaUncompress_Pooled(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark, UInt32 *crc)
+{
+	CLzmaDecPool *pool = GetDecoderPool();
+	if(pool == NULL)
+		return ErrorCode_Threading;
+	// dest is the dictionary, see LzmaDec_DecodeToDest
+	CLzmaDecPoolItem *item;
+	if(LzmaDecPool_AcquireLzma(pool, props, (unsigned)propsSize, False, g_AllocBig, &item) != SZ_OK)
+		return ErrorCode_Unknown;
+	LzmaDec_Init(&item->dec.decoder);
+	ResultCode result = LzmaUncompress_V1(&item->dec.decoder, dest, destLen, src, srcLen, endMark, crc);
+	LzmaDecPool_Release(pool, item);
+	return result;
+}
+
+ResultCode NativeLzmaUncompress_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark)
+{
+	return LzmaUncompress_Pooled(dest, destLen, src, srcLen, props, propsSize, endMark, NULL);
+}
+
+ResultCode NativeLzmaUncompressWithCrc(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark, unsigned *crc)
+{
+	InitCrcTable();
+	UInt32 value = CRC_INIT_VAL;
+	ResultCode result = LzmaUncompress_Pooled(dest, destLen, src, srcLen, props, propsSize, endMark, &value);
+	*crc = CRC_GET_DIGEST(value);
+	return result;
+}
+
 ResultCode NativeLzmaCompress2(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t srcLen, unsigned char *outProp,
 	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads, int blockSize, int blockThreads, int totalThreads)
 {
-	CLzma2EncHandle handle = Lzma2Enc_Create(&g_Alloc, &g_Alloc);
+	CLzma2EncHandle handle = Lzma2Enc_Create(&g_Alloc, g_AllocBig);
+	if(handle == NULL)
+		return ErrorCode_Memory;
+	Lzma2Enc_SetThreadPool(handle, GetThreadPool());
+	Lzma2Enc_SetTopology(handle, g_CpuTopology);
 	CLzma2EncProps props;
 	Lzma2EncProps_Init(&props);
 	props.lzmaProps.level = level;
@@ -217,6 +493,7 @@ ResultCode NativeLzmaCompress2(unsigned char *dest, size_t *destLen, const unsig
 	props.lzmaProps.mc = mc;
 	props.lzmaProps.writeEndMark = endMark;
 	props.lzmaProps.numThreads = numThreads;
+	props.lzmaProps.numHashThreads = g_EncoderHashThreads;
 	props.blockSize = blockSize;
 	props.numBlockThreads = blockThreads;
 	props.numTotalThreads = totalThreads;
@@ -226,6 +503,9 @@ ResultCode NativeLzmaCompress2(unsigned char *dest, size_t *destLen, const unsig
 		OutContext oc(NativeLzmaCompress2_Write, dest, *destLen);
 		InContext ic(NativeLzmaCompress2_Read, src, srcLen);
 		res = Lzma2Enc_Encode(handle, &oc, &ic, NULL);
+		CriticalSection_Enter(&g_PlacementLock);
+		g_NumPlacement = Lzma2Enc_GetPlacement(handle, g_Placement, NUM_MT_CODER_THREADS_MAX);
+		CriticalSection_Leave(&g_PlacementLock);
 		*destLen = oc.offset;
 		*outProp = Lzma2Enc_WriteProperties(handle);
 	}
@@ -236,7 +516,8 @@ ResultCode NativeLzmaCompress2(unsigned char *dest, size_t *destLen, const unsig
 ResultCode NativeLzmaUncompress2(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark)
 {
 	ELzmaStatus status;
-	SRes res = Lzma2Decode(dest, destLen, src, srcLen, prop, LZMA_FINISH_END, &status, &g_Alloc);
+	SRes res = Lzma2DecMt_Decode(dest, destLen, src, srcLen, prop, LZMA_FINISH_END, &status,
+		GetDecoderThreads(), GetThreadPool(), g_AllocBig);
 	switch(status)
 	{
 	case LZMA_STATUS_FINISHED_WITH_MARK:
@@ -261,27 +542,34 @@ ResultCode NativeLzmaUncompress2(unsigned char *dest, size_t *destLen, const uns
 	}
 }
 
-ResultCode NativeLzmaUncompress2_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark)
+// With crc, the output is decoded in steps of kCrcStepSize and *crc is updated after every step.
+static ResultCode Lzma2Uncompress_V1(CLzma2Dec *dec, unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, int endMark, UInt32 *crc)
 {
 	SRes res;
-	CLzma2Dec dec;
-	Lzma2Dec_Construct(&dec);
-	res = Lzma2Dec_Allocate(&dec, prop, &g_Alloc);
-	if(res != SZ_OK)
-		return ErrorCode_Unknown;
-	Lzma2Dec_Init(&dec);
 	SizeT writtenTotal = 0;
 	SizeT usedTotal = 0;
 	for(;;)
 	{
 		SizeT written = *destLen;
 		SizeT used = *srcLen;
+		ELzmaFinishMode finishMode = LZMA_FINISH_END;
+		if(crc != NULL && written > kCrcStepSize)
+		{
+			written = kCrcStepSize;
+			finishMode = LZMA_FINISH_ANY;
+		}
 
 		ELzmaStatus status;
-		res = Lzma2Dec_DecodeToBuf(&dec, dest, &written, src, &used, LZMA_FINISH_END, &status);
+#ifdef DISABLE_TRACE
+		res = Lzma2Dec_DecodeToDest(dec, dest, &written, src, &used, finishMode, &status);
+#else
+		res = Lzma2Dec_DecodeToBuf(dec, dest, &written, src, &used, finishMode, &status);
+#endif
 		if(res != SZ_OK)
 			return ErrorCode_Unknown;
 
+		if(crc != NULL)
+			*crc = CrcUpdate(*crc, dest, written);
 		writtenTotal += written;
 		dest += written;
 		*destLen -= written;
@@ -293,6 +581,10 @@ ResultCode NativeLzmaUncompress2_V1(unsigned char *dest, size_t *destLen, const
 		if(status == LZMA_STATUS_NOT_FINISHED || status == LZMA_STATUS_NEEDS_MORE_INPUT)
 			continue;
 
+		// the end of a step may look like the end of a stream without end mark
+		if(finishMode == LZMA_FINISH_ANY && status == LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
+			continue;
+
 		if(status == LZMA_STATUS_FINISHED_WITH_MARK)
 		{
 			if(!endMark)
@@ -309,8 +601,441 @@ ResultCode NativeLzmaUncompress2_V1(unsigned char *dest, size_t *destLen, const
 
 		return ErrorCode_Unknown;
 	}
-	Lzma2Dec_Free(&dec, &g_Alloc);
 	*destLen = writtenTotal;
 	*srcLen = usedTotal;
 	return StatusCode_Ok;
 }
+
+static ResultCode Lzma2Uncompress_Pooled(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark, UInt32 *crc)
+{
+	CLzmaDecPool *pool = GetDecoderPool();
+	if(pool == NULL)
+		return ErrorCode_Threading;
+#ifdef DISABLE_TRACE
+	// dest is the dictionary, see Lzma2Dec_DecodeToDest; traced builds keep the dictionary ring,
+	// whose positions are part of the trace
+	const Bool withDic = False;
+#else
+	const Bool withDic = True;
+#endif
+	CLzmaDecPoolItem *item;
+	if(LzmaDecPool_AcquireLzma2(pool, prop, withDic, g_AllocBig, &item) != SZ_OK)
+		return ErrorCode_Unknown;
+	Lzma2Dec_Init(&item->dec);
+	ResultCode result = Lzma2Uncompress_V1(&item->dec, dest, destLen, src, srcLen, endMark, crc);
+	LzmaDecPool_Release(pool, item);
+	return result;
+}
+
+ResultCode NativeLzmaUncompress2_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark)
+{
+	return Lzma2Uncompress_Pooled(dest, destLen, src, srcLen, prop, endMark, NULL);
+}
+
+ResultCode NativeLzmaUncompress2WithCrc(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark, unsigned *crc)
+{
+	InitCrcTable();
+	UInt32 value = CRC_INIT_VAL;
+	ResultCode result = Lzma2Uncompress_Pooled(dest, destLen, src, srcLen, prop, endMark, &value);
+	*crc = CRC_GET_DIGEST(value);
+	return result;
+}
+
+ResultCode NativeLzma2BuildIndex(unsigned char *index, size_t *indexLen, const unsigned char *src, size_t srcLen, unsigned char prop)
+{
+	CLzma2Index p;
+	Lzma2Index_Construct(&p);
+	SRes res = Lzma2Index_Build(&p, src, srcLen, prop, &g_Alloc);
+	if(res == SZ_OK)
+	{
+		size_t size = Lzma2Index_GetSerializedSize(&p);
+		if(size > *indexLen)
+			res = SZ_ERROR_OUTPUT_EOF;
+		else
+			Lzma2Index_Serialize(&p, index);
+		*indexLen = size;
+	}
+	Lzma2Index_Free(&p, &g_Alloc);
+	return res == SZ_ERROR_OUTPUT_EOF ? ErrorCode_OutputEnd : GetDecoderResult(res);
+}
+
+ResultCode NativeLzma2ReadRange(unsigned char *dest, size_t *destLen, unsigned long long offset, const unsigned char *src, size_t srcLen,
+	const unsigned char *index, size_t indexLen)
+{
+	CLzma2Index p;
+	Lzma2Index_Construct(&p);
+	SRes res = Lzma2Index_Deserialize(&p, index, indexLen, &g_Alloc);
+	if(res == SZ_OK)
+		res = Lzma2Index_Read(&p, src, srcLen, offset, dest, destLen, g_AllocBig);
+	else
+		*destLen = 0;
+	Lzma2Index_Free(&p, &g_Alloc);
+	return GetDecoderResult(res);
+}
+
+struct NativeStream
+{
+	bool encoder;
+	bool lzma2;
+	unsigned long long consumed;
+	unsigned long long produced;
+
+	// encoders
+	CLzmaEncHandle lzmaEnc;
+	CLzma2EncHandle lzma2Enc;
+	ISzAlloc *allocBig;
+	CEncStream enc;
+
+	// decoders
+	CLzma2Dec dec; // LZMA decoders use dec.decoder
+	unsigned char *inBuf;
+	size_t inPos;
+	size_t inLen;
+	bool ended;
+	bool finished;
+	SRes res;
+	bool crcEnabled;
+	UInt32 crc;
+};
+
+static const size_t kDecoderStreamBufSize = 1 << 16;
+
+// Streams also carry the encoder's parameter and threading errors, the rest maps as for decoders.
+static ResultCode GetStreamResult(SRes res)
+{
+	switch(res)
+	{
+	case SZ_ERROR_PARAM: return ErrorCode_Parameter;
+	case SZ_ERROR_THREAD: return ErrorCode_Threading;
+	default: return GetDecoderResult(res);
+	}
+}
+
+static NativeStream *NewStream(bool encoder, bool lzma2)
+{
+	NativeStream *s = new NativeStream;
+	s->encoder = encoder;
+	s->lzma2 = lzma2;
+	s->consumed = 0;
+	s->produced = 0;
+	s->lzmaEnc = NULL;
+	s->lzma2Enc = NULL;
+	s->allocBig = g_AllocBig;
+	EncStream_Construct(&s->enc);
+	Lzma2Dec_Construct(&s->dec);
+	s->inBuf = NULL;
+	s->inPos = 0;
+	s->inLen = 0;
+	s->ended = false;
+	s->finished = false;
+	s->res = SZ_OK;
+	s->crcEnabled = false;
+	s->crc = CRC_INIT_VAL;
+	return s;
+}
+
+ResultCode NativeLzmaEncoderCreate(NativeStream **stream, unsigned char *outProps, size_t *outPropsSize,
+	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads)
+{
+	*stream = NULL;
+	NativeStream *s = NewStream(true, false);
+	s->lzmaEnc = LzmaEnc_Create(&g_Alloc);
+	if(s->lzmaEnc == NULL)
+	{
+		NativeStreamDestroy(s);
+		return ErrorCode_Memory;
+	}
+	LzmaEnc_SetThreadPool(s->lzmaEnc, GetThreadPool());
+	CLzmaEncProps props;
+	LzmaEncProps_Init(&props);
+	props.level = level;
+	props.dictSize = dictSize;
+	props.lc = lc;
+	props.lp = lp;
+	props.pb = pb;
+	props.algo = algo;
+	props.fb = fb;
+	props.btMode = btMode;
+	props.numHashBytes = numHashBytes;
+	props.mc = mc;
+	props.writeEndMark = endMark;
+	props.numThreads = numThreads;
+	props.numHashThreads = g_EncoderHashThreads;
+	SRes res = LzmaEnc_SetProps(s->lzmaEnc, &props);
+	if(res == SZ_OK)
+		res = LzmaEnc_WriteProperties(s->lzmaEnc, outProps, outPropsSize);
+	if(res == SZ_OK)
+		res = EncStream_Create(&s->enc, s->lzmaEnc, NULL, ENC_STREAM_BUF_SIZE_DEFAULT, &g_Alloc, s->allocBig);
+	if(res != SZ_OK)
+	{
+		NativeStreamDestroy(s);
+		return GetStreamResult(res);
+	}
+	*stream = s;
+	return StatusCode_Ok;
+}
+
+ResultCode NativeLzma2EncoderCreate(NativeStream **stream, unsigned char *outProp,
+	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, int numThreads, int blockSize, int blockThreads, int totalThreads)
+{
+	*stream = NULL;
+	NativeStream *s = NewStream(true, true);
+	s->lzma2Enc = Lzma2Enc_Create(&g_Alloc, s->allocBig);
+	if(s->lzma2Enc == NULL)
+	{
+		NativeStreamDestroy(s);
+		return ErrorCode_Memory;
+	}
+	Lzma2Enc_SetThreadPool(s->lzma2Enc, GetThreadPool());
+	CLzma2EncProps props;
+	Lzma2EncProps_Init(&props);
+	props.lzmaProps.level = level;
+	props.lzmaProps.dictSize = dictSize;
+	props.lzmaProps.lc = lc;
+	props.lzmaProps.lp = lp;
+	props.lzmaProps.pb = pb;
+	props.lzmaProps.algo = algo;
+	props.lzmaProps.fb = fb;
+	props.lzmaProps.btMode = btMode;
+	props.lzmaProps.numHashBytes = numHashBytes;
+	props.lzmaProps.mc = mc;
+	props.lzmaProps.numThreads = numThreads;
+	props.lzmaProps.numHashThreads = g_EncoderHashThreads;
+	props.blockSize = blockSize;
+	props.numBlockThreads = blockThreads;
+	props.numTotalThreads = totalThreads;
+	SRes res = Lzma2Enc_SetProps(s->lzma2Enc, &props);
+	if(res == SZ_OK)
+	{
+		*outProp = Lzma2Enc_WriteProperties(s->lzma2Enc);
+		res = EncStream_Create(&s->enc, NULL, s->lzma2Enc, ENC_STREAM_BUF_SIZE_DEFAULT, &g_Alloc, s->allocBig);
+	}
+	if(res != SZ_OK)
+	{
+		NativeStreamDestroy(s);
+		return GetStreamResult(res);
+	}
+	*stream = s;
+	return StatusCode_Ok;
+}
+
+ResultCode NativeLzmaDecoderCreate(NativeStream **stream, const unsigned char *props, size_t propsSize)
+{
+	*stream = NULL;
+	NativeStream *s = NewStream(false, false);
+	SRes res = LzmaDec_Allocate(&s->dec.decoder, props, (unsigned)propsSize, s->allocBig);
+	if(res == SZ_OK)
+	{
+		s->inBuf = (unsigned char *)malloc(kDecoderStreamBufSize);
+		if(s->inBuf == NULL)
+			res = SZ_ERROR_MEM;
+	}
+	if(res != SZ_OK)
+	{
+		NativeStreamDestroy(s);
+		return GetStreamResult(res);
+	}
+	LzmaDec_Init(&s->dec.decoder);
+	*stream = s;
+	return StatusCode_Ok;
+}
+
+ResultCode NativeLzma2DecoderCreate(NativeStream **stream, unsigned char prop)
+{
+	*stream = NULL;
+	NativeStream *s = NewStream(false, true);
+	SRes res = Lzma2Dec_Allocate(&s->dec, prop, s->allocBig);
+	if(res == SZ_OK)
+	{
+		s->inBuf = (unsigned char *)malloc(kDecoderStreamBufSize);
+		if(s->inBuf == NULL)
+			res = SZ_ERROR_MEM;
+	}
+	if(res != SZ_OK)
+	{
+		NativeStreamDestroy(s);
+		return GetStreamResult(res);
+	}
+	Lzma2Dec_Init(&s->dec);
+	*stream = s;
+	return StatusCode_Ok;
+}
+
+ResultCode NativeStreamFeed(NativeStream *stream, const unsigned char *src, size_t *srcLen)
+{
+	if(stream->encoder)
+	{
+		SRes res = EncStream_Feed(&stream->enc, src, srcLen);
+		stream->consumed += *srcLen;
+		return GetStreamResult(res);
+	}
+	if(stream->ended)
+	{
+		*srcLen = 0;
+		return ErrorCode_Parameter;
+	}
+	if(stream->inPos != 0)
+	{
+		memmove(stream->inBuf, stream->inBuf + stream->inPos, stream->inLen - stream->inPos);
+		stream->inLen -= stream->inPos;
+		stream->inPos = 0;
+	}
+	*srcLen = min_(*srcLen, kDecoderStreamBufSize - stream->inLen);
+	memcpy(stream->inBuf + stream->inLen, src, *srcLen);
+	stream->inLen += *srcLen;
+	return GetStreamResult(stream->res);
+}
+
+// An LZMA stream without an end mark just stops after its last symbol. The decoder cannot tell that from
+// truncated input by itself (it reports LZMA_STATUS_NEEDS_MORE_INPUT), but after the last symbol no match
+// is pending, no partial input is buffered and the range coder has been drained to zero.
+static bool IsLzmaFinishedWithoutMark(const CLzmaDec *dec)
+{
+	return dec->remainLen == 0 && dec->tempBufSize == 0 && dec->code == 0 && !dec->needFlush;
+}
+
+// Accounts for one decoder call of NativeStreamDrain or NativeStreamSkip that used inLen bytes of the input
+// buffer and produced outLen bytes. Returns false when the caller has to stop: on an error, or when the
+// decoder made no progress and needs more input.
+static bool DecoderStreamStep(NativeStream *stream, SizeT inLen, SizeT outLen, ELzmaStatus status)
+{
+	stream->inPos += inLen;
+	stream->consumed += inLen;
+	if(stream->res != SZ_OK)
+		return false;
+
+	// after NativeStreamEnd the buffered input is all there is
+	bool noMoreInput = stream->ended && stream->inPos == stream->inLen;
+	if(status == LZMA_STATUS_FINISHED_WITH_MARK || (noMoreInput && status == LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK))
+		stream->finished = true;
+	else if(noMoreInput && status == LZMA_STATUS_NEEDS_MORE_INPUT && !stream->lzma2 && IsLzmaFinishedWithoutMark(&stream->dec.decoder))
+		stream->finished = true;
+	else if(noMoreInput && status == LZMA_STATUS_NEEDS_MORE_INPUT)
+		stream->res = SZ_ERROR_INPUT_EOF;
+	else if(inLen == 0 && outLen == 0)
+		return false;
+	return true;
+}
+
+ResultCode NativeStreamDrain(NativeStream *stream, unsigned char *dest, size_t *destLen, bool *finished)
+{
+	if(stream->encoder)
+	{
+		Bool encoderFinished;
+		SRes res = EncStream_Drain(&stream->enc, dest, destLen, &encoderFinished);
+		stream->produced += *destLen;
+		*finished = encoderFinished != 0;
+		return GetStreamResult(res);
+	}
+
+	size_t capacity = *destLen;
+	*destLen = 0;
+	while(stream->res == SZ_OK && !stream->finished && *destLen < capacity)
+	{
+		SizeT outLen = capacity - *destLen;
+		if(stream->crcEnabled && outLen > kCrcStepSize)
+			outLen = kCrcStepSize;
+		SizeT inLen = stream->inLen - stream->inPos;
+		ELzmaStatus status;
+		if(stream->lzma2)
+			stream->res = Lzma2Dec_DecodeToBuf(&stream->dec, dest + *destLen, &outLen, stream->inBuf + stream->inPos, &inLen, LZMA_FINISH_ANY, &status);
+		else
+			stream->res = LzmaDec_DecodeToBuf(&stream->dec.decoder, dest + *destLen, &outLen, stream->inBuf + stream->inPos, &inLen, LZMA_FINISH_ANY, &status);
+		if(stream->crcEnabled)
+			stream->crc = CrcUpdate(stream->crc, dest + *destLen, outLen);
+		*destLen += outLen;
+		if(!DecoderStreamStep(stream, inLen, outLen, status))
+			break;
+	}
+	stream->produced += *destLen;
+	*finished = stream->finished;
+	return GetStreamResult(stream->res);
+}
+
+ResultCode NativeStreamSkip(NativeStream *stream, unsigned long long count, unsigned long long *skipped, bool *finished)
+{
+	*skipped = 0;
+	*finished = false;
+	if(stream->encoder)
+		return ErrorCode_Unsupported;
+
+	// decode into the dictionary only: dicLimit rolls through the ring and nothing is copied out
+	CLzmaDec *dic = &stream->dec.decoder;
+	while(stream->res == SZ_OK && !stream->finished && *skipped < count)
+	{
+		if(dic->dicPos == dic->dicBufSize)
+			dic->dicPos = 0;
+		SizeT outPos = dic->dicPos;
+		SizeT dicLimit = dic->dicBufSize;
+		if(count - *skipped < dicLimit - outPos)
+			dicLimit = outPos + (SizeT)(count - *skipped);
+		if(stream->crcEnabled && dicLimit - outPos > kCrcStepSize)
+			dicLimit = outPos + kCrcStepSize;
+		SizeT inLen = stream->inLen - stream->inPos;
+		ELzmaStatus status;
+		if(stream->lzma2)
+			stream->res = Lzma2Dec_DecodeToDic(&stream->dec, dicLimit, stream->inBuf + stream->inPos, &inLen, LZMA_FINISH_ANY, &status);
+		else
+			stream->res = LzmaDec_DecodeToDic(dic, dicLimit, stream->inBuf + stream->inPos, &inLen, LZMA_FINISH_ANY, &status);
+		SizeT outLen = dic->dicPos - outPos;
+		if(stream->crcEnabled)
+			stream->crc = CrcUpdate(stream->crc, dic->dic + outPos, outLen);
+		*skipped += outLen;
+		if(!DecoderStreamStep(stream, inLen, outLen, status))
+			break;
+	}
+	stream->produced += *skipped;
+	*finished = stream->finished;
+	return GetStreamResult(stream->res);
+}
+
+ResultCode NativeStreamFlush(NativeStream *stream)
+{
+	if(stream->encoder)
+		return GetStreamResult(EncStream_Flush(&stream->enc));
+	return GetStreamResult(stream->res);
+}
+
+ResultCode NativeStreamEnd(NativeStream *stream)
+{
+	if(stream->encoder)
+		return GetStreamResult(EncStream_End(&stream->enc));
+	stream->ended = true;
+	return GetStreamResult(stream->res);
+}
+
+ResultCode NativeStreamEnableCrc(NativeStream *stream)
+{
+	if(stream->encoder)
+		return ErrorCode_Unsupported;
+	if(stream->produced != 0)
+		return ErrorCode_Parameter;
+	InitCrcTable();
+	stream->crcEnabled = true;
+	return StatusCode_Ok;
+}
+
+unsigned NativeStreamGetCrc(NativeStream *stream)
+{
+	return CRC_GET_DIGEST(stream->crc);
+}
+
+void NativeStreamGetTotals(NativeStream *stream, unsigned long long *consumed, unsigned long long *produced)
+{
+	*consumed = stream->consumed;
+	*produced = stream->produced;
+}
+
+void NativeStreamDestroy(NativeStream *stream)
+{
+	if(stream == NULL)
+		return;
+	EncStream_Destruct(&stream->enc);
+	if(stream->lzmaEnc != NULL)
+		LzmaEnc_Destroy(stream->lzmaEnc, &g_Alloc, stream->allocBig);
+	if(stream->lzma2Enc != NULL)
+		Lzma2Enc_Destroy(stream->lzma2Enc);
+	LzmaDec_Free(&stream->dec.decoder, stream->allocBig);
+	free(stream->inBuf);
+	delete stream;
+}
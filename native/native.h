@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 enum ResultCode
 {
 	StatusCode_Ok,
@@ -20,9 +22,138 @@ ResultCode NativeLzmaCompressMemory_V1(unsigned char *dest, size_t *destLen, con
 ResultCode NativeLzmaCompressStream(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t srcLen, unsigned char *outProps, size_t *outPropsSize,
 	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads);
 ResultCode NativeLzmaUncompress(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize);
+// Decodes numItems independent streams like NativeLzmaUncompress in one call, on the decoder threads of
+// NativeSetDecoderThreads (see LzmaDecBatch.h). destLen and srcLen of every item are updated like those of
+// NativeLzmaUncompress and result is set to its result. Returns ErrorCode_Memory if the batch could not be
+// started, in which case no item was decoded, and StatusCode_Ok otherwise, also if some items failed.
+struct NativeLzmaBatchItem
+{
+	unsigned char *dest;
+	size_t destLen;
+	const unsigned char *src;
+	size_t srcLen;
+	const unsigned char *props;
+	size_t propsSize;
+	ResultCode result;
+};
+
+ResultCode NativeLzmaUncompressBatch(NativeLzmaBatchItem *items, int numItems);
 ResultCode NativeLzmaUncompress_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark);
 
 ResultCode NativeLzmaCompress2(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t srcLen, unsigned char *outProp,
 	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads, int blockSize, int blockThreads, int totalThreads);
 ResultCode NativeLzmaUncompress2(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark);
 ResultCode NativeLzmaUncompress2_V1(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark);
+
+// Same as NativeLzmaUncompress_V1 and NativeLzmaUncompress2_V1, and *crc is set to the CRC32 of the output
+// (as in 7z archives), also when the call fails. The output is decoded in steps of 128 KiB and each step is
+// checksummed in a separate pass right after it was decoded, while it is still in the cache, instead of one
+// pass over the whole output at the end.
+ResultCode NativeLzmaUncompressWithCrc(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, const unsigned char *props, size_t propsSize, bool endMark, unsigned *crc);
+ResultCode NativeLzmaUncompress2WithCrc(unsigned char *dest, size_t *destLen, const unsigned char *src, size_t *srcLen, unsigned char prop, int endMark, unsigned *crc);
+
+// Random access into LZMA2 streams (see Lzma2Index.h). NativeLzma2BuildIndex walks the chunk headers of src once
+// and writes the serialized chunk index, which can be cached next to the stream. *indexLen is the size of the buffer
+// on input and the size of the index on output; ErrorCode_OutputEnd means that the buffer is too small and *indexLen
+// is the required size. NativeLzma2ReadRange decodes *destLen bytes from the unpacked offset, starting at the last
+// dictionary reset before it; *destLen is reduced if the range ends after the end of the stream.
+ResultCode NativeLzma2BuildIndex(unsigned char *index, size_t *indexLen, const unsigned char *src, size_t srcLen, unsigned char prop);
+ResultCode NativeLzma2ReadRange(unsigned char *dest, size_t *destLen, unsigned long long offset, const unsigned char *src, size_t srcLen,
+	const unsigned char *index, size_t indexLen);
+
+// A worker pool for the one-call encoders. While a pool is attached with NativeSetThreadPool,
+// NativeLzmaCompressStream, NativeLzmaCompressMemory_V1 and NativeLzmaCompress2 lease their block
+// and match finder threads from it, and the workers stay parked between calls instead of being
+// created and joined on every call. Concurrent calls may share one pool. Attaching, detaching and
+// destroying a pool must not overlap with running calls.
+struct NativeThreadPool;
+NativeThreadPool *NativeCreateThreadPool();
+void NativeDestroyThreadPool(NativeThreadPool *pool);
+void NativeSetThreadPool(NativeThreadPool *pool);
+
+// The big buffers of the one-call functions (match finder hash and son arrays, dictionaries) come
+// from malloc by default. With NativeSetLargePageAlloc(true) they are allocated from huge pages
+// when the system provides them, falling back to transparent huge pages, normal pages and malloc.
+// Switching follows the same rules as NativeSetThreadPool. NativeGetLargePageAllocBackings returns
+// the NativeAllocBacking flags of every backing handed out since the allocator was enabled.
+enum NativeAllocBacking
+{
+	NativeAllocBacking_Heap = 1,
+	NativeAllocBacking_Pages = 2,
+	NativeAllocBacking_HugePages = 4,
+	NativeAllocBacking_TransparentHugePages = 8,
+};
+
+void NativeSetLargePageAlloc(bool enable);
+unsigned NativeGetLargePageAllocBackings();
+
+// NUMA placement for the block threads of NativeLzmaCompress2. NativeSetCpuTopology(true, NULL) detects the
+// nodes of the machine; a list like "0-3;4-7" (one cpu list per node, separated by ';') replaces detection with
+// a fake topology, for example to exercise placement on a single node machine. Each block thread is then bound
+// to its own group of cpus on one node and creates and first-touches its encoder there. Returns false if the
+// topology cannot be detected or parsed. Switching follows the same rules as NativeSetThreadPool.
+// NativeGetCpuPlacement copies the mapping chosen by the last NativeLzmaCompress2 call and returns the number of
+// placed block threads.
+struct NativeCpuPlacement
+{
+	int node;
+	int firstCpu;
+	int numCpus;
+	bool pinned;
+};
+
+bool NativeSetCpuTopology(bool enable, const char *topology);
+int NativeGetCpuPlacement(NativeCpuPlacement *items, int maxItems);
+
+// Decoder threads of NativeLzmaUncompress2. A stream is split at its dictionary resets and the parts are
+// decoded concurrently (see Lzma2DecMt.h); NativeLzmaCompress2 with more than one block thread starts every
+// block with a reset. 0 (the default) uses one thread per cpu the process may run on, 1 decodes sequentially.
+// Helper threads are leased from the pool of NativeSetThreadPool when one is attached.
+// Switching follows the same rules as NativeSetThreadPool.
+void NativeSetDecoderThreads(int numThreads);
+
+// Hash threads of the multithreaded match finder (numHashThreads of CLzmaEncProps, a power of 2 up to 16),
+// used by the encoder calls except NativeLzmaCompressMemory when they run with numThreads > 1, algo 1 and
+// btMode 1 or 2; 1 (the default) hashes on the match finder's own thread. More than 1 raises the numThreads
+// of the call to 1 + numHashThreads. The output does not depend on it. Switching follows the same rules as
+// NativeSetThreadPool.
+void NativeSetEncoderHashThreads(int numHashThreads);
+
+// Decoders of NativeLzmaUncompress_V1 and NativeLzmaUncompress2_V1 (see LzmaDecPool.h). A decoder stays
+// allocated after a call and is reused by the next call with the same properties (lc, lp, pb and dictionary
+// size), from any thread. NativeSetDecoderPoolSize limits the number of idle decoders, 16 by default;
+// 0 frees them and allocates a decoder on every call. A hit is a call that reused an idle decoder.
+struct NativeDecoderPoolCounters
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	int idle;
+};
+
+void NativeSetDecoderPoolSize(int maxIdle);
+void NativeGetDecoderPoolCounters(NativeDecoderPoolCounters *counters);
+
+// Streaming coders with constant memory. NativeStreamFeed takes input (*srcLen is set to the bytes taken) and
+// NativeStreamDrain hands out output (*destLen is set to the bytes written); if Feed does not take all input,
+// drain before feeding the rest. After NativeStreamEnd drain until *finished. An LZMA stream without end mark
+// finishes when its input ends after the last symbol. NativeStreamFlush makes an LZMA2 encoder write out all
+// input so far. NativeStreamSkip decodes up to count bytes without handing them out, NativeStreamEnableCrc
+// (before the first drain or skip) keeps the CRC32 of the output. A stream must be used by one thread at a time.
+struct NativeStream;
+
+ResultCode NativeLzmaEncoderCreate(NativeStream **stream, unsigned char *outProps, size_t *outPropsSize,
+	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, unsigned endMark, int numThreads);
+ResultCode NativeLzma2EncoderCreate(NativeStream **stream, unsigned char *outProp,
+	int level, unsigned dictSize, int lc, int lp, int pb, int algo, int fb, int btMode, int numHashBytes, unsigned mc, int numThreads, int blockSize, int blockThreads, int totalThreads);
+ResultCode NativeLzmaDecoderCreate(NativeStream **stream, const unsigned char *props, size_t propsSize);
+ResultCode NativeLzma2DecoderCreate(NativeStream **stream, unsigned char prop);
+
+ResultCode NativeStreamFeed(NativeStream *stream, const unsigned char *src, size_t *srcLen);
+ResultCode NativeStreamDrain(NativeStream *stream, unsigned char *dest, size_t *destLen, bool *finished);
+ResultCode NativeStreamSkip(NativeStream *stream, unsigned long long count, unsigned long long *skipped, bool *finished);
+ResultCode NativeStreamFlush(NativeStream *stream);
+ResultCode NativeStreamEnd(NativeStream *stream);
+ResultCode NativeStreamEnableCrc(NativeStream *stream);
+unsigned NativeStreamGetCrc(NativeStream *stream);
+void NativeStreamGetTotals(NativeStream *stream, unsigned long long *consumed, unsigned long long *produced);
+void NativeStreamDestroy(NativeStream *stream);
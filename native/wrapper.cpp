@@ -1,7 +1,9 @@
 #include <msclr\marshal.h>
 #include "wrapper.h"
 #include "native.h"
+#include "Benchmark.h"
 #include "Trace.h"
+#include "lzma/LzmaDec.h"
 
 using namespace System::IO;
 using namespace System::Threading;
@@ -180,3 +182,204 @@ void Helper2::LzmaUncompress(SharedSettings^ s)
 	s->WrittenSize = actualDestLen;
 	s->UsedSize = actualSrcLen;
 }
+
+String^ Benchmark::BlockThreadScaling(int inputSize, int level, int maxBlockThreads, bool useThreadPool)
+{
+	const int kMaxResults = 32;
+	NativeBenchmarkScalingResult results[kMaxResults];
+	int count = NativeBenchmarkBlockThreadScaling(results, kMaxResults, inputSize, level, maxBlockThreads, useThreadPool);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("threads  result     packed   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,7} {1,7} {2,10} {3,9:F3} {4,9:F2}", results[i].blockThreads, results[i].result,
+			(UInt64)results[i].packedSize, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+String^ Benchmark::MatchFinderHandoff(int inputSize, int dictSize)
+{
+	const int kMaxResults = 2;
+	NativeBenchmarkMatchFinderResult results[kMaxResults];
+	int count = NativeBenchmarkMatchFinderHandoff(results, kMaxResults, inputSize, dictSize);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("handoff     result  checksum   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-10} {1,7}  {2:X8} {3,9:F3} {4,9:F2}", results[i].lockFree ? "lock-free" : "semaphore",
+			results[i].result, results[i].checksum, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+String^ Benchmark::HashThreads(int inputSize, int level, int maxHashThreads, int runs)
+{
+	const int kMaxResults = 5;
+	NativeBenchmarkHashThreadsResult results[kMaxResults];
+	int count = NativeBenchmarkHashThreads(results, kMaxResults, inputSize, level, maxHashThreads, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("hash threads  result  identical    packed   seconds      MB/s  speedup");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,12} {1,7}  {2,-9} {3,9} {4,9:F3} {5,9:F2} {6,8:F2}", results[i].numHashThreads,
+			results[i].result, results[i].identical, (UInt64)results[i].packedSize, results[i].seconds, results[i].megabytesPerSecond, results[i].speedup));
+	return sb->ToString();
+}
+
+String^ Benchmark::WaitSpin(int inputSize, int blockSize, int blockThreads, int level)
+{
+	const int kMaxResults = 2;
+	NativeBenchmarkWaitSpinResult results[kMaxResults];
+	int count = NativeBenchmarkWaitSpin(results, kMaxResults, inputSize, blockSize, blockThreads, level);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("spin  result     packed      spins      parks   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,4} {1,7} {2,10} {3,10} {4,10} {5,9:F3} {6,9:F2}", results[i].maxSpinCount, results[i].result,
+			(UInt64)results[i].packedSize, results[i].counted ? results[i].spins.ToString() : gcnew String("n/a"),
+			results[i].counted ? results[i].parks.ToString() : gcnew String("n/a"), results[i].seconds, results[i].megabytesPerSecond));
+	if(count > 0 && !results[0].counted)
+		sb->AppendLine("wait counters are not compiled into this build, define ENABLE_WAIT_COUNTERS to count spins and parks");
+	return sb->ToString();
+}
+
+String^ Benchmark::DecodeKernel(int inputSize, int level, int runs, int fuzzStreams)
+{
+	const int kMaxResults = 2;
+	NativeBenchmarkDecodeKernelResult results[kMaxResults];
+	int count = NativeBenchmarkDecodeKernel(results, kMaxResults, inputSize, level, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("kernel     result  exact   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-9} {1,7}  {2,-5} {3,9:F3} {4,9:F2}", results[i].kernel == LZMA_DEC_KERNEL_X64 ? "x86-64" : "portable",
+			results[i].result, results[i].exact, results[i].seconds, results[i].megabytesPerSecond));
+	if(fuzzStreams > 0)
+	{
+		int mismatches = NativeCompareDecodeKernels(inputSize < (1 << 16) ? inputSize : (1 << 16), fuzzStreams, 1);
+		if(mismatches < 0)
+			sb->AppendLine("fuzz: no second kernel in this build");
+		else
+			sb->AppendLine(String::Format("fuzz: {0} of {1} streams differ", mismatches, fuzzStreams));
+	}
+	return sb->ToString();
+}
+
+String^ Benchmark::MatchCopy(int inputSize, int dictSize, int runs)
+{
+	const int kMaxResults = 6;
+	static const char *kCorpusNames[] = { "source", "log", "json" };
+	NativeBenchmarkMatchCopyResult results[kMaxResults];
+	int count = NativeBenchmarkMatchCopy(results, kMaxResults, inputSize, dictSize, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("corpus  dictionary  result  exact    packed   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-7} {1,-10} {2,7}  {3,-5} {4,9} {5,9:F3} {6,9:F2}", gcnew String(kCorpusNames[results[i].corpus]),
+			results[i].ring ? "ring" : "output", results[i].result, results[i].exact, (UInt64)results[i].packedSize, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+String^ Benchmark::BatchDecode(int numItems, int maxItemSize, int runs)
+{
+	const int kMaxResults = 2;
+	NativeBenchmarkBatchResult results[kMaxResults];
+	int count = NativeBenchmarkBatchDecode(results, kMaxResults, numItems, maxItemSize, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("calls     result  exact   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-8} {1,7}  {2,-5} {3,9:F3} {4,9:F2}", results[i].batch ? "batch" : "per item",
+			results[i].result, results[i].exact, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+String^ Benchmark::SkipOutput(int inputSize, int skipSize, int runs)
+{
+	const int kMaxResults = 2;
+	NativeBenchmarkSkipResult results[kMaxResults];
+	int count = NativeBenchmarkSkipOutput(results, kMaxResults, inputSize, skipSize, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("skip        result  exact   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-10} {1,7}  {2,-5} {3,9:F3} {4,9:F2}", results[i].skip ? "native" : "drain loop",
+			results[i].result, results[i].exact, results[i].seconds, results[i].megabytesPerSecond));
+	sb->AppendLine("(the drain loop reads into a 16 KiB buffer; it is not the managed Decoder.SkipOutputData)");
+	return sb->ToString();
+}
+
+String^ Benchmark::MatchLen(int inputSize, int level, int fb, int runs)
+{
+	const int kMaxResults = 12;
+	static const char *kCorpusNames[] = { "source", "log", "json" };
+	static const char *kKernelNames[] = { "bytes", "words", "sse2", "avx2" };
+	NativeBenchmarkMatchLenResult results[kMaxResults];
+	int count = NativeBenchmarkMatchLen(results, kMaxResults, inputSize, level, fb, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("corpus  kernel  result  identical    packed   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-7} {1,-6} {2,7}  {3,-9} {4,9} {5,9:F3} {6,9:F2}", gcnew String(kCorpusNames[results[i].corpus]),
+			gcnew String(kKernelNames[results[i].kernel]), results[i].result, results[i].identical, (UInt64)results[i].packedSize, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+String^ Benchmark::Normalize(int dictSize, int runs)
+{
+	const int kMaxResults = 3;
+	static const char *kKernelNames[] = { "scalar", "sse4.1", "avx2" };
+	NativeBenchmarkNormalizeResult results[kMaxResults];
+	int count = NativeBenchmarkNormalize(results, kMaxResults, dictSize, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("kernel  result  identical  table MB   ms/pass    ms/GB");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-7} {1,6}  {2,-9} {3,9:F1} {4,9:F2} {5,8:F3}", gcnew String(kKernelNames[results[i].kernel]),
+			results[i].result, results[i].identical, results[i].tableSize / 1048576.0, results[i].seconds * 1000, results[i].secondsPerGigabyte * 1000));
+	return sb->ToString();
+}
+
+String^ Benchmark::Prefetch(int inputSize, int dictSize, int runs)
+{
+	const int kMaxResults = 4;
+	NativeBenchmarkPrefetchResult results[kMaxResults];
+	int count = NativeBenchmarkPrefetch(results, kMaxResults, inputSize, dictSize, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("finder  prefetch  result  identical   seconds      MB/s  misses/pos");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-7} {1,-8} {2,7}  {3,-9} {4,9:F3} {5,9:F2}  {6,10}", gcnew String(results[i].hashChain ? "hc4" : "bt4"),
+			results[i].prefetch, results[i].result, results[i].identical, results[i].seconds, results[i].megabytesPerSecond,
+			results[i].cacheMisses < 0 ? gcnew String("n/a") : results[i].missesPerPosition.ToString("F3")));
+	return sb->ToString();
+}
+
+String^ Benchmark::HashLayout(int inputSize, int dictSize, int level, int runs)
+{
+	const int kMaxResults = 12;
+	static const char *kCorpusNames[] = { "source", "log", "json" };
+	static const char *kFinderNames[] = { "hc4", "bt4", "hb4" };
+	NativeBenchmarkHashLayoutResult results[kMaxResults];
+	int count = NativeBenchmarkHashLayout(results, kMaxResults, inputSize, dictSize, level, runs);
+	Text::StringBuilder^ sb = gcnew Text::StringBuilder();
+	sb->AppendLine("corpus  finder   mc  result  exact     packed   ratio   seconds      MB/s");
+	for(int i = 0; i < count; i++)
+		sb->AppendLine(String::Format("{0,-7} {1,-6} {2,4} {3,7}  {4,-5} {5,10} {6,7:F4} {7,9:F3} {8,9:F2}", gcnew String(kCorpusNames[results[i].corpus]),
+			gcnew String(kFinderNames[results[i].btMode]), results[i].mc == 0 ? gcnew String("def") : results[i].mc.ToString(), results[i].result,
+			results[i].exact, (UInt64)results[i].packedSize, results[i].ratio, results[i].seconds, results[i].megabytesPerSecond));
+	return sb->ToString();
+}
+
+void Settings::SetEncoderHashThreads(int numHashThreads)
+{
+	NativeSetEncoderHashThreads(numHashThreads);
+}
+
+int SelfTest::StreamRoundTrip(int inputSize, bool lzma2, bool endMark, int pieceSize)
+{
+	return NativeCheckStreamRoundTrip(inputSize, lzma2, endMark, pieceSize);
+}
+
+int SelfTest::LongStreamRoundTrip(long long inputSize, int dictSize)
+{
+	return NativeCheckLongStreamRoundTrip(inputSize, dictSize);
+}
+
+int SelfTest::HashThreads(int inputSize, int numHashThreads)
+{
+	return NativeCheckHashThreads(inputSize, numHashThreads);
+}
+
+int SelfTest::Placement(int numBlockThreads)
+{
+	return NativeCheckPlacement(numBlockThreads);
+}
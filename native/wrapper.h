@@ -31,4 +31,39 @@ namespace Native {
 		virtual void LzmaUncompress(Testing::SharedSettings^ s);
 	};
 
+	// Runs the native benchmarks from Benchmark.h and formats their results as text tables.
+	public ref class Benchmark abstract sealed
+	{
+	public:
+		static String^ BlockThreadScaling(int inputSize, int level, int maxBlockThreads, bool useThreadPool);
+		static String^ MatchFinderHandoff(int inputSize, int dictSize);
+		static String^ HashThreads(int inputSize, int level, int maxHashThreads, int runs);
+		static String^ WaitSpin(int inputSize, int blockSize, int blockThreads, int level);
+		static String^ DecodeKernel(int inputSize, int level, int runs, int fuzzStreams);
+		static String^ MatchCopy(int inputSize, int dictSize, int runs);
+		static String^ BatchDecode(int numItems, int maxItemSize, int runs);
+		static String^ SkipOutput(int inputSize, int skipSize, int runs);
+		static String^ MatchLen(int inputSize, int level, int fb, int runs);
+		static String^ Normalize(int dictSize, int runs);
+		static String^ Prefetch(int inputSize, int dictSize, int runs);
+		static String^ HashLayout(int inputSize, int dictSize, int level, int runs);
+	};
+
+	// Global settings of the native library (see native.h).
+	public ref class Settings abstract sealed
+	{
+	public:
+		static void SetEncoderHashThreads(int numHashThreads);
+	};
+
+	// Runs the native checks from Benchmark.h for the unit tests. Every check returns 0 (StatusCode_Ok) on success.
+	public ref class SelfTest abstract sealed
+	{
+	public:
+		static int StreamRoundTrip(int inputSize, bool lzma2, bool endMark, int pieceSize);
+		static int LongStreamRoundTrip(long long inputSize, int dictSize);
+		static int HashThreads(int inputSize, int numHashThreads);
+		static int Placement(int numBlockThreads);
+	};
+
 } } } }
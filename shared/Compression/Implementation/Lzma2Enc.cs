@@ -366,12 +366,7 @@ namespace ManagedLzma.LZMA.Master
                 mAlloc = alloc;
                 mAllocBig = allocBig;
 
-                mCoders = new CLzma2EncInternal[NUM_MT_CODER_THREADS_MAX];
-                for (int i = 0; i < mCoders.Length; i++)
-                {
-                    mCoders[i] = new CLzma2EncInternal();
-                    mCoders[i].mEnc = null;
-                }
+                mCoders = new CLzma2EncInternal[0];
 
 #if !_7ZIP_ST
                 mMtCoder = new CMtCoder();
@@ -445,6 +440,18 @@ namespace ManagedLzma.LZMA.Master
 
             public SRes Lzma2Enc_Encode(ISeqOutStream outStream, ISeqInStream inStream, ICompressProgress progress)
             {
+                if (mProps.mNumBlockThreads > mCoders.Length)
+                {
+                    CLzma2EncInternal[] coders = new CLzma2EncInternal[mProps.mNumBlockThreads];
+                    Array.Copy(mCoders, coders, mCoders.Length);
+                    for (int i = mCoders.Length; i < coders.Length; i++)
+                    {
+                        coders[i] = new CLzma2EncInternal();
+                        coders[i].mEnc = null;
+                    }
+                    mCoders = coders;
+                }
+
                 for (int i = 0; i < mProps.mNumBlockThreads; i++)
                 {
                     CLzma2EncInternal t = mCoders[i];
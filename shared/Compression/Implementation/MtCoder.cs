@@ -104,8 +104,10 @@ namespace ManagedLzma.LZMA.Master
             #endregion
         }
 
+        // Thread state is allocated for the number of threads that is actually used,
+        // NUM_MT_CODER_THREADS_MAX is only a sanity limit for the props.
 #if !_7ZIP_ST
-        public const int NUM_MT_CODER_THREADS_MAX = 32;
+        public const int NUM_MT_CODER_THREADS_MAX = 1024;
 #else
         public const int NUM_MT_CODER_THREADS_MAX = 1;
 #endif
@@ -119,16 +121,16 @@ namespace ManagedLzma.LZMA.Master
             internal ICompressProgress mProgress;
             internal SRes mRes;
             internal CCriticalSection mCS = new CCriticalSection();
-            internal ulong[] mInSizes = new ulong[NUM_MT_CODER_THREADS_MAX];
-            internal ulong[] mOutSizes = new ulong[NUM_MT_CODER_THREADS_MAX];
+            internal ulong[] mInSizes;
+            internal ulong[] mOutSizes;
 
             #endregion
 
             #region Methods
 
-            internal void MtProgress_Init(ICompressProgress progress)
+            internal void MtProgress_Init(ICompressProgress progress, int numThreads)
             {
-                for (uint i = 0; i < NUM_MT_CODER_THREADS_MAX; i++)
+                for (int i = 0; i < numThreads; i++)
                     mInSizes[i] = mOutSizes[i] = 0;
 
                 mTotalInSize = 0;
@@ -407,9 +409,7 @@ namespace ManagedLzma.LZMA.Master
             {
                 mAlloc = null;
 
-                mThreads = new CMtThread[NUM_MT_CODER_THREADS_MAX];
-                for (int i = 0; i < mThreads.Length; i++)
-                    mThreads[i] = new CMtThread(i, this);
+                mThreads = new CMtThread[0];
 
                 CriticalSection_Init(out mCS);
                 CriticalSection_Init(out mMtProgress.mCS);
@@ -424,13 +424,34 @@ namespace ManagedLzma.LZMA.Master
                 CriticalSection_Delete(mMtProgress.mCS);
             }
 
+            // Threads are constructed on first use and kept for later calls.
+            private void MtCoder_AllocThreads(int numThreads)
+            {
+                if (numThreads <= mThreads.Length)
+                    return;
+
+                CMtThread[] threads = new CMtThread[numThreads];
+                Array.Copy(mThreads, threads, mThreads.Length);
+                mMtProgress.mInSizes = new ulong[numThreads];
+                mMtProgress.mOutSizes = new ulong[numThreads];
+
+                for (int i = mThreads.Length; i < numThreads; i++)
+                    threads[i] = new CMtThread(i, this);
+
+                mThreads = threads;
+            }
+
             internal SRes MtCoder_Code()
             {
                 int numThreads = mNumThreads;
                 SRes res = SZ_OK;
                 mRes = SZ_OK;
 
-                mMtProgress.MtProgress_Init(mProgress);
+                if (numThreads <= 0 || numThreads > NUM_MT_CODER_THREADS_MAX)
+                    return SZ_ERROR_PARAM;
+                MtCoder_AllocThreads(numThreads);
+
+                mMtProgress.MtProgress_Init(mProgress, numThreads);
 
                 for (uint i = 0; i < numThreads; i++)
                 {
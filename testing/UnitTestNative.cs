@@ -0,0 +1,61 @@
+﻿using System;
+using System.Text;
+using System.Collections.Generic;
+using System.Linq;
+
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+
+namespace ManagedLzma.LZMA
+{
+    using SelfTest = Reference.Native.SelfTest;
+
+    // Checks of the native library that have no managed counterpart to compare against.
+    [TestClass]
+    public class UnitTestNative : TestBase
+    {
+        [TestMethod]
+        public void TestStreamWithEndMark()
+        {
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(200000, false, true, 4096));
+        }
+
+        [TestMethod]
+        public void TestStreamWithoutEndMark()
+        {
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(0, false, false, 4096));
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(1, false, false, 1));
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(200000, false, false, 4096));
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(200000, false, false, 1 << 20));
+        }
+
+        [TestMethod]
+        public void TestStreamLzma2()
+        {
+            Assert.AreEqual(0, SelfTest.StreamRoundTrip(200000, true, false, 4096));
+        }
+
+        // The match finder positions wrap after 4 GB, where they used to be normalized. Takes about a minute.
+        [TestMethod]
+        public void TestStreamPast4GB()
+        {
+            Assert.AreEqual(0, SelfTest.LongStreamRoundTrip((4L << 30) + (64 << 20), 1 << 20));
+        }
+
+        [TestMethod]
+        public void TestHashThreads()
+        {
+            Assert.AreEqual(0, SelfTest.HashThreads(3 << 20, 2));
+            Assert.AreEqual(0, SelfTest.HashThreads(3 << 20, 4));
+            Assert.AreEqual(0, SelfTest.HashThreads(3 << 20, 16));
+            Assert.AreEqual(0, SelfTest.HashThreads(100, 16));
+        }
+
+        // Uses a fake topology, so it runs the same on machines without NUMA.
+        [TestMethod]
+        public void TestPlacement()
+        {
+            Assert.AreEqual(0, SelfTest.Placement(4));
+            Assert.AreEqual(0, SelfTest.Placement(6));
+        }
+    }
+}